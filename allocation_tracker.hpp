@@ -0,0 +1,199 @@
+#ifndef ALLOCATION_TRACKER_HPP
+#define ALLOCATION_TRACKER_HPP
+
+#include <atomic>
+#include <new>
+#include <cstdint>
+#include <cstdlib>
+#include <algorithm>
+#include <malloc.h>
+
+using namespace std;
+
+// Process-wide heap accounting: allocation count, bytes allocated, live bytes
+// and the peak of live bytes, all in malloc usable sizes. The counts come from
+// replacement operator new/delete, which only exist in a program whose main
+// translation unit defines TRACK_ALLOCATIONS before including this header
+// (benchmark.cpp does; main.cpp when built with -DTRACK_ALLOCATIONS). Everywhere
+// else the counters stay zero and isHooked() is false. Allocations from every
+// thread are counted, over-aligned ones included.
+
+struct AllocationCounts {
+    uint64_t allocations = 0;
+    uint64_t bytes = 0;
+    uint64_t live = 0;
+};
+
+class AllocationTracker {
+private:
+    static inline atomic<uint64_t> allocations{0};
+    static inline atomic<uint64_t> bytes{0};
+    static inline atomic<uint64_t> live{0};
+    static inline atomic<uint64_t> peak{0};
+    static inline bool hooked = false;
+
+    static void raisePeak(uint64_t value) {
+        uint64_t seen = peak.load(memory_order_relaxed);
+        while (value > seen && !peak.compare_exchange_weak(seen, value, memory_order_relaxed)) {}
+    }
+
+public:
+    static void onAllocate(void* p) {
+        uint64_t size = malloc_usable_size(p);
+        allocations.fetch_add(1, memory_order_relaxed);
+        bytes.fetch_add(size, memory_order_relaxed);
+        raisePeak(live.fetch_add(size, memory_order_relaxed) + size);
+    }
+
+    static void onFree(void* p) {
+        if (p) live.fetch_sub(malloc_usable_size(p), memory_order_relaxed);
+    }
+
+    static void markHooked() {
+        hooked = true;
+    }
+
+    static bool isHooked() {
+        return hooked;
+    }
+
+    static AllocationCounts counts() {
+        AllocationCounts c;
+        c.allocations = allocations.load(memory_order_relaxed);
+        c.bytes = bytes.load(memory_order_relaxed);
+        c.live = live.load(memory_order_relaxed);
+        return c;
+    }
+
+    static uint64_t peakLive() {
+        return peak.load(memory_order_relaxed);
+    }
+
+    // Starts a peak window at the current live size and returns the old peak,
+    // which endPeakWindow folds back in so windows can nest
+    static uint64_t beginPeakWindow() {
+        return peak.exchange(live.load(memory_order_relaxed), memory_order_relaxed);
+    }
+
+    static void endPeakWindow(uint64_t outerPeak) {
+        raisePeak(outerPeak);
+    }
+};
+
+#ifdef TRACK_ALLOCATIONS
+
+static const bool allocationHooksInstalled = (AllocationTracker::markHooked(), true);
+
+inline void* trackedAllocate(size_t size) {
+    void* p = malloc(size ? size : 1);
+    if (p) AllocationTracker::onAllocate(p);
+    return p;
+}
+
+inline void* trackedAllocate(size_t size, align_val_t alignment) {
+    void* p = nullptr;
+    size_t align = max(static_cast<size_t>(alignment), sizeof(void*));
+    if (posix_memalign(&p, align, size ? size : 1) != 0) return nullptr;
+    AllocationTracker::onAllocate(p);
+    return p;
+}
+
+// Not inlined: once GCC sees free() under operator delete it reports every
+// new/delete pair as mismatched (-Wmismatched-new-delete)
+__attribute__((noinline)) inline void trackedFree(void* p) noexcept {
+    AllocationTracker::onFree(p);
+    free(p);
+}
+
+void* operator new(size_t size) {
+    void* p = trackedAllocate(size);
+    if (!p) throw bad_alloc();
+    return p;
+}
+
+void* operator new[](size_t size) {
+    void* p = trackedAllocate(size);
+    if (!p) throw bad_alloc();
+    return p;
+}
+
+void* operator new(size_t size, const nothrow_t&) noexcept {
+    return trackedAllocate(size);
+}
+
+void* operator new[](size_t size, const nothrow_t&) noexcept {
+    return trackedAllocate(size);
+}
+
+void operator delete(void* p) noexcept {
+    trackedFree(p);
+}
+
+void operator delete[](void* p) noexcept {
+    trackedFree(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    trackedFree(p);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+    trackedFree(p);
+}
+
+void operator delete(void* p, const nothrow_t&) noexcept {
+    trackedFree(p);
+}
+
+void operator delete[](void* p, const nothrow_t&) noexcept {
+    trackedFree(p);
+}
+
+// Over-aligned types (alignas above the default new alignment)
+void* operator new(size_t size, align_val_t alignment) {
+    void* p = trackedAllocate(size, alignment);
+    if (!p) throw bad_alloc();
+    return p;
+}
+
+void* operator new[](size_t size, align_val_t alignment) {
+    void* p = trackedAllocate(size, alignment);
+    if (!p) throw bad_alloc();
+    return p;
+}
+
+void* operator new(size_t size, align_val_t alignment, const nothrow_t&) noexcept {
+    return trackedAllocate(size, alignment);
+}
+
+void* operator new[](size_t size, align_val_t alignment, const nothrow_t&) noexcept {
+    return trackedAllocate(size, alignment);
+}
+
+void operator delete(void* p, align_val_t) noexcept {
+    trackedFree(p);
+}
+
+void operator delete[](void* p, align_val_t) noexcept {
+    trackedFree(p);
+}
+
+void operator delete(void* p, size_t, align_val_t) noexcept {
+    trackedFree(p);
+}
+
+void operator delete[](void* p, size_t, align_val_t) noexcept {
+    trackedFree(p);
+}
+
+void operator delete(void* p, align_val_t, const nothrow_t&) noexcept {
+    trackedFree(p);
+}
+
+void operator delete[](void* p, align_val_t, const nothrow_t&) noexcept {
+    trackedFree(p);
+}
+
+#endif
+
+#endif
@@ -0,0 +1,338 @@
+#ifndef ANALYSIS_HPP
+#define ANALYSIS_HPP
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cmath>
+#include <stdexcept>
+#include <cstdint>
+#include "codec.hpp"
+#include "stages.hpp"
+#include "symbol_models.hpp"
+#include "stage_profiler.hpp"
+#include "checksum.hpp"
+#include "async_io.hpp"
+#include "rsa.hpp"
+
+using namespace std;
+
+// Dry run of an encryption: what it would write and how long it would take,
+// without writing anything. An input larger than the sample budget is read as
+// evenly spaced blocks cut at word boundaries, the layout sampleContent uses.
+// The sample's word counts give the entropy and the code lengths the encoder
+// would assign; word and distinct-word counts are scaled to the whole input.
+// Stage times are measured on the sample where the analysis does the stage's
+// work anyway (read, tokenize, huffman-build) and on a calibration run of the
+// real encoder over a slice of it otherwise, then scaled by what each stage is
+// proportional to: words for tokenize and emit, distinct words for rsa and
+// huffman-build.
+
+struct AnalysisOptions {
+    EncryptionMode mode = EncryptionMode::HuffmanCaesar;
+    uint64_t sampleBytes = 16 << 20;        // read at most this much of the input; 0 = all of it
+    uint64_t calibrationBytes = 4 << 20;    // slice the encoder is timed on, at most
+    bool scaleToInput = true;               // shrink both with the input, see below
+
+    // The analysis costs about a read and count of the sample plus an encrypt
+    // of the slice, so fixed budgets cost most of the encrypt they project on
+    // inputs a few times their size. Scaled, the sample is at most a quarter
+    // and the slice a sixteenth of the input, with floors below which timings
+    // are noise.
+    uint64_t sampleBudget(uint64_t inputBytes) const {
+        if (!scaleToInput || sampleBytes == 0) return sampleBytes;
+        return min<uint64_t>(sampleBytes, max<uint64_t>(256 << 10, inputBytes / 4));
+    }
+    uint64_t calibrationBudget(uint64_t inputBytes) const {
+        if (!scaleToInput) return calibrationBytes;
+        return min<uint64_t>(calibrationBytes, max<uint64_t>(64 << 10, inputBytes / 16));
+    }
+};
+
+// One output format's projected size
+struct SizeEstimate {
+    string name;
+    double outputBytes = 0;
+    double codebookBytes = 0;    // huffman_hashmap.txt, or the dictionary inside a container
+};
+
+struct StageEstimate {
+    string name;
+    const char* timedOn = "";    // "sample", or "slice" for stages only the calibration run has
+    double timedMs = 0;
+    double projectedMs = 0;      // on the whole input
+};
+
+struct AnalysisReport {
+    EncryptionMode mode = EncryptionMode::HuffmanCaesar;
+    uint64_t inputBytes = 0;
+    uint64_t sampledBytes = 0;
+    uint64_t sampleWords = 0;
+    size_t sampleVocabulary = 0;
+    double words = 0;            // whole input, extrapolated when sampled
+    double vocabulary = 0;
+    double entropyBits = 0;      // Shannon entropy per word
+    double huffmanBits = 0;      // average code length per word
+    int longestCode = 0;
+    vector<SizeEstimate> sizes;
+    vector<StageEstimate> stages;
+    double analysisMs = 0;
+
+    bool sampled() const {
+        return sampledBytes < inputBytes;
+    }
+
+    double projectedMs() const {
+        double total = 0;
+        for (const StageEstimate& stage : stages) total += stage.projectedMs;
+        return total;
+    }
+
+    void print(ostream& out) const {
+        const double MB = 1048576.0;
+        out << "\n=== Analysis (dry run, nothing written) ===" << endl;
+        out << fixed << setprecision(2);
+        out << "Mode: " << (mode == EncryptionMode::Combined ? "combined" : "huffman-caesar") << endl;
+        out << "Input: " << inputBytes / MB << " MB, read " << sampledBytes / MB << " MB"
+            << (sampled() ? " (sampled; word and vocabulary counts extrapolated)" : " (exact counts)") << endl;
+        out << "Words: " << static_cast<uint64_t>(words) << ", distinct: " << static_cast<uint64_t>(vocabulary)
+            << " (sample: " << sampleWords << ", " << sampleVocabulary << ")" << endl;
+        out << "Entropy: " << entropyBits << " bits/word, Huffman: " << huffmanBits
+            << " bits/word, longest code: " << longestCode << " bits" << endl;
+
+        out << "  " << left << setw(28) << "output" << right << setw(12) << "output MB" << setw(13) << "codebook MB"
+            << setw(11) << "bits/word" << endl;
+        for (const SizeEstimate& size : sizes) {
+            double bitsPerWord = words > 0 ? (size.outputBytes + size.codebookBytes) * 8 / words : 0;
+            out << "  " << left << setw(28) << size.name << right << setw(12) << size.outputBytes / MB << setw(13)
+                << size.codebookBytes / MB << setw(11) << bitsPerWord << endl;
+        }
+
+        out << "  " << left << setw(28) << "stage" << right << setw(12) << "timed on" << setw(13) << "timed ms"
+            << setw(14) << "projected ms" << endl;
+        for (const StageEstimate& stage : stages) {
+            out << "  " << left << setw(28) << stage.name << right << setw(12) << stage.timedOn << setw(13)
+                << stage.timedMs << setw(14) << stage.projectedMs << endl;
+        }
+        out << "  " << left << setw(28) << "total (write not included)" << right << setw(39) << projectedMs()
+            << endl;
+        out << "Analysis took " << analysisMs << " ms";
+        if (projectedMs() > 0) out << " (" << 100 * analysisMs / projectedMs() << "% of the projected encrypt)";
+        out << endl;
+    }
+};
+
+// Reads at most options.sampleBudget bytes of a file into sample: all of it
+// when it fits, otherwise evenly spaced blocks as sampleContent would take
+// them. Returns the file's size.
+inline uint64_t readSample(const string& filename, const AnalysisOptions& options, string& sample) {
+    ifstream file(filename, ios::binary | ios::ate);
+    if (!file) throw runtime_error("Failed to open input file: " + filename);
+    uint64_t size = static_cast<uint64_t>(file.tellg());
+    uint64_t budget = options.sampleBudget(size);
+    sample.clear();
+    if (budget == 0 || size <= budget) {
+        if (!readFileAsync(filename, sample)) throw runtime_error("Failed to open input file: " + filename);
+        return size;
+    }
+
+    const uint64_t blocks = 16;
+    const uint64_t slack = 256;
+    uint64_t blockSize = budget / blocks;
+    uint64_t stride = size / blocks;
+    string window;
+    auto toBoundary = [&](size_t pos) {
+        size_t limit = min<size_t>(window.size(), pos + slack);
+        size_t at = pos;
+        while (at < limit && !isTokenSpace(window[at])) at++;
+        while (at < limit && isTokenSpace(window[at])) at++;
+        return at < limit ? at : pos;
+    };
+    sample.reserve(budget + 2 * blocks * slack);
+    for (uint64_t b = 0; b < blocks; ++b) {
+        uint64_t begin = b * stride;
+        window.resize(min(size - begin, blockSize + 2 * slack));
+        file.seekg(static_cast<streamoff>(begin));
+        if (!file.read(&window[0], static_cast<streamsize>(window.size()))) {
+            throw runtime_error("Failed to read input file: " + filename);
+        }
+        size_t start = b == 0 ? 0 : toBoundary(0);
+        size_t end = toBoundary(min<size_t>(window.size(), start + blockSize));
+        sample.append(window, start, end - start);
+    }
+    return size;
+}
+
+// Milliseconds since start
+inline double elapsedMs(chrono::steady_clock::time_point start) {
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+// Analyzes sample as a stand-in for inputBytes of input
+inline AnalysisReport analyzeSample(string_view sample, uint64_t inputBytes, const RSA& rsa,
+                                    const AnalysisOptions& options) {
+    AnalysisReport report;
+    report.mode = options.mode;
+    report.inputBytes = inputBytes;
+    report.sampledBytes = sample.size();
+    double scale = sample.empty() ? 1.0 : static_cast<double>(inputBytes) / sample.size();
+
+    // Word counts, timed as the tokenize stage at the sample's vocabulary size
+    SymbolTable symbols;
+    vector<int> frequency, wordIds;
+    auto start = chrono::steady_clock::now();
+    countTokens(sample, symbols, frequency, &wordIds);
+    double tokenizeMs = elapsedMs(start);
+    report.sampleWords = wordIds.size();
+    report.sampleVocabulary = symbols.size();
+    report.words = wordIds.size() * scale;
+
+    // Heaps' law V(n) ~ n^beta, beta measured between the first half of the
+    // words and all of them (ids are handed out in first-seen order, so the
+    // largest id in the first half is its vocabulary). Heaps' law overshoots a
+    // vocabulary that is running out, so the Chao1 estimate of how many words
+    // there are in all, from the words seen once and twice, caps it.
+    report.vocabulary = symbols.size();
+    if (report.sampled()) {
+        int halfVocabulary = 0;
+        for (size_t i = 0; i < wordIds.size() / 2; ++i) halfVocabulary = max(halfVocabulary, wordIds[i] + 1);
+        double beta = 0;
+        if (halfVocabulary > 0 && symbols.size() > static_cast<size_t>(halfVocabulary)) {
+            beta = min(1.0, log2(static_cast<double>(symbols.size()) / halfVocabulary));
+        }
+        double once = 0, twice = 0;
+        for (int f : frequency) {
+            once += f == 1;
+            twice += f == 2;
+        }
+        double richness = symbols.size() + (twice > 0 ? once * once / (2 * twice) : once * (once - 1) / 2);
+        report.vocabulary = max<double>(symbols.size(), min(symbols.size() * pow(scale, beta), richness));
+    }
+
+    // Entropy against the lengths buildHuffmanCodes assigns. RSA maps distinct
+    // words to distinct keys, so both modes get the same lengths.
+    start = chrono::steady_clock::now();
+    vector<HuffmanCode> codes = buildHuffmanCodes(frequency);
+    double buildMs = elapsedMs(start);
+    double total = static_cast<double>(wordIds.size());
+    double entropy = 0, codeBits = 0;
+    for (size_t id = 0; id < frequency.size(); ++id) {
+        entropy += frequency[id] * log2(total / frequency[id]);
+        codeBits += static_cast<double>(frequency[id]) * codes[id].length;
+        report.longestCode = max(report.longestCode, static_cast<int>(codes[id].length));
+    }
+    if (total > 0) {
+        report.entropyBits = entropy / total;
+        report.huffmanBits = codeBits / total;
+    }
+
+    // huffman_hashmap.txt holds "key:code\n" per distinct word. A combined key
+    // is the word's characters as space-separated ciphertext numbers; there are
+    // only 256 characters, so their lengths are looked up, not encrypted.
+    size_t keyLength[256];
+    for (int b = 0; b < 256; ++b) keyLength[b] = 1;
+    if (options.mode == EncryptionMode::Combined) {
+        long long characters[256];
+        for (int b = 0; b < 256; ++b) characters[b] = static_cast<char>(b);    // as encryptSymbols widens them
+        rsa.encryptBatch(characters, characters, 256);
+        for (int b = 0; b < 256; ++b) keyLength[b] = to_string(characters[b]).size() + 1;
+    }
+    double codebookBytes = 0;
+    for (size_t id = 0; id < symbols.size(); ++id) {
+        string_view word = symbols.symbol(id);
+        size_t key = options.mode == EncryptionMode::Combined ? 0 : word.size();
+        if (options.mode == EncryptionMode::Combined) {
+            for (char c : word) key += keyLength[static_cast<unsigned char>(c)];
+            key -= !word.empty();
+        }
+        codebookBytes += key + 1 + codes[id].length + 1;
+    }
+    if (symbols.size() > 0) codebookBytes *= report.vocabulary / symbols.size();
+
+    // Text output: one digit per code bit and a space between words
+    SizeEstimate text;
+    text.name = options.mode == EncryptionMode::Combined ? "text (combined)" : "text (huffman-caesar)";
+    text.outputBytes = report.words * report.huffmanBits + max(0.0, report.words - 1);
+    text.codebookBytes = codebookBytes;
+    report.sizes.push_back(text);
+
+    // Compact containers, estimated as --compact auto would on its own sample
+    uint64_t sliceBytes = options.calibrationBudget(inputBytes);
+    string modelSample = sampleContent(sample, min<uint64_t>(sliceBytes, 1 << 20));
+    if (!modelSample.empty()) {
+        double bytesPerChar = options.mode == EncryptionMode::Combined ? to_string(rsa.getPublicKey().second).size() + 1 : 1;
+        SubwordModel subword;
+        for (const ModelEstimate& estimate : estimateSymbolModels(
+                 modelSample, static_cast<double>(inputBytes) / modelSample.size(), bytesPerChar, subword)) {
+            SizeEstimate compact;
+            compact.name = string("compact ") + symbolModelName(estimate.model);
+            compact.outputBytes = estimate.payloadBytes;
+            compact.codebookBytes = estimate.dictionaryBytes;
+            report.sizes.push_back(compact);
+        }
+    }
+
+    // Time the real encoder on a slice. Its tables are smaller than a whole
+    // input's and stay in cache longer, so emit is scaled up by however much
+    // slower per word tokenizing the whole sample was than tokenizing the slice.
+    string slice = sampleContent(sample, sliceBytes);
+    StageProfiler calibration;
+    string encrypted;
+    Codebook codebook;
+    ChecksumBuilder checksums;
+    if (options.mode == EncryptionMode::Combined) {
+        CombinedEncryption::encrypt(slice, rsa, encrypted, codebook, nullptr, &calibration, &checksums);
+    } else {
+        HuffmanCaesarEncryption::encrypt(slice, rsa, encrypted, codebook, nullptr, &calibration, &checksums);
+    }
+    double sliceWords = static_cast<double>(calibration.stageTokens("emit"));
+    double sliceVocabulary = static_cast<double>(codebook.size());
+    double slowdown = 1;
+    if (sliceWords > 0 && report.sampleWords > 0 && calibration.stageMs("tokenize") > 0) {
+        slowdown = max(1.0, tokenizeMs / report.sampleWords / (calibration.stageMs("tokenize") / sliceWords));
+    }
+
+    auto addStage = [&](const char* name, const char* timedOn, double ms, double projectedMs) {
+        StageEstimate stage;
+        stage.name = name;
+        stage.timedOn = timedOn;
+        stage.timedMs = ms;
+        stage.projectedMs = projectedMs;
+        report.stages.push_back(stage);
+    };
+    addStage("tokenize", "sample", tokenizeMs, report.sampleWords ? tokenizeMs * report.words / report.sampleWords : 0);
+    if (options.mode == EncryptionMode::Combined) {
+        double rsaMs = calibration.stageMs("rsa");
+        addStage("rsa", "slice", rsaMs, sliceVocabulary > 0 ? rsaMs * report.vocabulary / sliceVocabulary : 0);
+    }
+    addStage("huffman-build", "sample", buildMs,
+             report.sampleVocabulary ? buildMs * report.vocabulary / report.sampleVocabulary : 0);
+    double emitMs = calibration.stageMs("emit");
+    addStage("emit", "slice", emitMs, sliceWords > 0 ? emitMs * slowdown * report.words / sliceWords : 0);
+    return report;
+}
+
+// Samples a file and analyzes it, timing the sample read as the read stage
+inline AnalysisReport analyzeFile(const string& filename, const RSA& rsa, const AnalysisOptions& options = {}) {
+    auto start = chrono::steady_clock::now();
+    string sample;
+    uint64_t inputBytes = readSample(filename, options, sample);
+    double readMs = elapsedMs(start);
+
+    AnalysisReport report = analyzeSample(sample, inputBytes, rsa, options);
+    StageEstimate read;
+    read.name = "read";
+    read.timedOn = "sample";
+    read.timedMs = readMs;
+    read.projectedMs = sample.empty() ? 0 : readMs * inputBytes / sample.size();
+    report.stages.insert(report.stages.begin(), read);
+    report.analysisMs = elapsedMs(start);
+    return report;
+}
+
+#endif
@@ -0,0 +1,410 @@
+#ifndef APPROXIMATE_HPP
+#define APPROXIMATE_HPP
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <fstream>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdio>
+#include "tokenizer.hpp"
+#include "codebook.hpp"
+#include "codec.hpp"
+#include "rsa.hpp"
+
+using namespace std;
+
+// Approximate (heavy-hitter) codebooks. Only the K most frequent words, found
+// with a Count-Min sketch, get Huffman codes; every other word is written as
+// the escape code followed by one literal word: its text (the RSA ciphertext
+// in combined mode) in a byte-level Huffman code ended by an end-of-literal
+// code. Codebook size and build time depend on K, not on the vocabulary.
+//
+// Codebook file: the usual "token:code" lines for the K words, ":code" for the
+// escape (no real word is empty), then a "%literal" line followed by "hh:code"
+// per byte value (two hex digits) and "end:code".
+
+inline uint64_t mixHash(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    return h ^ (h >> 33);
+}
+
+// Count-Min sketch with conservative update: only the rows at the current
+// minimum are raised, which keeps overestimates for rare words much smaller
+class CountMinSketch {
+private:
+    static const int DEPTH = 4;
+    vector<uint32_t> counters;    // DEPTH rows of `width` counters
+    size_t mask;
+
+public:
+    explicit CountMinSketch(size_t width) {
+        size_t size = 1024;
+        while (size < width) size <<= 1;
+        mask = size - 1;
+        counters.assign(size * DEPTH, 0);
+    }
+
+    // Counts one occurrence and returns the new estimate
+    uint64_t add(uint64_t tokenHash) {
+        uint64_t h1 = mixHash(tokenHash);
+        uint64_t h2 = (h1 >> 32) | 1;
+        uint32_t* cell[DEPTH];
+        uint32_t estimate = UINT32_MAX;
+        for (int row = 0; row < DEPTH; ++row) {
+            cell[row] = &counters[row * (mask + 1) + ((h1 + row * h2) & mask)];
+            estimate = min(estimate, *cell[row]);
+        }
+        if (estimate == UINT32_MAX) return estimate;
+        estimate++;
+        for (int row = 0; row < DEPTH; ++row) {
+            if (*cell[row] < estimate) *cell[row] = estimate;
+        }
+        return estimate;
+    }
+};
+
+// The K words with the highest sketch estimates seen so far, in a min-heap so
+// the weakest candidate is replaced in O(log K). Words are views into the input.
+class TopKTracker {
+private:
+    struct Candidate {
+        string_view token;
+        uint64_t estimate;
+    };
+
+    size_t capacity;
+    vector<Candidate> heap;
+    unordered_map<string_view, size_t> position;   // token -> heap index
+
+    void place(size_t i, Candidate candidate) {
+        heap[i] = candidate;
+        position[candidate.token] = i;
+    }
+
+    void siftUp(size_t i) {
+        Candidate moving = heap[i];
+        while (i > 0 && heap[(i - 1) / 2].estimate > moving.estimate) {
+            place(i, heap[(i - 1) / 2]);
+            i = (i - 1) / 2;
+        }
+        place(i, moving);
+    }
+
+    void siftDown(size_t i) {
+        Candidate moving = heap[i];
+        while (true) {
+            size_t child = 2 * i + 1;
+            if (child >= heap.size()) break;
+            if (child + 1 < heap.size() && heap[child + 1].estimate < heap[child].estimate) child++;
+            if (heap[child].estimate >= moving.estimate) break;
+            place(i, heap[child]);
+            i = child;
+        }
+        place(i, moving);
+    }
+
+public:
+    explicit TopKTracker(size_t k) : capacity(k) {
+        heap.reserve(k);
+        position.reserve(k * 2);
+    }
+
+    void offer(string_view token, uint64_t estimate) {
+        if (capacity == 0) return;
+        auto it = position.find(token);
+        if (it != position.end()) {
+            // Estimates only grow, so the entry can only move down
+            heap[it->second].estimate = estimate;
+            siftDown(it->second);
+            return;
+        }
+        if (heap.size() < capacity) {
+            heap.push_back({token, estimate});
+            siftUp(heap.size() - 1);
+            return;
+        }
+        if (estimate <= heap[0].estimate) return;
+        position.erase(heap[0].token);
+        heap[0] = {token, estimate};
+        siftDown(0);
+    }
+
+    vector<string_view> tokens() const {
+        vector<string_view> result;
+        result.reserve(heap.size());
+        for (const Candidate& candidate : heap) result.push_back(candidate.token);
+        return result;
+    }
+};
+
+// Byte-level Huffman code for escaped words
+class LiteralCoder {
+public:
+    static const int END = 256;    // end-of-literal symbol
+
+private:
+    struct CodeHasher {
+        size_t operator()(const HuffmanCode& code) const {
+            return static_cast<size_t>(code.hash());
+        }
+    };
+
+    vector<HuffmanCode> codes = vector<HuffmanCode>(END + 1);    // length 0 = byte never escaped
+    unordered_map<HuffmanCode, int, CodeHasher> symbolOf;
+
+public:
+    // frequency has END + 1 entries; symbols that never occur get no code
+    void build(const vector<int>& frequency) {
+        vector<int> symbols, compact;
+        for (int symbol = 0; symbol <= END; ++symbol) {
+            if (frequency[symbol] > 0) {
+                symbols.push_back(symbol);
+                compact.push_back(frequency[symbol]);
+            }
+        }
+        vector<HuffmanCode> built = buildHuffmanCodes(compact);
+        clear();
+        for (size_t i = 0; i < symbols.size(); ++i) setCode(symbols[i], built[i]);
+    }
+
+    void clear() {
+        codes.assign(END + 1, HuffmanCode());
+        symbolOf.clear();
+    }
+
+    void setCode(int symbol, HuffmanCode code) {
+        codes[symbol] = code;
+        symbolOf[code] = symbol;
+    }
+
+    const HuffmanCode& code(int symbol) const {
+        return codes[symbol];
+    }
+
+    bool empty() const {
+        return symbolOf.empty();
+    }
+
+    // Appends the shifted digits of text followed by the end code
+    void encode(string_view text, const CaesarShift& caesar, string& out) const {
+        for (char c : text) appendShiftedCode(out, codes[static_cast<unsigned char>(c)], caesar);
+        appendShiftedCode(out, codes[END], caesar);
+    }
+
+    bool decode(string_view digits, const CaesarShift& caesar, string& text) const {
+        HuffmanCode code;
+        for (char c : digits) {
+            int bit = caesar.bit(c);
+            if (bit < 0 || code.length == HuffmanCode::MAX_LENGTH) return false;
+            code.append(bit);
+            auto it = symbolOf.find(code);
+            if (it == symbolOf.end()) continue;
+            if (it->second == END) return true;
+            text.push_back(static_cast<char>(it->second));
+            code = HuffmanCode();
+        }
+        return false;
+    }
+};
+
+struct ApproximateCodebook {
+    Codebook codes;              // top-K words, keyed as in huffman_hashmap.txt
+    bool hasEscape = false;
+    HuffmanCode escape;
+    LiteralCoder literals;
+
+    void clear() {
+        codes.clear();
+        hasEscape = false;
+        escape = HuffmanCode();
+        literals.clear();
+    }
+};
+
+// Sketch width per tracked word: enough that a rare word's overestimate rarely
+// lifts it into the top K
+inline size_t sketchWidthFor(size_t topK) {
+    return max<size_t>(4096, topK * 8);
+}
+
+// Encrypts content with a top-K codebook. Three passes over content: sketch and
+// track candidates, count candidates exactly (and escaped literal bytes), encode.
+inline void encryptContentApproximate(string_view content, EncryptionMode mode, const RSA& rsa, const CaesarShift& caesar,
+                                      size_t topK, string& out, ApproximateCodebook& book) {
+    CountMinSketch sketch(sketchWidthFor(topK));
+    TopKTracker tracker(topK);
+    Tokenizer tokenizer(content);
+    string_view token;
+    while (tokenizer.next(token)) {
+        tracker.offer(token, sketch.add(hashToken(token)));
+    }
+
+    SymbolTable symbols;
+    for (string_view candidate : tracker.tokens()) symbols.intern(candidate);
+    const int escapeId = static_cast<int>(symbols.size());
+    vector<int> frequency(escapeId + 1, 0);
+    vector<int> literalFrequency(LiteralCoder::END + 1, 0);
+    // RSA here works per character, so the ciphertext of every byte value is
+    // computed once and escaped words are encrypted by table lookup
+    vector<string> cipherOfByte;
+    if (mode == EncryptionMode::Combined) {
+        for (int c = 0; c < 256; ++c) cipherOfByte.push_back(to_string(rsa.encrypt(static_cast<char>(c))));
+    }
+    string literal;
+    auto literalText = [&](string_view word) -> const string& {
+        literal.clear();
+        if (mode != EncryptionMode::Combined) {
+            literal.assign(word.data(), word.size());
+            return literal;
+        }
+        for (size_t i = 0; i < word.size(); ++i) {
+            if (i) literal.push_back(' ');
+            literal += cipherOfByte[static_cast<unsigned char>(word[i])];
+        }
+        return literal;
+    };
+
+    tokenizer = Tokenizer(content);
+    while (tokenizer.next(token)) {
+        int id = symbols.find(token);
+        if (id >= 0) {
+            frequency[id]++;
+            continue;
+        }
+        frequency[escapeId]++;
+        for (char c : literalText(token)) literalFrequency[static_cast<unsigned char>(c)]++;
+        literalFrequency[LiteralCoder::END]++;
+    }
+
+    book.clear();
+    if (frequency[escapeId] == 0) frequency.pop_back();
+    vector<HuffmanCode> codes = buildHuffmanCodes(frequency);
+    book.codes.reserve(escapeId);
+    for (int id = 0; id < escapeId; ++id) {
+        string_view word = symbols.symbol(id);
+        if (mode == EncryptionMode::Combined) {
+            book.codes.insert_or_assign(rsa.encryptString(word), codes[id]);
+        } else {
+            book.codes.insert_or_assign(word, codes[id]);
+        }
+    }
+    if (static_cast<int>(codes.size()) > escapeId) {
+        book.hasEscape = true;
+        book.escape = codes[escapeId];
+        book.literals.build(literalFrequency);
+    }
+
+    out.clear();
+    tokenizer = Tokenizer(content);
+    bool firstWord = true;
+    while (tokenizer.next(token)) {
+        if (!firstWord) out.push_back(' ');
+        firstWord = false;
+        int id = symbols.find(token);
+        if (id >= 0) {
+            appendShiftedCode(out, codes[id], caesar);
+        } else {
+            appendShiftedCode(out, book.escape, caesar);
+            out.push_back(' ');
+            book.literals.encode(literalText(token), caesar, out);
+        }
+    }
+}
+
+// Decodes text that may contain escaped literals. reverse maps codes to plain
+// words; literals are RSA-decrypted in combined mode.
+inline void decodeApproximateWords(string_view encrypted, const ReverseCodebook& reverse, const CaesarShift& caesar,
+                                   const HuffmanCode& escape, const LiteralCoder& literals,
+                                   EncryptionMode mode, const RSA& rsa, string& out) {
+    Tokenizer tokenizer(encrypted);
+    string_view word, token;
+    bool firstWord = out.empty();
+    string literal;
+    while (tokenizer.next(word)) {
+        HuffmanCode code;
+        if (!parseShiftedCode(word, caesar, code)) {
+            throw runtime_error("Malformed code: " + string(word));
+        }
+        if (!firstWord) out.push_back(' ');
+        firstWord = false;
+        if (code == escape) {
+            literal.clear();
+            if (!tokenizer.next(word) || !literals.decode(word, caesar, literal)) {
+                throw runtime_error("Malformed literal after escape code");
+            }
+            out += mode == EncryptionMode::Combined ? rsa.decryptString(literal) : literal;
+            continue;
+        }
+        if (!reverse.lookup(code, token)) {
+            throw runtime_error("Unknown code: " + string(word));
+        }
+        out.append(token.data(), token.size());
+    }
+}
+
+inline void writeApproximateCodebook(ostream& file, const ApproximateCodebook& book) {
+    for (const auto& pair : book.codes) {
+        file << pair.first << ":" << pair.second << "\n";
+    }
+    if (book.hasEscape) {
+        file << ":" << book.escape << "\n";
+        file << "%literal\n";
+        char hex[3];
+        for (int symbol = 0; symbol < LiteralCoder::END; ++symbol) {
+            if (book.literals.code(symbol).length == 0) continue;
+            snprintf(hex, sizeof(hex), "%02x", symbol);
+            file << hex << ":" << book.literals.code(symbol) << "\n";
+        }
+        file << "end:" << book.literals.code(LiteralCoder::END) << "\n";
+    }
+}
+
+inline void saveApproximateCodebookFile(const ApproximateCodebook& book, const string& filename) {
+    ofstream file(filename, ios::binary);
+    if (!file) throw runtime_error("Failed to create codebook file: " + filename);
+    writeApproximateCodebook(file, book);
+    if (!file) throw runtime_error("Failed to write codebook file: " + filename);
+}
+
+// Reads plain and approximate codebooks alike (a plain one has no escape)
+inline void readApproximateCodebook(istream& file, ApproximateCodebook& book) {
+    book.clear();
+    bool inLiterals = false;
+    string line;
+    while (getline(file, line)) {
+        if (line == "%literal") {
+            inLiterals = true;
+            continue;
+        }
+        size_t colon = line.rfind(':');
+        HuffmanCode code;
+        if (colon == string::npos || !HuffmanCode::parse(string_view(line).substr(colon + 1), code)) continue;
+        string_view key = string_view(line).substr(0, colon);
+        if (inLiterals) {
+            if (key == "end") {
+                book.literals.setCode(LiteralCoder::END, code);
+            } else if (key.size() == 2) {
+                book.literals.setCode(stoi(string(key), nullptr, 16), code);
+            }
+        } else if (key.empty()) {
+            book.hasEscape = true;
+            book.escape = code;
+        } else {
+            book.codes.insert_or_assign(key, code);
+        }
+    }
+}
+
+inline void loadApproximateCodebookFile(const string& filename, ApproximateCodebook& book) {
+    ifstream file(filename, ios::binary);
+    if (!file) throw runtime_error("Failed to open codebook file: " + filename);
+    readApproximateCodebook(file, book);
+}
+
+#endif
@@ -0,0 +1,665 @@
+#ifndef ASYNC_IO_HPP
+#define ASYNC_IO_HPP
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <deque>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <stdexcept>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#ifdef __linux__
+#include <linux/io_uring.h>
+#endif
+
+using namespace std;
+
+// Asynchronous file I/O used by the encrypt/decrypt stages so disk transfers
+// overlap with the RSA/Huffman/Caesar work. Requests are positional (pread /
+// pwrite style) and identified by a caller-chosen tag.
+class AsyncIOBackend {
+public:
+    virtual ~AsyncIOBackend() = default;
+
+    virtual void submitRead(int fd, char *buffer, size_t length, uint64_t offset, uint64_t tag) = 0;
+    virtual void submitWrite(int fd, const char *buffer, size_t length, uint64_t offset, uint64_t tag) = 0;
+
+    // Blocks until one request completes; result is bytes transferred or -errno
+    virtual void wait(uint64_t &tag, long &result) = 0;
+
+    virtual const char *name() const = 0;
+};
+
+#ifdef __linux__
+// io_uring through the raw syscalls (no liburing dependency)
+class IoUringBackend : public AsyncIOBackend {
+private:
+    int ringFd = -1;
+    void *sqRing = MAP_FAILED, *cqRing = MAP_FAILED;
+    size_t sqRingSize = 0, cqRingSize = 0;
+    io_uring_sqe *sqes = static_cast<io_uring_sqe *>(MAP_FAILED);
+    size_t sqesSize = 0;
+
+    unsigned *sqHead, *sqTail, *sqMask, *sqArray;
+    unsigned *cqHead, *cqTail, *cqMask;
+    io_uring_cqe *cqes;
+
+    IoUringBackend() = default;
+
+    static int enter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags) {
+        return static_cast<int>(syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0));
+    }
+
+    void submit(uint8_t opcode, int fd, const char *buffer, size_t length, uint64_t offset, uint64_t tag) {
+        unsigned tail = *sqTail;
+        if (tail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) > *sqMask) {
+            throw runtime_error("io_uring submission queue full");
+        }
+        unsigned index = tail & *sqMask;
+        io_uring_sqe &sqe = sqes[index];
+        memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = opcode;
+        sqe.fd = fd;
+        sqe.addr = reinterpret_cast<uint64_t>(buffer);
+        sqe.len = static_cast<uint32_t>(length);
+        sqe.off = offset;
+        sqe.user_data = tag;
+        sqArray[index] = index;
+        __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+
+        while (enter(ringFd, 1, 0, 0) < 0) {
+            if (errno != EINTR && errno != EAGAIN) {
+                throw runtime_error(string("io_uring_enter failed: ") + strerror(errno));
+            }
+        }
+    }
+
+public:
+    // Returns nullptr when the kernel has no (usable) io_uring
+    static unique_ptr<IoUringBackend> create(unsigned entries = 32) {
+        unique_ptr<IoUringBackend> ring(new IoUringBackend());
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        ring->ringFd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+        if (ring->ringFd < 0) return nullptr;
+
+        // IORING_OP_READ/WRITE arrived in the same release as this feature bit
+        if (!(params.features & IORING_FEAT_RW_CUR_POS)) return nullptr;
+
+        ring->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        ring->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool singleMap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (singleMap) {
+            ring->sqRingSize = ring->cqRingSize = max(ring->sqRingSize, ring->cqRingSize);
+        }
+
+        ring->sqRing = mmap(nullptr, ring->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                            ring->ringFd, IORING_OFF_SQ_RING);
+        if (ring->sqRing == MAP_FAILED) return nullptr;
+        if (singleMap) {
+            ring->cqRing = ring->sqRing;
+        } else {
+            ring->cqRing = mmap(nullptr, ring->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                ring->ringFd, IORING_OFF_CQ_RING);
+            if (ring->cqRing == MAP_FAILED) return nullptr;
+        }
+        ring->sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+        ring->sqes = static_cast<io_uring_sqe *>(mmap(nullptr, ring->sqesSize, PROT_READ | PROT_WRITE,
+                                                      MAP_SHARED | MAP_POPULATE, ring->ringFd, IORING_OFF_SQES));
+        if (ring->sqes == MAP_FAILED) return nullptr;
+
+        char *sq = static_cast<char *>(ring->sqRing);
+        char *cq = static_cast<char *>(ring->cqRing);
+        ring->sqHead = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+        ring->sqTail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+        ring->sqMask = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+        ring->sqArray = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+        ring->cqHead = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+        ring->cqTail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+        ring->cqMask = reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+        ring->cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+        return ring;
+    }
+
+    ~IoUringBackend() override {
+        if (sqes != MAP_FAILED) munmap(sqes, sqesSize);
+        if (cqRing != MAP_FAILED && cqRing != sqRing) munmap(cqRing, cqRingSize);
+        if (sqRing != MAP_FAILED) munmap(sqRing, sqRingSize);
+        if (ringFd >= 0) close(ringFd);
+    }
+
+    void submitRead(int fd, char *buffer, size_t length, uint64_t offset, uint64_t tag) override {
+        submit(IORING_OP_READ, fd, buffer, length, offset, tag);
+    }
+
+    void submitWrite(int fd, const char *buffer, size_t length, uint64_t offset, uint64_t tag) override {
+        submit(IORING_OP_WRITE, fd, buffer, length, offset, tag);
+    }
+
+    void wait(uint64_t &tag, long &result) override {
+        while (true) {
+            unsigned head = *cqHead;
+            if (head != __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) {
+                const io_uring_cqe &cqe = cqes[head & *cqMask];
+                tag = cqe.user_data;
+                result = cqe.res;
+                __atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+                return;
+            }
+            if (enter(ringFd, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR) {
+                throw runtime_error(string("io_uring_enter failed: ") + strerror(errno));
+            }
+        }
+    }
+
+    const char *name() const override {
+        return "io_uring";
+    }
+};
+#endif
+
+// Fallback for kernels without io_uring: worker threads run pread/pwrite
+class ThreadIOBackend : public AsyncIOBackend {
+private:
+    struct Request {
+        bool isWrite;
+        int fd;
+        char *buffer;
+        size_t length;
+        uint64_t offset;
+        uint64_t tag;
+    };
+
+    mutex lock;
+    condition_variable requestReady, completionReady;
+    deque<Request> requests;
+    deque<pair<uint64_t, long>> completions;
+    bool stopping = false;
+    vector<thread> workers;
+
+    void run() {
+        unique_lock<mutex> guard(lock);
+        while (true) {
+            requestReady.wait(guard, [this] { return stopping || !requests.empty(); });
+            if (requests.empty()) return;
+            Request request = requests.front();
+            requests.pop_front();
+            guard.unlock();
+
+            ssize_t done = request.isWrite
+                ? pwrite(request.fd, request.buffer, request.length, static_cast<off_t>(request.offset))
+                : pread(request.fd, request.buffer, request.length, static_cast<off_t>(request.offset));
+            long result = done < 0 ? -errno : static_cast<long>(done);
+
+            guard.lock();
+            completions.emplace_back(request.tag, result);
+            completionReady.notify_all();
+        }
+    }
+
+    void enqueue(const Request &request) {
+        lock_guard<mutex> guard(lock);
+        requests.push_back(request);
+        requestReady.notify_one();
+    }
+
+public:
+    explicit ThreadIOBackend(size_t threads = 4) {
+        for (size_t i = 0; i < threads; ++i) workers.emplace_back(&ThreadIOBackend::run, this);
+    }
+
+    ~ThreadIOBackend() override {
+        {
+            lock_guard<mutex> guard(lock);
+            stopping = true;
+        }
+        requestReady.notify_all();
+        for (thread &worker : workers) worker.join();
+    }
+
+    void submitRead(int fd, char *buffer, size_t length, uint64_t offset, uint64_t tag) override {
+        enqueue({false, fd, buffer, length, offset, tag});
+    }
+
+    void submitWrite(int fd, const char *buffer, size_t length, uint64_t offset, uint64_t tag) override {
+        enqueue({true, fd, const_cast<char *>(buffer), length, offset, tag});
+    }
+
+    void wait(uint64_t &tag, long &result) override {
+        unique_lock<mutex> guard(lock);
+        completionReady.wait(guard, [this] { return !completions.empty(); });
+        tag = completions.front().first;
+        result = completions.front().second;
+        completions.pop_front();
+    }
+
+    const char *name() const override {
+        return "threads";
+    }
+};
+
+// io_uring when available, otherwise the thread backend.
+// DAA_IO_BACKEND=threads forces the fallback.
+inline unique_ptr<AsyncIOBackend> makeAsyncIOBackend(unsigned entries = 32) {
+#ifdef __linux__
+    const char *forced = getenv("DAA_IO_BACKEND");
+    if (!forced || string(forced) != "threads") {
+        if (auto ring = IoUringBackend::create(entries)) return ring;
+    }
+#endif
+    return unique_ptr<AsyncIOBackend>(new ThreadIOBackend());
+}
+
+// The one backend every reader and writer in the process shares, so opening a
+// file costs no ring setup or thread start. Each reader or writer is a client;
+// its tags carry its client id above the caller's buffer index. One waiting
+// thread at a time blocks on the backend and queues each completion for the
+// client it belongs to, waking the others to collect theirs.
+class SharedAsyncIO {
+private:
+    static const int INDEX_BITS = 16;
+
+    unique_ptr<AsyncIOBackend> backend = makeAsyncIOBackend(256);
+    mutex lock;
+    condition_variable completed;
+    bool polling = false;
+    uint64_t nextClient = 1;
+    unordered_map<uint64_t, deque<pair<uint64_t, long>>> pending;    // completions by client
+
+    SharedAsyncIO() = default;
+
+public:
+    static SharedAsyncIO &instance() {
+        static SharedAsyncIO io;
+        return io;
+    }
+
+    uint64_t registerClient() {
+        lock_guard<mutex> guard(lock);
+        uint64_t client = nextClient++;
+        pending[client];
+        return client;
+    }
+
+    // Only once none of the client's requests are in flight
+    void unregisterClient(uint64_t client) {
+        lock_guard<mutex> guard(lock);
+        pending.erase(client);
+    }
+
+    void submitRead(uint64_t client, int fd, char *buffer, size_t length, uint64_t offset, uint64_t index) {
+        lock_guard<mutex> guard(lock);
+        backend->submitRead(fd, buffer, length, offset, client << INDEX_BITS | index);
+    }
+
+    void submitWrite(uint64_t client, int fd, const char *buffer, size_t length, uint64_t offset, uint64_t index) {
+        lock_guard<mutex> guard(lock);
+        backend->submitWrite(fd, buffer, length, offset, client << INDEX_BITS | index);
+    }
+
+    // Blocks until one of client's requests completes
+    void wait(uint64_t client, uint64_t &index, long &result) {
+        unique_lock<mutex> guard(lock);
+        deque<pair<uint64_t, long>> &mine = pending[client];
+        while (mine.empty()) {
+            if (polling) {
+                completed.wait(guard);
+                continue;
+            }
+            polling = true;
+            guard.unlock();
+            uint64_t tag = 0;
+            long done = 0;
+            try {
+                backend->wait(tag, done);
+            } catch (...) {
+                guard.lock();
+                polling = false;
+                completed.notify_all();
+                throw;
+            }
+            guard.lock();
+            polling = false;
+            auto owner = pending.find(tag >> INDEX_BITS);
+            if (owner != pending.end()) owner->second.emplace_back(tag & ((1u << INDEX_BITS) - 1), done);
+            completed.notify_all();
+        }
+        index = mine.front().first;
+        result = mine.front().second;
+        mine.pop_front();
+    }
+
+    const char *name() const {
+        return backend->name();
+    }
+};
+
+// Reads a file front to back with `depth` chunk reads kept in flight, so the
+// caller processes chunk k while chunks k+1.. are being read. Pipes, FIFOs
+// and files that report no size (/proc) are read with plain read() until EOF.
+class AsyncFileReader {
+private:
+    struct Buffer {
+        vector<char> data;
+        uint64_t offset = 0;
+        size_t requested = 0;
+        long result = 0;
+        bool inFlight = false;
+        bool done = false;
+    };
+
+    SharedAsyncIO &io = SharedAsyncIO::instance();
+    uint64_t client = 0;    // 0 = streaming with read()
+    int fd = -1;
+    uint64_t fileSize = 0;
+    uint64_t nextOffset = 0;
+    vector<Buffer> buffers;
+    size_t current = 0;
+    bool recyclePrevious = false;
+
+    void submit(size_t index) {
+        Buffer &buffer = buffers[index];
+        buffer.offset = nextOffset;
+        buffer.requested = static_cast<size_t>(min<uint64_t>(buffer.data.size(), fileSize - nextOffset));
+        buffer.inFlight = true;
+        buffer.done = false;
+        nextOffset += buffer.requested;
+        io.submitRead(client, fd, buffer.data.data(), buffer.requested, buffer.offset, index);
+    }
+
+    bool nextStreamed(string_view &chunk) {
+        Buffer &buffer = buffers[0];
+        ssize_t got;
+        do {
+            got = ::read(fd, buffer.data.data(), buffer.data.size());
+        } while (got < 0 && errno == EINTR);
+        if (got < 0) throw runtime_error(string("Read failed: ") + strerror(errno));
+        if (got == 0) return false;
+        chunk = string_view(buffer.data.data(), static_cast<size_t>(got));
+        return true;
+    }
+
+public:
+    explicit AsyncFileReader(const string &path, size_t chunkSize = 1 << 20, size_t depth = 3) {
+        fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) return;
+        struct stat info;
+        if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode) || info.st_size == 0) {
+            buffers.resize(1);
+            buffers[0].data.resize(chunkSize);
+            return;
+        }
+        fileSize = static_cast<uint64_t>(info.st_size);
+
+        client = io.registerClient();
+        buffers.resize(depth);
+        for (size_t i = 0; i < depth; ++i) {
+            buffers[i].data.resize(chunkSize);
+            if (nextOffset < fileSize) submit(i);
+        }
+    }
+
+    AsyncFileReader(const AsyncFileReader &) = delete;
+    AsyncFileReader &operator=(const AsyncFileReader &) = delete;
+
+    ~AsyncFileReader() {
+        if (fd < 0) return;
+        if (client) {
+            // Drain requests still in flight before their buffers go away
+            for (Buffer &buffer : buffers) {
+                while (buffer.inFlight && !buffer.done) {
+                    uint64_t tag;
+                    long result;
+                    io.wait(client, tag, result);
+                    buffers[tag].done = true;
+                }
+            }
+            io.unregisterClient(client);
+        }
+        close(fd);
+    }
+
+    bool isOpen() const {
+        return fd >= 0;
+    }
+
+    // 0 when the file is streamed
+    uint64_t size() const {
+        return fileSize;
+    }
+
+    const char *backendName() const {
+        return client ? io.name() : "read";
+    }
+
+    // Returns the next chunk in file order; the view stays valid until the next call
+    bool next(string_view &chunk) {
+        if (fd < 0) return false;
+        if (!client) return nextStreamed(chunk);
+
+        if (recyclePrevious) {
+            size_t previous = (current + buffers.size() - 1) % buffers.size();
+            buffers[previous].inFlight = false;
+            if (nextOffset < fileSize) submit(previous);
+            recyclePrevious = false;
+        }
+
+        Buffer &buffer = buffers[current];
+        if (!buffer.inFlight) return false;
+
+        while (!buffer.done) {
+            uint64_t tag;
+            long result;
+            io.wait(client, tag, result);
+            buffers[tag].result = result;
+            buffers[tag].done = true;
+        }
+        if (buffer.result < 0) {
+            throw runtime_error(string("Asynchronous read failed: ") + strerror(static_cast<int>(-buffer.result)));
+        }
+
+        // Short reads are rare for regular files; finish them synchronously to keep chunks contiguous
+        size_t got = static_cast<size_t>(buffer.result);
+        while (got < buffer.requested) {
+            ssize_t more = pread(fd, buffer.data.data() + got, buffer.requested - got,
+                                 static_cast<off_t>(buffer.offset + got));
+            if (more <= 0) break;
+            got += static_cast<size_t>(more);
+        }
+
+        chunk = string_view(buffer.data.data(), got);
+        current = (current + 1) % buffers.size();
+        recyclePrevious = true;
+        return true;
+    }
+};
+
+// Buffers output in `depth` chunks; a full chunk is handed to the backend and
+// the caller keeps producing into the next one while it is written
+class AsyncFileWriter {
+private:
+    struct Buffer {
+        vector<char> data;
+        size_t used = 0;
+        uint64_t offset = 0;
+        long result = 0;
+        bool inFlight = false;
+        bool done = false;
+    };
+
+    SharedAsyncIO &io = SharedAsyncIO::instance();
+    uint64_t client = 0;
+    int fd = -1;
+    uint64_t offset = 0;
+    vector<Buffer> buffers;
+    size_t current = 0;
+
+    void complete(Buffer &buffer) {
+        while (!buffer.done) {
+            uint64_t tag;
+            long result;
+            io.wait(client, tag, result);
+            buffers[tag].result = result;
+            buffers[tag].done = true;
+        }
+        buffer.inFlight = false;
+        if (buffer.result < 0) {
+            throw runtime_error(string("Asynchronous write failed: ") + strerror(static_cast<int>(-buffer.result)));
+        }
+        // Finish a short write synchronously
+        size_t written = static_cast<size_t>(buffer.result);
+        while (written < buffer.used) {
+            ssize_t more = pwrite(fd, buffer.data.data() + written, buffer.used - written,
+                                  static_cast<off_t>(buffer.offset + written));
+            if (more <= 0) throw runtime_error("Asynchronous write failed: short write");
+            written += static_cast<size_t>(more);
+        }
+        buffer.used = 0;
+    }
+
+    void flushCurrent() {
+        Buffer &buffer = buffers[current];
+        if (buffer.used == 0) return;
+        buffer.offset = offset;
+        // Marked in flight only once submitted, so a failed submit is never waited for
+        io.submitWrite(client, fd, buffer.data.data(), buffer.used, buffer.offset, current);
+        buffer.inFlight = true;
+        buffer.done = false;
+        offset += buffer.used;
+
+        current = (current + 1) % buffers.size();
+        if (buffers[current].inFlight) complete(buffers[current]);
+    }
+
+public:
+    explicit AsyncFileWriter(const string &path, size_t chunkSize = 1 << 20, size_t depth = 3) {
+        fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) return;
+        client = io.registerClient();
+        buffers.resize(depth);
+        for (Buffer &buffer : buffers) buffer.data.resize(chunkSize);
+    }
+
+    AsyncFileWriter(const AsyncFileWriter &) = delete;
+    AsyncFileWriter &operator=(const AsyncFileWriter &) = delete;
+
+    ~AsyncFileWriter() {
+        try {
+            close();
+        } catch (const exception &e) {
+            cerr << e.what() << endl;
+        }
+        if (client) io.unregisterClient(client);
+    }
+
+    bool isOpen() const {
+        return fd >= 0;
+    }
+
+    void write(const char *data, size_t length) {
+        while (length > 0) {
+            Buffer &buffer = buffers[current];
+            size_t room = buffer.data.size() - buffer.used;
+            size_t take = min(room, length);
+            memcpy(buffer.data.data() + buffer.used, data, take);
+            buffer.used += take;
+            data += take;
+            length -= take;
+            if (buffer.used == buffer.data.size()) flushCurrent();
+        }
+    }
+
+    void write(string_view data) {
+        write(data.data(), data.size());
+    }
+
+    void put(char c) {
+        Buffer &buffer = buffers[current];
+        buffer.data[buffer.used++] = c;
+        if (buffer.used == buffer.data.size()) flushCurrent();
+    }
+
+    AsyncFileWriter &operator<<(string_view data) {
+        write(data);
+        return *this;
+    }
+
+    AsyncFileWriter &operator<<(char c) {
+        put(c);
+        return *this;
+    }
+
+    // Flushes the partial chunk and waits for every write to land. Every
+    // write in flight is waited for even after one fails, since the backend
+    // may still be reading its buffer; the first failure is thrown after that.
+    void close() {
+        if (fd < 0) return;
+        exception_ptr failure;
+        try {
+            flushCurrent();
+        } catch (...) {
+            failure = current_exception();
+        }
+        for (Buffer &buffer : buffers) {
+            if (!buffer.inFlight) continue;
+            try {
+                complete(buffer);
+            } catch (...) {
+                if (!failure) failure = current_exception();
+            }
+        }
+        ::close(fd);
+        fd = -1;
+        if (failure) rethrow_exception(failure);
+    }
+};
+
+// Reads a whole file through the asynchronous reader; returns false if it cannot be opened
+inline bool readFileAsync(const string &path, string &content) {
+    AsyncFileReader reader(path);
+    if (!reader.isOpen()) return false;
+    content.clear();
+    content.reserve(reader.size());
+    string_view chunk;
+    while (reader.next(chunk)) {
+        content.append(chunk.data(), chunk.size());
+    }
+    return true;
+}
+
+// Streams inputFile through a byte-for-byte transform into outputFile. The read
+// of the next chunk and the write of the previous one run while `transform`
+// works on the current chunk. Returns false if either file cannot be opened.
+inline bool transformFileAsync(const string &inputFile, const string &outputFile,
+                               const function<void(const char *in, char *out, size_t length)> &transform) {
+    AsyncFileReader reader(inputFile);
+    if (!reader.isOpen()) return false;
+    AsyncFileWriter writer(outputFile);
+    if (!writer.isOpen()) return false;
+
+    vector<char> scratch;
+    string_view chunk;
+    while (reader.next(chunk)) {
+        scratch.resize(chunk.size());
+        transform(chunk.data(), scratch.data(), chunk.size());
+        writer.write(scratch.data(), scratch.size());
+    }
+    writer.close();
+    return true;
+}
+
+#endif
@@ -4,21 +4,90 @@
 #include <string>
 #include <algorithm>
 #include <iostream>
+#include <iterator>
+#include <vector>
+#include <utility>
+#include <stdexcept>
+#include <cstddef>
+#include "tokenizer.hpp"
 
 using namespace std;
 
+// Nodes are keyed by (count, symbol id); the token text lives once in a SymbolTable
 struct AVLNode {
-    string word;
+    int id;
     int count;
     AVLNode *left, *right;
     int height;
 
-    AVLNode(const string &w, int c) : word(w), count(c), left(nullptr), right(nullptr), height(1) {}
+    AVLNode(int i, int c) : id(i), count(c), left(nullptr), right(nullptr), height(1) {}
 };
 
 class AVLTree {
+public:
+    // An AVL tree of height h holds at least Fib(h + 2) - 1 nodes, so 64 levels
+    // bound any tree that fits in memory; iterators and updates keep their
+    // root-to-node paths in fixed arrays of this size
+    static constexpr int MAX_HEIGHT = 64;
+
+    // In-order (ascending count, then id) traversal without recursion or allocation
+    class Iterator {
+    private:
+        const AVLNode *stack[MAX_HEIGHT] = {};
+        int depth = 0;
+
+        void descend(const AVLNode *node) {
+            while (node) {
+                stack[depth++] = node;
+                node = node->left;
+            }
+        }
+
+    public:
+        using iterator_category = forward_iterator_tag;
+        using value_type = AVLNode;
+        using difference_type = ptrdiff_t;
+        using pointer = const AVLNode *;
+        using reference = const AVLNode &;
+
+        Iterator() {}
+
+        explicit Iterator(const AVLNode *root) {
+            descend(root);
+        }
+
+        reference operator*() const {
+            return *stack[depth - 1];
+        }
+
+        pointer operator->() const {
+            return stack[depth - 1];
+        }
+
+        Iterator &operator++() {
+            const AVLNode *node = stack[--depth];
+            descend(node->right);
+            return *this;
+        }
+
+        bool operator==(const Iterator &other) const {
+            return depth == other.depth && (depth == 0 || stack[depth - 1] == other.stack[depth - 1]);
+        }
+
+        bool operator!=(const Iterator &other) const {
+            return !(*this == other);
+        }
+    };
+
 private:
     AVLNode *root;
+    size_t nodeCount = 0;
+
+    // Orders the key (count, id) against a node's key
+    static int compare(int count, int id, const AVLNode *node) {
+        if (count != node->count) return count < node->count ? -1 : 1;
+        return id < node->id ? -1 : (id > node->id ? 1 : 0);
+    }
 
     int getHeight(AVLNode *node) {
         return node ? node->height : 0;
@@ -54,47 +123,45 @@ private:
         return y;
     }
 
-    AVLNode* insert(AVLNode *node, const string &word, int count) {
-        if (!node) return new AVLNode(word, count);
-
-        if (count < node->count || (count == node->count && word < node->word))
-            node->left = insert(node->left, word, count);
-        else if (count > node->count || (count == node->count && word > node->word))
-            node->right = insert(node->right, word, count);
-        else
-            return node;
-
+    AVLNode* rebalance(AVLNode *node) {
         node->height = 1 + max(getHeight(node->left), getHeight(node->right));
-
         int balance = getBalance(node);
 
-        if (balance > 1 && (count < node->left->count || (count == node->left->count && word < node->left->word)))
-            return rightRotate(node);
-
-        if (balance < -1 && (count > node->right->count || (count == node->right->count && word > node->right->word)))
-            return leftRotate(node);
-
-        if (balance > 1 && (count > node->left->count || (count == node->left->count && word > node->left->word))) {
-            node->left = leftRotate(node->left);
+        if (balance > 1) {
+            if (getBalance(node->left) < 0) node->left = leftRotate(node->left);
             return rightRotate(node);
         }
-
-        if (balance < -1 && (count < node->right->count || (count == node->right->count && word < node->right->word))) {
-            node->right = rightRotate(node->right);
+        if (balance < -1) {
+            if (getBalance(node->right) > 0) node->right = rightRotate(node->right);
             return leftRotate(node);
         }
-
         return node;
     }
 
-    void inorderTraversal(AVLNode *node) const {
-        if (node) {
-            inorderTraversal(node->left);
-            cout << node->word << ": " << node->count << endl;
-            inorderTraversal(node->right);
+    // Rebalances bottom-up along the links of an update path, stopping once a
+    // subtree's height is unchanged since nothing above it can have moved
+    void retrace(AVLNode **path[], int depth) {
+        while (depth-- > 0) {
+            AVLNode **link = path[depth];
+            int before = (*link)->height;
+            *link = rebalance(*link);
+            if ((*link)->height == before) break;
         }
     }
 
+    // Balanced subtree over keys[first, first + n): the middle key is the root
+    static AVLNode* build(const vector<pair<int, int>> &keys, size_t first, size_t n) {
+        if (n == 0) return nullptr;
+        size_t middle = first + n / 2;
+        AVLNode *node = new AVLNode(keys[middle].second, keys[middle].first);
+        node->left = build(keys, first, n / 2);
+        node->right = build(keys, middle + 1, n - n / 2 - 1);
+        int leftHeight = node->left ? node->left->height : 0;
+        int rightHeight = node->right ? node->right->height : 0;
+        node->height = 1 + max(leftHeight, rightHeight);
+        return node;
+    }
+
     void cleanup(AVLNode *node) {
         if (node) {
             cleanup(node->left);
@@ -106,16 +173,109 @@ private:
 public:
     AVLTree() : root(nullptr) {}
 
+    // Bulk load in O(n) from (count, id) keys in strictly increasing order
+    explicit AVLTree(const vector<pair<int, int>> &sortedKeys) : root(nullptr) {
+        for (size_t i = 1; i < sortedKeys.size(); ++i) {
+            if (!(sortedKeys[i - 1] < sortedKeys[i])) throw runtime_error("AVL bulk load needs strictly increasing keys");
+        }
+        root = build(sortedKeys, 0, sortedKeys.size());
+        nodeCount = sortedKeys.size();
+    }
+
+    AVLTree(const AVLTree &) = delete;
+    AVLTree &operator=(const AVLTree &) = delete;
+
     ~AVLTree() {
         cleanup(root);
     }
 
-    void insert(const string &word, int count) {
-        root = insert(root, word, count);
+    // Returns false if the key is already present
+    bool insert(int id, int count) {
+        AVLNode **path[MAX_HEIGHT];
+        int depth = 0;
+        AVLNode **link = &root;
+        while (*link) {
+            int order = compare(count, id, *link);
+            if (order == 0) return false;
+            path[depth++] = link;
+            link = order < 0 ? &(*link)->left : &(*link)->right;
+        }
+        *link = new AVLNode(id, count);
+        nodeCount++;
+        retrace(path, depth);
+        return true;
+    }
+
+    // Returns false if the key is not present
+    bool erase(int id, int count) {
+        AVLNode **path[MAX_HEIGHT];
+        int depth = 0;
+        AVLNode **link = &root;
+        while (*link) {
+            int order = compare(count, id, *link);
+            if (order == 0) break;
+            path[depth++] = link;
+            link = order < 0 ? &(*link)->left : &(*link)->right;
+        }
+        AVLNode *node = *link;
+        if (!node) return false;
+
+        if (!node->left || !node->right) {
+            *link = node->left ? node->left : node->right;
+        } else {
+            // The in-order successor, the leftmost node of the right subtree,
+            // takes the erased node's place
+            int nodeDepth = depth;
+            path[depth++] = link;
+            AVLNode **successorLink = &node->right;
+            while ((*successorLink)->left) {
+                path[depth++] = successorLink;
+                successorLink = &(*successorLink)->left;
+            }
+            AVLNode *successor = *successorLink;
+            *successorLink = successor->right;
+            successor->left = node->left;
+            successor->right = node->right;
+            successor->height = node->height;
+            *link = successor;
+            if (depth > nodeDepth + 1) path[nodeDepth + 1] = &successor->right;
+        }
+        delete node;
+        nodeCount--;
+        retrace(path, depth);
+        return true;
+    }
+
+    bool contains(int id, int count) const {
+        const AVLNode *node = root;
+        while (node) {
+            int order = compare(count, id, node);
+            if (order == 0) return true;
+            node = order < 0 ? node->left : node->right;
+        }
+        return false;
     }
 
-    void printInorder() const {
-        inorderTraversal(root);
+    Iterator begin() const {
+        return Iterator(root);
+    }
+
+    Iterator end() const {
+        return Iterator();
+    }
+
+    size_t size() const {
+        return nodeCount;
+    }
+
+    bool empty() const {
+        return nodeCount == 0;
+    }
+
+    void printInorder(const SymbolTable &symbols) const {
+        for (const AVLNode &node : *this) {
+            cout << symbols.symbol(node.id) << ": " << node.count << endl;
+        }
     }
 
     AVLNode* getRoot() const {
@@ -0,0 +1,389 @@
+// Micro-benchmarks for the data structures behind the encryption pipeline.
+//
+// Build: g++ -std=c++17 -O2 -pthread benchmark.cpp -o benchmark
+// Run:   ./benchmark            (runs everything)
+//        ./benchmark codebook   (runs only the named benchmarks: codebook, entropy, ordering, packing,
+//                                tokenize)
+//
+// A summary at the end lists each benchmark's time, heap allocations and
+// peak live heap.
+
+#define TRACK_ALLOCATIONS
+#include "allocation_tracker.hpp"
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <random>
+#include <cmath>
+#include <chrono>
+#include <functional>
+#include "tokenizer.hpp"
+#include "delimiter_scan.hpp"
+#include "codebook.hpp"
+#include "huffman.hpp"
+#include "container.hpp"
+#include "rans.hpp"
+#include "avl_tree.hpp"
+#include "eytzinger_tree.hpp"
+#include "codec.hpp"
+#include "parallel_bits.hpp"
+#include "thread_pool.hpp"
+#include "stage_profiler.hpp"
+
+using namespace std;
+
+// Keeps results alive so the optimizer cannot drop the measured work
+static volatile size_t benchmarkSink;
+
+template <typename F>
+double timeMs(F &&work) {
+    auto start = chrono::steady_clock::now();
+    work();
+    auto stop = chrono::steady_clock::now();
+    return chrono::duration<double, milli>(stop - start).count();
+}
+
+void printRow(const string &name, double ms, size_t operations) {
+    cout << "  " << left << setw(44) << name << right << setw(10) << fixed << setprecision(2) << ms << " ms"
+         << setw(12) << setprecision(1) << (operations / ms / 1000.0) << " Mops/s" << endl;
+}
+
+void printThroughput(const string &name, double ms, size_t bytes) {
+    cout << "  " << left << setw(44) << name << right << setw(10) << fixed << setprecision(2) << ms << " ms"
+         << setw(12) << setprecision(1) << (bytes / ms / 1000.0) << " MB/s" << endl;
+}
+
+// Words "t0x", "t1x", ... drawn with a Zipf-like skew, joined by spaces
+string makeTokenText(size_t vocabulary, size_t tokens, unsigned seed) {
+    mt19937_64 gen(seed);
+    uniform_real_distribution<double> uniform(0.0, 1.0);
+    string text;
+    for (size_t i = 0; i < tokens; ++i) {
+        size_t rank = static_cast<size_t>(pow(static_cast<double>(vocabulary), uniform(gen))) - 1;
+        if (i) text += ' ';
+        text += 't' + to_string(rank) + 'x';
+    }
+    return text;
+}
+
+// Codebook for the distinct words of text, built the same way the encrypt paths do
+void buildCodes(const string &text, SymbolTable &symbols, vector<int> &tokenIds, vector<HuffmanCode> &codes) {
+    vector<int> frequency;
+    Tokenizer tokenizer(text);
+    string_view token;
+    while (tokenizer.next(token)) {
+        int id = symbols.intern(token);
+        if (id == static_cast<int>(frequency.size())) frequency.push_back(0);
+        frequency[id]++;
+        tokenIds.push_back(id);
+    }
+    codes = buildHuffmanCodes(frequency);
+}
+
+void benchCodebook() {
+    const size_t vocabulary = 200000, tokens = 2000000;
+    string text = makeTokenText(vocabulary, tokens, 42);
+
+    SymbolTable symbols;
+    vector<int> tokenIds;
+    vector<HuffmanCode> codes;
+    buildCodes(text, symbols, tokenIds, codes);
+    cout << "codebook: " << symbols.size() << " distinct tokens, " << tokenIds.size() << " lookups" << endl;
+
+    vector<string_view> stream;
+    vector<string> codeStream;
+    stream.reserve(tokenIds.size());
+    codeStream.reserve(tokenIds.size());
+    for (int id : tokenIds) {
+        stream.push_back(symbols.symbol(id));
+        codeStream.push_back(codes[id].toString());
+    }
+
+    // unordered_map<string, string>, as the codebook used to be stored
+    unordered_map<string, string> mapCodes, mapReverse;
+    printRow("unordered_map build", timeMs([&] {
+        for (size_t id = 0; id < symbols.size(); ++id) {
+            mapCodes[string(symbols.symbol(id))] = codes[id].toString();
+        }
+    }), symbols.size());
+    printRow("unordered_map lookup (string key)", timeMs([&] {
+        size_t total = 0;
+        for (string_view token : stream) total += mapCodes.find(string(token))->second.size();
+        benchmarkSink = total;
+    }), stream.size());
+    printRow("unordered_map reverse build", timeMs([&] {
+        for (const auto &pair : mapCodes) mapReverse[pair.second] = pair.first;
+    }), mapCodes.size());
+    printRow("unordered_map reverse lookup", timeMs([&] {
+        size_t total = 0;
+        for (const string &code : codeStream) total += mapReverse.find(code)->second.size();
+        benchmarkSink = total;
+    }), codeStream.size());
+
+    // Flat Codebook / ReverseCodebook
+    Codebook flatCodes;
+    ReverseCodebook flatReverse;
+    printRow("Codebook build", timeMs([&] {
+        flatCodes.reserve(symbols.size());
+        for (size_t id = 0; id < symbols.size(); ++id) flatCodes.insert_or_assign(symbols.symbol(id), codes[id]);
+    }), symbols.size());
+    printRow("Codebook lookup (string_view key)", timeMs([&] {
+        size_t total = 0;
+        for (string_view token : stream) total += flatCodes.lookup(token)->length;
+        benchmarkSink = total;
+    }), stream.size());
+    printRow("ReverseCodebook build", timeMs([&] {
+        flatReverse.build(flatCodes);
+    }), flatCodes.size());
+    printRow("ReverseCodebook lookup (code text)", timeMs([&] {
+        size_t total = 0;
+        string_view token;
+        for (const string &code : codeStream) {
+            flatReverse.lookup(code, token);
+            total += token.size();
+        }
+        benchmarkSink = total;
+    }), codeStream.size());
+}
+
+// Huffman and rANS over the same word-id stream and counts. MB/s is measured
+// against the text the ids stand for; ratio is coded size over text size.
+void benchEntropy() {
+    const size_t vocabulary = 200000, tokens = 2000000;
+    string text = makeTokenText(vocabulary, tokens, 42);
+
+    SymbolTable symbols;
+    vector<int> tokenIds;
+    vector<int> frequency;
+    Tokenizer tokenizer(text);
+    string_view token;
+    while (tokenizer.next(token)) {
+        int id = symbols.intern(token);
+        if (id == static_cast<int>(frequency.size())) frequency.push_back(0);
+        frequency[id]++;
+        tokenIds.push_back(id);
+    }
+    double entropyBits = 0;
+    for (int f : frequency) entropyBits += f * log2(static_cast<double>(tokens) / f);
+    cout << "entropy: " << symbols.size() << " distinct tokens, " << tokens << " tokens, order-0 bound "
+         << static_cast<size_t>(entropyBits / 8) << " bytes" << endl;
+
+    auto printRatio = [&](const string &name, size_t bytes) {
+        cout << "  " << left << setw(44) << name << right << setw(10) << bytes << " bytes" << setw(12)
+             << setprecision(3) << static_cast<double>(bytes) / text.size() << " ratio, "
+             << setprecision(3) << bytes * 8.0 / entropyBits << "x bound" << endl;
+    };
+
+    vector<uint8_t> lengths;
+    vector<HuffmanCode> codes;
+    string huffmanPayload;
+    printThroughput("Huffman build + encode", timeMs([&] {
+        for (const HuffmanCode &code : buildHuffmanCodes(frequency)) lengths.push_back(code.length);
+        codes = canonicalCodes(lengths);
+        BitWriter bits(huffmanPayload);
+        for (int id : tokenIds) bits.write(codes[id].bits, codes[id].length);
+        bits.flush();
+    }), text.size());
+    printThroughput("Huffman decode", timeMs([&] {
+        CanonicalDecoder decoder(lengths);
+        BitReader bits(huffmanPayload);
+        size_t total = 0;
+        for (size_t i = 0; i < tokenIds.size(); ++i) total += decoder.decode(bits);
+        benchmarkSink = total;
+    }), text.size());
+    printThroughput("Huffman decode (lookup table)", timeMs([&] {
+        CanonicalDecoder decoder(lengths);
+        BitWindow window(huffmanPayload);
+        size_t total = 0;
+        int length;
+        for (size_t i = 0; i < tokenIds.size(); ++i) {
+            window.refill();
+            total += decoder.decodeWindow(window.peek(), length);
+            window.consume(length);
+        }
+        benchmarkSink = total;
+    }), text.size());
+    printRatio("Huffman payload", huffmanPayload.size());
+
+    // Round-robin streams, decoded in lockstep
+    const size_t streams = 4;
+    vector<string> streamBytes(streams);
+    printThroughput("Huffman x4 interleaved encode", timeMs([&] {
+        vector<BitWriter> writers;
+        for (string &bytes : streamBytes) writers.emplace_back(bytes);
+        for (size_t i = 0; i < tokenIds.size(); ++i) writers[i % streams].write(codes[tokenIds[i]].bits, codes[tokenIds[i]].length);
+        for (BitWriter &writer : writers) writer.flush();
+    }), text.size());
+    printThroughput("Huffman x4 interleaved decode", timeMs([&] {
+        CanonicalDecoder decoder(lengths);
+        vector<BitWindow> windows;
+        for (const string &bytes : streamBytes) windows.emplace_back(bytes);
+        size_t total = 0;
+        decodeRounds(decoder, windows, tokenIds.size() / streams, [&](uint32_t s) { total += s; });
+        benchmarkSink = total;
+    }), text.size());
+
+    RansTable table;
+    string ransPayload;
+    printThroughput("rANS build + encode", timeMs([&] {
+        table = RansTable::fromCounts(frequency);
+        ransEncode(table, tokenIds.size(), [&](size_t i) { return static_cast<uint32_t>(tokenIds[i]); }, ransPayload);
+    }), text.size());
+    printThroughput("rANS decode", timeMs([&] {
+        RansTable decoderTable = RansTable::fromScaled(table.scaleBits, table.freq);
+        size_t total = 0;
+        ransDecode(decoderTable, ransPayload, tokenIds.size(), [&](uint32_t s) { total += s; });
+        benchmarkSink = total;
+    }), text.size());
+    printRatio("rANS payload", ransPayload.size());
+}
+
+// Ordered (count, id) containers behind the Huffman builder
+template <typename Tree>
+void benchOrderedTree(const string &name, const vector<pair<int, int>> &keys, const vector<pair<int, int>> &probes,
+                      const vector<int> &frequency) {
+    Tree *tree = nullptr;
+    printRow(name + " bulk load", timeMs([&] { tree = new Tree(keys); }), keys.size());
+    printRow(name + " in-order walk", timeMs([&] {
+        size_t total = 0;
+        for (const auto &node : *tree) total += node.count;
+        benchmarkSink = total;
+    }), keys.size());
+    printRow(name + " lookup", timeMs([&] {
+        size_t found = 0;
+        for (const pair<int, int> &probe : probes) found += tree->contains(probe.second, probe.first);
+        benchmarkSink = found;
+    }), probes.size());
+    delete tree;
+    printRow(name + " Huffman codes", timeMs([&] {
+        benchmarkSink = buildHuffmanCodes<Tree>(frequency).size();
+    }), frequency.size());
+}
+
+void benchOrdering() {
+    const size_t symbols = 1000000, probeCount = 2000000;
+    mt19937_64 gen(7);
+    vector<int> frequency(symbols);
+    for (size_t id = 0; id < symbols; ++id) frequency[id] = static_cast<int>(1000000 / (1 + gen() % symbols)) + 1;
+    vector<pair<int, int>> keys;
+    for (size_t id = 0; id < symbols; ++id) keys.emplace_back(frequency[id], static_cast<int>(id));
+    sort(keys.begin(), keys.end());
+    vector<pair<int, int>> probes;
+    for (size_t i = 0; i < probeCount; ++i) probes.push_back(keys[gen() % keys.size()]);
+    cout << "ordering: " << symbols << " keys, " << probeCount << " lookups" << endl;
+
+    printRow("AVLTree incremental insert", timeMs([&] {
+        AVLTree tree;
+        for (size_t id = 0; id < symbols; ++id) tree.insert(static_cast<int>(id), frequency[id]);
+        benchmarkSink = tree.size();
+    }), symbols);
+    benchOrderedTree<AVLTree>("AVLTree", keys, probes, frequency);
+    benchOrderedTree<EytzingerTree>("EytzingerTree", keys, probes, frequency);
+}
+
+// Huffman bit packing: the serial BitWriter against packCodes on 1 .. N threads
+void benchPacking() {
+    const size_t vocabulary = 200000, tokens = 8000000;
+    mt19937_64 gen(11);
+    vector<int> frequency(vocabulary, 0);
+    vector<uint32_t> tokenIds(tokens);
+    for (uint32_t &id : tokenIds) {
+        id = static_cast<uint32_t>(vocabulary / (1 + gen() % vocabulary)) - 1;
+        frequency[id]++;
+    }
+    for (int &f : frequency) f++;
+    vector<uint8_t> lengths;
+    for (const HuffmanCode &code : buildHuffmanCodes(frequency)) lengths.push_back(code.length);
+    vector<HuffmanCode> codes = canonicalCodes(lengths);
+    auto symbolAt = [&](uint64_t i) { return tokenIds[i]; };
+    auto identity = [](uint8_t byte) { return byte; };
+    cout << "packing: " << tokens << " tokens, " << thread::hardware_concurrency() << " cores" << endl;
+
+    string serial;
+    printRow("BitWriter (serial)", timeMs([&] {
+        BitWriter bits(serial);
+        for (uint32_t id : tokenIds) bits.write(codes[id].bits, codes[id].length);
+        bits.flush();
+    }), tokens);
+    size_t maxThreads = max<size_t>(4, thread::hardware_concurrency());
+    for (size_t threads = 1; threads <= maxThreads; threads *= 2) {
+        WorkStealingPool pool(threads);
+        string packed;
+        double ms = timeMs([&] { packCodes(codes, tokens, symbolAt, identity, packed, &pool); });
+        printRow("packCodes x" + to_string(threads) + (packed == serial ? "" : " (MISMATCH)"), ms, tokens);
+    }
+}
+
+// Whitespace splitting: a byte-at-a-time loop against the block masks of each
+// instruction set and the Tokenizer built on them
+void benchTokenize() {
+    string text = makeTokenText(1000000, 8000000, 13);
+    cout << "tokenize: " << text.size() << " bytes" << endl;
+
+    size_t words = 0;
+    printThroughput("byte-at-a-time split", timeMs([&] {
+        size_t pos = 0;
+        while (pos < text.size()) {
+            while (pos < text.size() && isTokenSpace(text[pos])) pos++;
+            if (pos == text.size()) break;
+            while (pos < text.size() && !isTokenSpace(text[pos])) pos++;
+            words++;
+        }
+    }), text.size());
+
+    vector<pair<string, BlockMasker>> maskers = {{"scalar", maskBlocksScalar<WhitespaceDelimiters>}};
+#if defined(__x86_64__) || defined(__i386__)
+#ifdef __SSE2__
+    maskers.push_back({"SSE2", maskBlocksSse2<WhitespaceDelimiters>});
+#endif
+    if (__builtin_cpu_supports("avx2")) maskers.push_back({"AVX2", maskBlocksAvx2<WhitespaceDelimiters>});
+#endif
+    vector<uint64_t> masks(64);
+    for (const auto &masker : maskers) {
+        printThroughput("block masks (" + masker.first + ")", timeMs([&] {
+            size_t delimiters = 0;
+            for (size_t offset = 0; offset + 4096 <= text.size(); offset += 4096) {
+                masker.second(text.data() + offset, 64, masks.data());
+                for (uint64_t mask : masks) delimiters += __builtin_popcountll(mask);
+            }
+            benchmarkSink = delimiters;
+        }), text.size());
+    }
+
+    size_t scanned = 0;
+    printThroughput("Tokenizer", timeMs([&] {
+        Tokenizer tokenizer(text);
+        string_view token;
+        while (tokenizer.next(token)) scanned++;
+    }), text.size());
+    if (scanned != words) cout << "  MISMATCH: " << scanned << " words, expected " << words << endl;
+}
+
+int main(int argc, char *argv[]) {
+    vector<pair<string, function<void()>>> benchmarks = {
+        {"codebook", benchCodebook},
+        {"entropy", benchEntropy},
+        {"ordering", benchOrdering},
+        {"packing", benchPacking},
+        {"tokenize", benchTokenize},
+    };
+
+    StageProfiler summary;
+    for (const auto &benchmark : benchmarks) {
+        bool selected = argc < 2;
+        for (int i = 1; i < argc; ++i) {
+            if (benchmark.first == argv[i]) selected = true;
+        }
+        if (selected) {
+            cout << "\n=== " << benchmark.first << " ===" << endl;
+            ProfileScope scope(&summary, benchmark.first.c_str());
+            benchmark.second();
+        }
+    }
+    summary.report(cout);
+    return 0;
+}
@@ -0,0 +1,215 @@
+#ifndef BINARY_IO_HPP
+#define BINARY_IO_HPP
+
+#include <string>
+#include <string_view>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+using namespace std;
+
+// Little-endian integers, varints and MSB-first bit streams for the binary
+// formats (daemon frames, compact containers)
+
+inline void appendU32(string& out, uint32_t value) {
+    for (int i = 0; i < 4; ++i) out.push_back(static_cast<char>((value >> (8 * i)) & 0xFF));
+}
+
+inline uint32_t readU32(const char* in) {
+    uint32_t value = 0;
+    for (int i = 0; i < 4; ++i) value |= static_cast<uint32_t>(static_cast<unsigned char>(in[i])) << (8 * i);
+    return value;
+}
+
+inline void appendU64(string& out, uint64_t value) {
+    for (int i = 0; i < 8; ++i) out.push_back(static_cast<char>((value >> (8 * i)) & 0xFF));
+}
+
+inline uint64_t readU64(const char* in) {
+    uint64_t value = 0;
+    for (int i = 0; i < 8; ++i) value |= static_cast<uint64_t>(static_cast<unsigned char>(in[i])) << (8 * i);
+    return value;
+}
+
+inline void appendVarint(string& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<char>((value & 0x7F) | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+// Bounds-checked cursor over a byte buffer; running off the end throws
+class ByteReader {
+private:
+    string_view data;
+    size_t pos = 0;
+
+    void need(size_t n) const {
+        if (data.size() - pos < n) throw runtime_error("Truncated input");
+    }
+
+public:
+    explicit ByteReader(string_view d) : data(d) {}
+
+    uint8_t u8() {
+        need(1);
+        return static_cast<uint8_t>(data[pos++]);
+    }
+
+    uint32_t u32() {
+        need(4);
+        uint32_t value = readU32(data.data() + pos);
+        pos += 4;
+        return value;
+    }
+
+    uint64_t u64() {
+        need(8);
+        uint64_t value = readU64(data.data() + pos);
+        pos += 8;
+        return value;
+    }
+
+    uint64_t varint() {
+        uint64_t value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            uint8_t byte = u8();
+            value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+            if (!(byte & 0x80)) return value;
+        }
+        throw runtime_error("Malformed varint");
+    }
+
+    string_view bytes(size_t n) {
+        need(n);
+        string_view view = data.substr(pos, n);
+        pos += n;
+        return view;
+    }
+
+    size_t position() const {
+        return pos;
+    }
+
+    size_t remaining() const {
+        return data.size() - pos;
+    }
+};
+
+// Packs codes MSB-first into bytes appended to out
+class BitWriter {
+private:
+    string& out;
+    uint64_t pending = 0;    // low `count` bits are not yet written
+    int count = 0;
+    uint64_t written = 0;
+
+public:
+    explicit BitWriter(string& o) : out(o) {}
+
+    void write(uint64_t bits, int length) {
+        if (length > 32) {
+            write(bits >> 32, length - 32);
+            bits &= 0xFFFFFFFFULL;
+            length = 32;
+        }
+        pending = (pending << length) | bits;
+        count += length;
+        written += length;
+        while (count >= 8) {
+            count -= 8;
+            out.push_back(static_cast<char>(pending >> count));
+        }
+    }
+
+    // Pads the last byte with zero bits
+    void flush() {
+        if (count > 0) {
+            out.push_back(static_cast<char>(pending << (8 - count)));
+            count = 0;
+        }
+    }
+
+    uint64_t bitCount() const {
+        return written;
+    }
+};
+
+class BitReader {
+private:
+    const unsigned char* data;
+    uint64_t totalBits;
+    uint64_t pos = 0;
+
+public:
+    BitReader(string_view bytes) : data(reinterpret_cast<const unsigned char*>(bytes.data())),
+                                   totalBits(static_cast<uint64_t>(bytes.size()) * 8) {}
+
+    int bit() {
+        if (pos >= totalBits) throw runtime_error("Truncated bit stream");
+        int value = (data[pos >> 3] >> (7 - (pos & 7))) & 1;
+        pos++;
+        return value;
+    }
+
+    uint64_t position() const {
+        return pos;
+    }
+};
+
+// Reads MSB-first bits through a 64-bit window for table-driven decoders.
+// Past the end the window fills with zero bits; overrun() reports reading them.
+class BitWindow {
+private:
+    const unsigned char* pos;
+    const unsigned char* end;
+    uint64_t window = 0;
+    int available = 0;
+    uint64_t consumed = 0;
+    uint64_t totalBits;
+
+public:
+    BitWindow() : pos(nullptr), end(nullptr), totalBits(0) {}
+
+    explicit BitWindow(string_view bytes) : pos(reinterpret_cast<const unsigned char*>(bytes.data())),
+                                            end(pos + bytes.size()),
+                                            totalBits(static_cast<uint64_t>(bytes.size()) * 8) {}
+
+    // Tops the window up to at least 57 valid bits
+    void refill() {
+        if (available > 56) return;
+        if (end - pos >= 8) {
+            uint64_t next;
+            memcpy(&next, pos, 8);
+            next = __builtin_bswap64(next);
+            window |= next >> available;
+            pos += (63 - available) >> 3;
+            available |= 56;
+            return;
+        }
+        while (available <= 56) {
+            uint64_t byte = pos < end ? *pos++ : 0;
+            window |= byte << (56 - available);
+            available += 8;
+        }
+    }
+
+    // The next 64 bits, first bit in the most significant position
+    uint64_t peek() const {
+        return window;
+    }
+
+    void consume(int bits) {
+        window <<= bits;
+        available -= bits;
+        consumed += bits;
+    }
+
+    bool overrun() const {
+        return consumed > totalBits;
+    }
+};
+
+#endif
@@ -0,0 +1,524 @@
+#ifndef BOUNDED_ENCODER_HPP
+#define BOUNDED_ENCODER_HPP
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <queue>
+#include <unordered_map>
+#include <memory>
+#include <fstream>
+#include <numeric>
+#include <algorithm>
+#include <filesystem>
+#include <stdexcept>
+#include <iostream>
+#include <unistd.h>
+#include "tokenizer.hpp"
+#include "codebook.hpp"
+#include "codec.hpp"
+#include "checksum.hpp"
+#include "async_io.hpp"
+#include "rsa.hpp"
+
+using namespace std;
+namespace fs = std::filesystem;
+
+// Encrypts a file of any size within a fixed memory budget, producing the same
+// format as the in-memory modes (shifted codes separated by single spaces plus a
+// huffman_hashmap.txt codebook).
+//
+//  1. Count: words are counted in a hash table capped at half the budget. When
+//     it fills, it is spilled to a run file sorted by (hash, word) and emptied.
+//  2. Merge: runs are k-way merged (in several levels if there are more runs
+//     than I/O buffers fit in the budget) into one vocabulary file, summing counts.
+//  3. Codes: code lengths come from the in-place minimum-redundancy algorithm of
+//     Moffat and Katajainen over the sorted counts, then canonical codes are
+//     assigned while streaming the vocabulary. Only this step holds anything per
+//     distinct word in memory (~9 bytes: its count, then its code length).
+//  4. Encode: the input is streamed again. If the word -> code table does not fit
+//     in half the budget it is split into hash partitions: one pass per partition
+//     writes that partition's codes in input order, and a last pass interleaves them.
+class BoundedEncoder {
+private:
+    static const size_t IO_BUFFER = 256 * 1024;
+    static const size_t CODE_BUFFER = 64 * 1024;
+    static const size_t SYMBOL_OVERHEAD = 64;   // estimated table bytes per distinct word besides its text
+    static const size_t MIN_BUDGET = 8 * 1024 * 1024;
+
+    EncryptionMode mode;
+    const RSA& rsa;
+    CaesarShift caesar;
+    size_t budget;
+    fs::path tempDir;
+    size_t tempCount = 0;
+
+    size_t runCount = 0;
+    size_t distinctWords = 0;
+    size_t partitionCount = 1;
+
+    // One vocabulary line of a run or the merged file: [u64 hash][u32 length][text][u64 count]
+    struct Record {
+        uint64_t hash = 0;
+        string token;
+        uint64_t count = 0;
+
+        bool operator<(const Record& other) const {
+            return hash != other.hash ? hash < other.hash : token < other.token;
+        }
+    };
+
+    class RecordWriter {
+    private:
+        vector<char> buffer;
+        ofstream file;
+
+    public:
+        explicit RecordWriter(const fs::path& path) : buffer(IO_BUFFER) {
+            file.rdbuf()->pubsetbuf(buffer.data(), buffer.size());
+            file.open(path, ios::binary | ios::trunc);
+            if (!file) throw runtime_error("Cannot create temporary file " + path.string());
+        }
+
+        void write(uint64_t hash, string_view token, uint64_t count) {
+            uint32_t length = static_cast<uint32_t>(token.size());
+            file.write(reinterpret_cast<const char*>(&hash), sizeof(hash));
+            file.write(reinterpret_cast<const char*>(&length), sizeof(length));
+            file.write(token.data(), token.size());
+            file.write(reinterpret_cast<const char*>(&count), sizeof(count));
+        }
+
+        void close() {
+            file.close();
+            if (!file) throw runtime_error("Failed writing temporary file");
+        }
+    };
+
+    class RecordReader {
+    private:
+        vector<char> buffer;
+        ifstream file;
+
+    public:
+        explicit RecordReader(const fs::path& path) : buffer(IO_BUFFER) {
+            file.rdbuf()->pubsetbuf(buffer.data(), buffer.size());
+            file.open(path, ios::binary);
+            if (!file) throw runtime_error("Cannot open temporary file " + path.string());
+        }
+
+        bool next(Record& record) {
+            uint32_t length;
+            if (!file.read(reinterpret_cast<char*>(&record.hash), sizeof(record.hash))) return false;
+            file.read(reinterpret_cast<char*>(&length), sizeof(length));
+            record.token.resize(length);
+            file.read(&record.token[0], length);
+            file.read(reinterpret_cast<char*>(&record.count), sizeof(record.count));
+            if (!file) throw runtime_error("Truncated temporary file");
+            return true;
+        }
+    };
+
+    fs::path tempPath(const string& stem) {
+        return tempDir / (stem + "-" + to_string(tempCount++));
+    }
+
+    // Streams the words of a file to onToken; a word split across read chunks is
+    // reassembled in a carry buffer, so memory stays at the chunk size
+    template <typename OnToken>
+    void forEachToken(const string& path, OnToken onToken) {
+        AsyncFileReader reader(path, min<size_t>(1 << 20, budget / 16), 2);
+        if (!reader.isOpen()) throw runtime_error("Cannot open input file: " + path);
+
+        string carry;
+        string_view chunk;
+        while (reader.next(chunk)) {
+            size_t i = 0;
+            if (!carry.empty()) {
+                while (i < chunk.size() && !isTokenSpace(chunk[i])) i++;
+                carry.append(chunk.data(), i);
+                if (carry.size() > budget / 4) throw runtime_error("A single word is larger than the memory budget");
+                if (i == chunk.size()) continue;
+                onToken(string_view(carry));
+                carry.clear();
+            }
+            while (i < chunk.size()) {
+                while (i < chunk.size() && isTokenSpace(chunk[i])) i++;
+                size_t start = i;
+                while (i < chunk.size() && !isTokenSpace(chunk[i])) i++;
+                if (start == i) break;
+                if (i == chunk.size()) {
+                    carry.assign(chunk.data() + start, i - start);
+                } else {
+                    onToken(chunk.substr(start, i - start));
+                }
+            }
+        }
+        if (!carry.empty()) onToken(string_view(carry));
+    }
+
+    // Phase 1: count into a bounded table, spilling sorted runs
+    vector<fs::path> countRuns(const string& input) {
+        vector<fs::path> runs;
+        SymbolTable symbols;
+        vector<uint64_t> counts;
+        size_t tableBytes = 0;
+
+        auto spill = [&] {
+            if (counts.empty()) return;
+            vector<uint32_t> order(counts.size());
+            iota(order.begin(), order.end(), 0);
+            sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+                uint64_t ha = symbols.hashOf(a), hb = symbols.hashOf(b);
+                return ha != hb ? ha < hb : symbols.symbol(a) < symbols.symbol(b);
+            });
+            runs.push_back(tempPath("run"));
+            RecordWriter writer(runs.back());
+            for (uint32_t id : order) {
+                writer.write(symbols.hashOf(id), symbols.symbol(id), counts[id]);
+            }
+            writer.close();
+            symbols = SymbolTable();
+            counts = vector<uint64_t>();
+            tableBytes = 0;
+        };
+
+        forEachToken(input, [&](string_view token) {
+            int id = symbols.internCopy(token);
+            if (id == static_cast<int>(counts.size())) {
+                counts.push_back(0);
+                tableBytes += SYMBOL_OVERHEAD + token.size();
+            }
+            counts[id]++;
+            if (tableBytes > budget / 2) spill();
+        });
+        spill();
+        runCount = runs.size();
+        return runs;
+    }
+
+    fs::path mergeGroup(const vector<fs::path>& group) {
+        vector<unique_ptr<RecordReader>> readers;
+        vector<Record> heads(group.size());
+        auto later = [&](size_t a, size_t b) { return heads[b] < heads[a]; };
+        priority_queue<size_t, vector<size_t>, decltype(later)> queue(later);
+        for (size_t i = 0; i < group.size(); ++i) {
+            readers.emplace_back(new RecordReader(group[i]));
+            if (readers[i]->next(heads[i])) queue.push(i);
+        }
+
+        fs::path merged = tempPath("merge");
+        RecordWriter writer(merged);
+        Record current;
+        bool haveCurrent = false;
+        while (!queue.empty()) {
+            size_t i = queue.top();
+            queue.pop();
+            if (haveCurrent && current.hash == heads[i].hash && current.token == heads[i].token) {
+                current.count += heads[i].count;
+            } else {
+                if (haveCurrent) writer.write(current.hash, current.token, current.count);
+                swap(current, heads[i]);
+                haveCurrent = true;
+            }
+            if (readers[i]->next(heads[i])) queue.push(i);
+        }
+        if (haveCurrent) writer.write(current.hash, current.token, current.count);
+        writer.close();
+        return merged;
+    }
+
+    // Phase 2: k-way merge, fan-in limited by how many read buffers fit the budget
+    fs::path mergeRuns(vector<fs::path> runs) {
+        size_t fanIn = max<size_t>(2, budget / 2 / IO_BUFFER);
+        while (runs.size() > 1) {
+            vector<fs::path> next;
+            for (size_t i = 0; i < runs.size(); i += fanIn) {
+                vector<fs::path> group(runs.begin() + i, runs.begin() + min(runs.size(), i + fanIn));
+                if (group.size() == 1) {
+                    next.push_back(group[0]);
+                    continue;
+                }
+                next.push_back(mergeGroup(group));
+                for (const fs::path& run : group) fs::remove(run);
+            }
+            runs.swap(next);
+        }
+        return runs[0];
+    }
+
+    // In-place minimum-redundancy code lengths (Moffat & Katajainen). A holds the
+    // weights in non-decreasing order and is overwritten with their code lengths.
+    static void minimumRedundancyLengths(vector<uint64_t>& A) {
+        long n = static_cast<long>(A.size());
+        if (n == 0) return;
+        if (n == 1) {
+            A[0] = 1;
+            return;
+        }
+        A[0] += A[1];
+        long root = 0, leaf = 2;
+        for (long next = 1; next < n - 1; ++next) {
+            if (leaf >= n || A[root] < A[leaf]) {
+                A[next] = A[root];
+                A[root++] = next;
+            } else {
+                A[next] = A[leaf++];
+            }
+            if (leaf >= n || (root < next && A[root] < A[leaf])) {
+                A[next] += A[root];
+                A[root++] = next;
+            } else {
+                A[next] += A[leaf++];
+            }
+        }
+        A[n - 2] = 0;
+        for (long next = n - 3; next >= 0; --next) {
+            A[next] = A[A[next]] + 1;
+        }
+        long available = 1, used = 0, depth = 0;
+        root = n - 2;
+        long next = n - 1;
+        while (available > 0) {
+            while (root >= 0 && static_cast<long>(A[root]) == depth) {
+                used++;
+                root--;
+            }
+            while (available > used) {
+                A[next--] = depth;
+                available--;
+            }
+            available = 2 * used;
+            depth++;
+            used = 0;
+        }
+    }
+
+    // Phase 3: code length per vocabulary position (its id). Only the sorted counts
+    // are held; words with equal counts share a block of positions, so each id
+    // takes the next free position of its count's block on a second read.
+    vector<uint8_t> codeLengths(const fs::path& vocabulary) {
+        // Sized by a counting pass first: growing by doubling would briefly need 3x
+        size_t words = 0;
+        Record record;
+        {
+            RecordReader reader(vocabulary);
+            while (reader.next(record)) words++;
+        }
+        vector<uint64_t> sorted;
+        sorted.reserve(words);
+        {
+            RecordReader reader(vocabulary);
+            while (reader.next(record)) sorted.push_back(record.count);
+        }
+        distinctWords = sorted.size();
+        if (sorted.size() * 9 > budget / 2) {
+            cerr << "Warning: " << sorted.size() << " distinct words need about "
+                 << sorted.size() * 9 / (1024 * 1024) << " MiB to build codes, over half the memory budget" << endl;
+        }
+        sort(sorted.begin(), sorted.end());
+
+        unordered_map<uint64_t, size_t> blockNext;     // one entry per distinct count value
+        for (size_t i = sorted.size(); i-- > 0;) blockNext[sorted[i]] = i;
+
+        minimumRedundancyLengths(sorted);
+        vector<uint8_t> lengths(sorted.size());
+        RecordReader reader(vocabulary);
+        for (size_t id = 0; reader.next(record); ++id) {
+            uint64_t length = sorted[blockNext[record.count]++];
+            if (length > static_cast<uint64_t>(HuffmanCode::MAX_LENGTH)) {
+                throw runtime_error("Huffman code exceeds 64 bits");
+            }
+            lengths[id] = static_cast<uint8_t>(length);
+        }
+        return lengths;
+    }
+
+    size_t partitionOf(uint64_t hash) const {
+        return partitionCount == 1 ? 0 : static_cast<size_t>(hash >> (64 - __builtin_ctzll(partitionCount)));
+    }
+
+    // Loads one partition of the plain "word:code" file, a byte range of it
+    void loadPartition(const string& path, uint64_t begin, uint64_t end, Codebook& codes) {
+        codes.clear();
+        ifstream file(path, ios::binary);
+        file.seekg(static_cast<streamoff>(begin));
+        string line;
+        while (static_cast<uint64_t>(file.tellg()) < end && getline(file, line)) {
+            size_t colon = line.rfind(':');
+            codes.insert_or_assign(string_view(line).substr(0, colon),
+                                   HuffmanCode::fromString(string_view(line).substr(colon + 1)));
+        }
+    }
+
+    // Every pass after the first re-reads the input and expects the words it counted
+    [[noreturn]] static void inputChanged() {
+        throw runtime_error("Code stream ended early; was the input modified?");
+    }
+
+    static const HuffmanCode& codeOf(const Codebook& codes, string_view token) {
+        const HuffmanCode* code = codes.lookup(token);
+        if (!code) inputChanged();
+        return *code;
+    }
+
+    // Writes token's code and adds the pair to the block checksums
+    void writeShifted(AsyncFileWriter& out, string_view token, const HuffmanCode& code, bool& first,
+                      ChecksumBuilder& checksums) {
+        char text[HuffmanCode::MAX_LENGTH + 1];
+        size_t used = 0;
+        if (!first) text[used++] = ' ';
+        code.writeTo(text + used);
+        caesar.encodeChunk(text + used, text + used, code.length);
+        out.write(text, used + code.length);
+        checksums.add(token, string_view(text + used, code.length));
+        first = false;
+    }
+
+public:
+    BoundedEncoder(EncryptionMode m, const RSA& keys, int s, size_t memoryBudget, const string& tempRoot = "")
+        : mode(m), rsa(keys), caesar(s), budget(memoryBudget) {
+        if (budget < MIN_BUDGET) {
+            throw runtime_error("Memory budget must be at least " + to_string(MIN_BUDGET >> 20) + " MiB");
+        }
+        fs::path root = tempRoot.empty() ? fs::temp_directory_path() : fs::path(tempRoot);
+        tempDir = root / ("daa-spill-" + to_string(getpid()) + "-" + to_string(reinterpret_cast<uintptr_t>(this)));
+        fs::create_directories(tempDir);
+    }
+
+    BoundedEncoder(const BoundedEncoder&) = delete;
+    BoundedEncoder& operator=(const BoundedEncoder&) = delete;
+
+    ~BoundedEncoder() {
+        error_code ignored;
+        fs::remove_all(tempDir, ignored);
+    }
+
+    size_t getRunCount() const {
+        return runCount;
+    }
+
+    size_t getDistinctWords() const {
+        return distinctWords;
+    }
+
+    size_t getPartitionCount() const {
+        return partitionCount;
+    }
+
+    void encryptFile(const string& inputFile, const string& outputFile, const string& codebookFile) {
+        vector<fs::path> runs = countRuns(inputFile);
+        AsyncFileWriter out(outputFile);
+        if (!out.isOpen()) throw runtime_error("Failed to create output file: " + outputFile);
+        // Until the new checksums are saved, a sidecar from an earlier run would not match
+        removeChecksumFile(outputFile);
+        if (runs.empty()) {
+            out.close();
+            saveCodebookFile(Codebook(), codebookFile);
+            return;
+        }
+        fs::path vocabulary = mergeRuns(runs);
+        vector<uint8_t> lengths = codeLengths(vocabulary);
+
+        // Canonical codes: per length, consecutive values in vocabulary order
+        uint64_t lengthCount[HuffmanCode::MAX_LENGTH + 1] = {};
+        for (uint8_t length : lengths) lengthCount[length]++;
+        uint64_t nextCode[HuffmanCode::MAX_LENGTH + 1] = {};
+        uint64_t code = 0;
+        for (int length = 1; length <= HuffmanCode::MAX_LENGTH; ++length) {
+            code = (code + lengthCount[length - 1]) << 1;
+            nextCode[length] = code;
+        }
+
+        // Plain word -> code table size decides the partition count
+        uint64_t tableBytes = 0;
+        {
+            RecordReader reader(vocabulary);
+            Record record;
+            while (reader.next(record)) tableBytes += SYMBOL_OVERHEAD + record.token.size();
+        }
+        while (tableBytes / partitionCount > budget / 2) partitionCount *= 2;
+
+        // Write the codebook and the plain table, noting where each partition starts
+        string plainPath = mode == EncryptionMode::Combined ? tempPath("codes").string() : codebookFile;
+        vector<uint64_t> partitionStart(partitionCount + 1, 0);
+        {
+            ofstream codebook(codebookFile, ios::binary);
+            unique_ptr<ofstream> plain;
+            if (mode == EncryptionMode::Combined) plain.reset(new ofstream(plainPath, ios::binary));
+            ofstream& plainOut = plain ? *plain : codebook;
+            if (!codebook || !plainOut) throw runtime_error("Failed to create codebook file: " + codebookFile);
+
+            RecordReader reader(vocabulary);
+            Record record;
+            size_t id = 0, partition = 0;
+            while (reader.next(record)) {
+                size_t p = partitionOf(record.hash);
+                while (partition < p) partitionStart[++partition] = static_cast<uint64_t>(plainOut.tellp());
+                HuffmanCode value;
+                value.length = lengths[id++];
+                value.bits = nextCode[value.length]++;
+                if (plain) codebook << rsa.encryptString(record.token) << ":" << value << "\n";
+                plainOut << record.token << ":" << value << "\n";
+            }
+            plainOut.flush();
+            while (partition < partitionCount) partitionStart[++partition] = static_cast<uint64_t>(plainOut.tellp());
+            if (!codebook || !plainOut) throw runtime_error("Failed to write codebook file: " + codebookFile);
+        }
+        lengths = vector<uint8_t>();
+        fs::remove(vocabulary);
+
+        bool first = true;
+        ChecksumBuilder checksums;
+        Codebook codes;
+        if (partitionCount == 1) {
+            loadPartition(plainPath, partitionStart[0], partitionStart[1], codes);
+            forEachToken(inputFile, [&](string_view token) {
+                writeShifted(out, token, codeOf(codes, token), first, checksums);
+            });
+            out.close();
+            checksums.finish().save(checksumFileFor(outputFile));
+            return;
+        }
+
+        // One pass per partition writes its codes in input order...
+        vector<fs::path> codeStreams;
+        for (size_t p = 0; p < partitionCount; ++p) {
+            loadPartition(plainPath, partitionStart[p], partitionStart[p + 1], codes);
+            codeStreams.push_back(tempPath("stream"));
+            vector<char> buffer(CODE_BUFFER);
+            ofstream stream;
+            stream.rdbuf()->pubsetbuf(buffer.data(), buffer.size());
+            stream.open(codeStreams.back(), ios::binary);
+            forEachToken(inputFile, [&](string_view token) {
+                if (partitionOf(hashToken(token)) != p) return;
+                const HuffmanCode& found = codeOf(codes, token);
+                stream.write(reinterpret_cast<const char*>(&found.bits), sizeof(found.bits));
+                stream.write(reinterpret_cast<const char*>(&found.length), sizeof(found.length));
+            });
+            stream.close();
+            if (!stream) throw runtime_error("Failed writing temporary file");
+        }
+        codes = Codebook();
+
+        // ...and the last pass takes each word's code from its partition's stream
+        vector<vector<char>> buffers(partitionCount, vector<char>(CODE_BUFFER));
+        vector<unique_ptr<ifstream>> streams;
+        for (size_t p = 0; p < partitionCount; ++p) {
+            streams.emplace_back(new ifstream());
+            streams[p]->rdbuf()->pubsetbuf(buffers[p].data(), buffers[p].size());
+            streams[p]->open(codeStreams[p], ios::binary);
+        }
+        forEachToken(inputFile, [&](string_view token) {
+            ifstream& stream = *streams[partitionOf(hashToken(token))];
+            HuffmanCode value;
+            stream.read(reinterpret_cast<char*>(&value.bits), sizeof(value.bits));
+            stream.read(reinterpret_cast<char*>(&value.length), sizeof(value.length));
+            if (!stream) inputChanged();
+            writeShifted(out, token, value, first, checksums);
+        });
+        out.close();
+        checksums.finish().save(checksumFileFor(outputFile));
+    }
+};
+
+#endif
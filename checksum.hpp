@@ -0,0 +1,292 @@
+#ifndef CHECKSUM_HPP
+#define CHECKSUM_HPP
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <array>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <cstdint>
+#include <cstring>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#endif
+
+using namespace std;
+
+// CRC32C (Castagnoli) block checksums for the text outputs. The encoder splits
+// the token stream into blocks of BLOCK_TOKENS words and records, per block,
+// the CRC of the encrypted bytes and of the plaintext (the words joined by
+// single spaces, as every decrypt path writes them). They are saved next to
+// the encrypted file as "<file>.crc", so the text format itself is unchanged.
+//
+// A decrypt checks the encrypted bytes up front, which rejects a truncated or
+// corrupt file before any decoding, then checks each plaintext block as soon
+// as it is complete, which rejects a wrong codebook or wrong keys after the
+// first block instead of after the whole file.
+
+// Table for the byte-at-a-time fallback: slice k advances a byte k positions
+// further, so eight bytes fold in with one lookup each
+constexpr array<array<uint32_t, 256>, 8> makeCrc32cTables() {
+    array<array<uint32_t, 256>, 8> tables{};
+    for (uint32_t b = 0; b < 256; ++b) {
+        uint32_t crc = b;
+        for (int i = 0; i < 8; ++i) crc = (crc >> 1) ^ (0x82F63B78u & (0u - (crc & 1)));
+        tables[0][b] = crc;
+    }
+    for (int k = 1; k < 8; ++k) {
+        for (uint32_t b = 0; b < 256; ++b) tables[k][b] = (tables[k - 1][b] >> 8) ^ tables[0][tables[k - 1][b] & 0xFF];
+    }
+    return tables;
+}
+
+constexpr array<array<uint32_t, 256>, 8> CRC32C_TABLES = makeCrc32cTables();
+
+// Raw register update (no pre/post inversion)
+inline uint32_t crc32cSoftware(uint32_t crc, const char* data, size_t length) {
+    const auto& t = CRC32C_TABLES;
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(data);
+    for (; length >= 8; length -= 8, p += 8) {
+        uint64_t word;
+        memcpy(&word, p, 8);
+        word ^= crc;
+        crc = t[7][word & 0xFF] ^ t[6][(word >> 8) & 0xFF] ^ t[5][(word >> 16) & 0xFF] ^ t[4][(word >> 24) & 0xFF] ^
+              t[3][(word >> 32) & 0xFF] ^ t[2][(word >> 40) & 0xFF] ^ t[1][(word >> 48) & 0xFF] ^ t[0][word >> 56];
+    }
+    for (; length; --length, ++p) crc = (crc >> 8) ^ t[0][(crc ^ *p) & 0xFF];
+    return crc;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// The SSE4.2 crc32 instruction computes the same polynomial, eight bytes at a time
+__attribute__((target("sse4.2"))) inline uint32_t crc32cHardware(uint32_t crc, const char* data, size_t length) {
+#ifdef __x86_64__
+    uint64_t wide = crc;
+    for (; length >= 8; length -= 8, data += 8) {
+        uint64_t word;
+        memcpy(&word, data, 8);
+        wide = _mm_crc32_u64(wide, word);
+    }
+    crc = static_cast<uint32_t>(wide);
+#endif
+    for (; length; --length, ++data) crc = _mm_crc32_u8(crc, static_cast<unsigned char>(*data));
+    return crc;
+}
+
+#endif
+
+// Raw register update with the fastest implementation this CPU has
+using Crc32cUpdate = uint32_t (*)(uint32_t crc, const char* data, size_t length);
+
+inline Crc32cUpdate crc32cUpdate() {
+#if defined(__x86_64__) || defined(__i386__)
+    static const Crc32cUpdate update = __builtin_cpu_supports("sse4.2") ? crc32cHardware : crc32cSoftware;
+    return update;
+#else
+    return crc32cSoftware;
+#endif
+}
+
+// Continue a CRC32C over more bytes; crc32cExtend(crc32c(a), b) == crc32c(a + b)
+inline uint32_t crc32cExtend(uint32_t crc, string_view data) {
+    return ~crc32cUpdate()(~crc, data.data(), data.size());
+}
+
+inline uint32_t crc32c(string_view data) {
+    return crc32cExtend(0, data);
+}
+
+// One block of consecutive tokens. Every block after the first starts with
+// the space that separates it from the previous block, so the blocks tile the
+// encrypted text and the plaintext exactly.
+struct ChecksumBlock {
+    uint64_t tokens = 0;
+    uint64_t encodedBytes = 0;
+    uint64_t plainBytes = 0;
+    uint32_t encodedCrc = 0;
+    uint32_t plainCrc = 0;
+};
+
+class BlockChecksums {
+public:
+    static const uint64_t BLOCK_TOKENS = 1 << 16;
+
+    vector<ChecksumBlock> blocks;
+
+    uint64_t tokenCount() const {
+        uint64_t total = 0;
+        for (const ChecksumBlock& block : blocks) total += block.tokens;
+        return total;
+    }
+
+    uint64_t encodedSize() const {
+        uint64_t total = 0;
+        for (const ChecksumBlock& block : blocks) total += block.encodedBytes;
+        return total;
+    }
+
+    // Throws unless encrypted is exactly the text the checksums were taken of
+    void verifyEncoded(string_view encrypted) const {
+        if (encrypted.size() != encodedSize()) {
+            throw runtime_error("Encrypted text is " + to_string(encrypted.size()) + " bytes, checksums cover " +
+                                to_string(encodedSize()) + ": the file is truncated or altered");
+        }
+        size_t offset = 0;
+        for (size_t i = 0; i < blocks.size(); ++i) {
+            if (crc32c(encrypted.substr(offset, blocks[i].encodedBytes)) != blocks[i].encodedCrc) {
+                throw runtime_error("Checksum mismatch in encrypted block " + to_string(i) + ": the file is corrupt");
+            }
+            offset += blocks[i].encodedBytes;
+        }
+    }
+
+    // Text format: a header line, then one line per block
+    void write(ostream& file) const {
+        file << "crc32c " << BLOCK_TOKENS << " " << blocks.size() << "\n" << hex;
+        for (const ChecksumBlock& block : blocks) {
+            file << block.tokens << " " << block.encodedBytes << " " << block.plainBytes << " " << block.encodedCrc
+                 << " " << block.plainCrc << "\n";
+        }
+        file << dec;
+    }
+
+    void save(const string& filename) const {
+        ofstream file(filename, ios::binary);
+        if (!file) throw runtime_error("Failed to create checksum file: " + filename);
+        write(file);
+        if (!file) throw runtime_error("Failed to write checksum file: " + filename);
+    }
+
+    // Throws if the text is malformed; source names where it came from
+    void read(istream& file, const string& source) {
+        string magic;
+        uint64_t blockTokens = 0, count = 0;
+        if (!(file >> magic >> blockTokens >> count) || magic != "crc32c" || blockTokens == 0) {
+            throw runtime_error("Malformed checksum file: " + source);
+        }
+        blocks.clear();
+        file >> hex;
+        for (uint64_t i = 0; i < count; ++i) {
+            ChecksumBlock block;
+            if (!(file >> block.tokens >> block.encodedBytes >> block.plainBytes >> block.encodedCrc >> block.plainCrc) ||
+                block.tokens == 0) {
+                throw runtime_error("Malformed checksum file: " + source);
+            }
+            blocks.push_back(block);
+        }
+    }
+
+    // False if there is no such file; throws if it is malformed
+    bool load(const string& filename) {
+        ifstream file(filename, ios::binary);
+        if (!file) return false;
+        read(file, filename);
+        return true;
+    }
+};
+
+// Where the checksums of an encrypted file are kept
+inline string checksumFileFor(const string& encryptedFile) {
+    return encryptedFile + ".crc";
+}
+
+// Drops a stale sidecar when a file is rewritten without checksums
+inline void removeChecksumFile(const string& encryptedFile) {
+    unlink(checksumFileFor(encryptedFile).c_str());
+}
+
+// Running CRCs of one block, kept as raw registers between tokens
+struct BlockAccumulator {
+    ChecksumBlock block;
+    uint32_t encodedRegister = ~0u;
+    uint32_t plainRegister = ~0u;
+    Crc32cUpdate update = crc32cUpdate();
+
+    // Every token but the stream's first is preceded by a space on both sides
+    void addPlain(string_view plain, bool separated) {
+        if (separated) {
+            plainRegister = update(plainRegister, " ", 1);
+            block.plainBytes++;
+        }
+        plainRegister = update(plainRegister, plain.data(), plain.size());
+        block.plainBytes += plain.size();
+        block.tokens++;
+    }
+
+    void addEncoded(string_view encoded, bool separated) {
+        if (separated) {
+            encodedRegister = update(encodedRegister, " ", 1);
+            block.encodedBytes++;
+        }
+        encodedRegister = update(encodedRegister, encoded.data(), encoded.size());
+        block.encodedBytes += encoded.size();
+    }
+
+    ChecksumBlock take() {
+        ChecksumBlock done = block;
+        done.encodedCrc = ~encodedRegister;
+        done.plainCrc = ~plainRegister;
+        *this = BlockAccumulator();
+        return done;
+    }
+};
+
+// Collects checksums as an encoder writes each token
+class ChecksumBuilder {
+private:
+    BlockChecksums sums;
+    BlockAccumulator current;
+    bool firstToken = true;
+
+public:
+    // One token: its plain word and the exact bytes written for it
+    void add(string_view plain, string_view encoded) {
+        current.addEncoded(encoded, !firstToken);
+        current.addPlain(plain, !firstToken);
+        firstToken = false;
+        if (current.block.tokens == BlockChecksums::BLOCK_TOKENS) sums.blocks.push_back(current.take());
+    }
+
+    BlockChecksums finish() {
+        if (current.block.tokens) sums.blocks.push_back(current.take());
+        firstToken = true;
+        return move(sums);
+    }
+};
+
+// Checks the plaintext a decoder produces, one block at a time
+class ChecksumVerifier {
+private:
+    const BlockChecksums& sums;
+    size_t block = 0;
+    BlockAccumulator current;
+    bool firstToken = true;
+
+public:
+    explicit ChecksumVerifier(const BlockChecksums& s) : sums(s) {}
+
+    // Call with each decoded word in order; throws as soon as a block differs
+    void add(string_view plain) {
+        if (block == sums.blocks.size()) throw runtime_error("Decoded more words than the checksums cover");
+        current.addPlain(plain, !firstToken);
+        firstToken = false;
+        const ChecksumBlock& expected = sums.blocks[block];
+        if (current.block.tokens < expected.tokens) return;
+        ChecksumBlock done = current.take();
+        if (done.plainBytes != expected.plainBytes || done.plainCrc != expected.plainCrc) {
+            throw runtime_error("Checksum mismatch in decrypted block " + to_string(block) +
+                                ": wrong codebook or keys for this file");
+        }
+        block++;
+    }
+
+    // Throws if the decode stopped short of the last block
+    void finish() const {
+        if (block != sums.blocks.size()) throw runtime_error("Decoded fewer words than the checksums cover");
+    }
+};
+
+#endif
@@ -0,0 +1,385 @@
+#ifndef CODEBOOK_HPP
+#define CODEBOOK_HPP
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <iostream>
+#include <stdexcept>
+#include <cstdint>
+#include <algorithm>
+#include "tokenizer.hpp"
+
+using namespace std;
+
+// A Huffman code packed into an integer: the first code bit is the most
+// significant of the low `length` bits of `bits`
+struct HuffmanCode {
+    uint64_t bits = 0;
+    uint8_t length = 0;
+
+    static const int MAX_LENGTH = 64;
+
+    // Parse a "0101" style code; returns false for anything that is not a valid code
+    static bool parse(string_view text, HuffmanCode &code) {
+        if (text.empty() || text.size() > MAX_LENGTH) return false;
+        code.bits = 0;
+        for (char c : text) {
+            if (c != '0' && c != '1') return false;
+            code.bits = (code.bits << 1) | static_cast<uint64_t>(c - '0');
+        }
+        code.length = static_cast<uint8_t>(text.size());
+        return true;
+    }
+
+    static HuffmanCode fromString(string_view text) {
+        HuffmanCode code;
+        if (!parse(text, code)) {
+            throw runtime_error("Invalid Huffman code: " + string(text));
+        }
+        return code;
+    }
+
+    // Extend the code by one bit (used when decoding bit by bit)
+    void append(int bit) {
+        bits = (bits << 1) | static_cast<uint64_t>(bit);
+        length++;
+    }
+
+    // Writes the code as '0'/'1' characters into out (which must hold `length` chars)
+    void writeTo(char *out) const {
+        for (int i = 0; i < length; ++i) {
+            out[i] = ((bits >> (length - 1 - i)) & 1) ? '1' : '0';
+        }
+    }
+
+    string toString() const {
+        string text(length, '0');
+        writeTo(&text[0]);
+        return text;
+    }
+
+    bool operator==(const HuffmanCode &other) const {
+        return bits == other.bits && length == other.length;
+    }
+
+    bool operator!=(const HuffmanCode &other) const {
+        return !(*this == other);
+    }
+
+    uint64_t hash() const {
+        uint64_t h = (bits ^ (static_cast<uint64_t>(length) << 58)) * 0x9E3779B97F4A7C15ULL;
+        return h ^ (h >> 29);
+    }
+};
+
+inline ostream &operator<<(ostream &os, const HuffmanCode &code) {
+    char text[HuffmanCode::MAX_LENGTH];
+    code.writeTo(text);
+    return os.write(text, code.length);
+}
+
+// Flat open-addressing map from token to HuffmanCode.
+// Entries live in one dense vector (iteration order = insertion order), token
+// text lives in one contiguous string, and the probe table is a vector of
+// (hash tag, entry index) words, so a lookup touches two flat arrays and never
+// allocates. Lookups take string_view, so callers never build a temporary key.
+class Codebook {
+public:
+    struct Entry {
+        string_view first;      // token (points into the key arena)
+        HuffmanCode second;     // code
+    };
+
+private:
+    struct StoredEntry {
+        uint64_t hash;
+        size_t keyOffset;
+        uint32_t keyLength;
+        HuffmanCode code;
+    };
+
+    vector<StoredEntry> entries;
+    vector<uint64_t> slots;     // 0 = empty, else (hash tag << 32) | (entry index + 1)
+    string keys;
+
+    static uint64_t makeSlot(uint64_t h, size_t index) {
+        return (h & 0xFFFFFFFF00000000ULL) | static_cast<uint64_t>(index + 1);
+    }
+
+    string_view keyOf(const StoredEntry &entry) const {
+        return string_view(keys.data() + entry.keyOffset, entry.keyLength);
+    }
+
+    // Returns the slot holding token, or the empty slot where it would go
+    size_t findSlot(string_view token, uint64_t h) const {
+        size_t mask = slots.size() - 1;
+        size_t i = h & mask;
+        uint64_t tag = h & 0xFFFFFFFF00000000ULL;
+        while (slots[i] != 0) {
+            if ((slots[i] & 0xFFFFFFFF00000000ULL) == tag) {
+                const StoredEntry &entry = entries[(slots[i] & 0xFFFFFFFFULL) - 1];
+                if (entry.hash == h && keyOf(entry) == token) return i;
+            }
+            i = (i + 1) & mask;
+        }
+        return i;
+    }
+
+    void rehash(size_t newSize) {
+        slots.assign(newSize, 0);
+        size_t mask = newSize - 1;
+        for (size_t index = 0; index < entries.size(); ++index) {
+            size_t i = entries[index].hash & mask;
+            while (slots[i] != 0) i = (i + 1) & mask;
+            slots[i] = makeSlot(entries[index].hash, index);
+        }
+    }
+
+public:
+    class const_iterator {
+    private:
+        const Codebook *book;
+        size_t index;
+        mutable Entry current;
+
+    public:
+        const_iterator(const Codebook *b, size_t i) : book(b), index(i) {}
+
+        const Entry &operator*() const {
+            const StoredEntry &entry = book->entries[index];
+            current.first = book->keyOf(entry);
+            current.second = entry.code;
+            return current;
+        }
+        const Entry *operator->() const { return &**this; }
+        const_iterator &operator++() { ++index; return *this; }
+        bool operator==(const const_iterator &other) const { return index == other.index; }
+        bool operator!=(const const_iterator &other) const { return index != other.index; }
+    };
+
+    Codebook() = default;
+
+    // Copies rebuild the key views against the new key arena automatically,
+    // since entries store offsets rather than pointers
+    Codebook(const Codebook &) = default;
+    Codebook &operator=(const Codebook &) = default;
+    Codebook(Codebook &&) = default;
+    Codebook &operator=(Codebook &&) = default;
+
+    void reserve(size_t n) {
+        entries.reserve(n);
+        size_t needed = 16;
+        while (needed < n * 2) needed <<= 1;
+        if (needed > slots.size()) rehash(needed);
+    }
+
+    // Insert a token, or replace its code if already present
+    void insert_or_assign(string_view token, HuffmanCode code) {
+        if ((entries.size() + 1) * 2 > slots.size()) {
+            rehash(slots.empty() ? 16 : slots.size() * 2);
+        }
+        uint64_t h = hashToken(token);
+        size_t i = findSlot(token, h);
+        if (slots[i] != 0) {
+            entries[(slots[i] & 0xFFFFFFFFULL) - 1].code = code;
+            return;
+        }
+        StoredEntry entry;
+        entry.hash = h;
+        entry.keyOffset = keys.size();
+        entry.keyLength = static_cast<uint32_t>(token.size());
+        entry.code = code;
+        keys.append(token.data(), token.size());
+        slots[i] = makeSlot(h, entries.size());
+        entries.push_back(entry);
+    }
+
+    // Returns the code for token, or nullptr if it has none
+    const HuffmanCode *lookup(string_view token) const {
+        if (slots.empty()) return nullptr;
+        size_t i = findSlot(token, hashToken(token));
+        if (slots[i] == 0) return nullptr;
+        return &entries[(slots[i] & 0xFFFFFFFFULL) - 1].code;
+    }
+
+    const_iterator find(string_view token) const {
+        if (slots.empty()) return end();
+        size_t i = findSlot(token, hashToken(token));
+        if (slots[i] == 0) return end();
+        return const_iterator(this, (slots[i] & 0xFFFFFFFFULL) - 1);
+    }
+
+    size_t count(string_view token) const {
+        return lookup(token) ? 1 : 0;
+    }
+
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, entries.size()); }
+
+    size_t size() const { return entries.size(); }
+    bool empty() const { return entries.empty(); }
+
+    void clear() {
+        entries.clear();
+        slots.clear();
+        keys.clear();
+    }
+};
+
+// Reverse index from HuffmanCode back to its token, built once per codebook.
+// Uses a minimal perfect hash (hash-and-displace): codes are grouped into small
+// buckets, and each bucket gets a seed that sends all of its codes to distinct
+// slots of a table with exactly one slot per code. Single-code buckets store
+// their slot directly instead of a seed, which keeps the build linear. A lookup
+// is two hashes and one slot compare; the slot keeps its code so that text which
+// is not a code is rejected.
+// Token views point into the source codebook, which must outlive this index.
+class ReverseCodebook {
+private:
+    struct Slot {
+        HuffmanCode code;       // length 0 = unused
+        string_view token;
+    };
+
+    static const uint32_t DIRECT_SLOT = 0x80000000U;
+    // A bucket of a few codes with distinct hashes finds a seed within tens
+    // of tries; this many only fail when hashes collide
+    static const uint32_t MAX_SEED_TRIES = 1u << 20;
+
+    vector<uint32_t> seeds;     // per bucket: seed, or DIRECT_SLOT | slot index
+    vector<Slot> slots;
+
+    static uint64_t mix(uint64_t h) {
+        h ^= h >> 33;
+        h *= 0xFF51AFD7ED558CCDULL;
+        h ^= h >> 33;
+        h *= 0xC4CEB9FE1A85EC53ULL;
+        return h ^ (h >> 33);
+    }
+
+    // Maps a 64-bit hash onto [0, range) with a multiply instead of a division
+    static size_t reduce(uint64_t h, size_t range) {
+        return static_cast<size_t>((static_cast<unsigned __int128>(h) * range) >> 64);
+    }
+
+    size_t bucketOf(uint64_t h) const {
+        return reduce(h, seeds.size());
+    }
+
+    size_t slotOf(uint64_t h, uint32_t seed) const {
+        if (seed & DIRECT_SLOT) return seed & ~DIRECT_SLOT;
+        return reduce(mix(h ^ (static_cast<uint64_t>(seed) * 0x9E3779B97F4A7C15ULL)), slots.size());
+    }
+
+public:
+    ReverseCodebook() = default;
+
+    explicit ReverseCodebook(const Codebook &codebook) {
+        build(codebook);
+    }
+
+    void build(const Codebook &codebook) {
+        size_t n = codebook.size();
+        seeds.assign(n / 2 + 1, 0);
+        slots.assign(n, Slot());
+        if (n == 0) return;
+
+        // Group codes by bucket (counting sort into one flat array)
+        vector<Codebook::Entry> entries;
+        vector<uint64_t> hashes;
+        entries.reserve(n);
+        hashes.reserve(n);
+        for (const auto &pair : codebook) {
+            entries.push_back(pair);
+            hashes.push_back(pair.second.hash());
+        }
+        size_t bucketCount = seeds.size();
+        vector<uint32_t> bucketStart(bucketCount + 1, 0);
+        for (size_t i = 0; i < n; ++i) bucketStart[bucketOf(hashes[i]) + 1]++;
+        for (size_t b = 0; b < bucketCount; ++b) bucketStart[b + 1] += bucketStart[b];
+        vector<uint32_t> members(n);
+        vector<uint32_t> fill(bucketStart.begin(), bucketStart.end() - 1);
+        for (size_t i = 0; i < n; ++i) members[fill[bucketOf(hashes[i])]++] = static_cast<uint32_t>(i);
+
+        // Place the largest buckets first, while the table is still empty
+        size_t largest = 0;
+        for (size_t b = 0; b < bucketCount; ++b) {
+            largest = max<size_t>(largest, bucketStart[b + 1] - bucketStart[b]);
+        }
+        vector<vector<uint32_t>> bySize(largest + 1);
+        for (size_t b = 0; b < bucketCount; ++b) {
+            bySize[bucketStart[b + 1] - bucketStart[b]].push_back(static_cast<uint32_t>(b));
+        }
+
+        vector<bool> taken(n, false);
+        size_t placed[64];
+        size_t nextFree = 0;
+        for (size_t size = largest; size >= 1; --size) {
+            for (uint32_t b : bySize[size]) {
+                const uint32_t *bucket = &members[bucketStart[b]];
+
+                if (size == 1) {
+                    while (taken[nextFree]) nextFree++;
+                    seeds[b] = DIRECT_SLOT | static_cast<uint32_t>(nextFree);
+                } else {
+                    if (size > 64) {
+                        throw runtime_error("Failed to build reverse codebook index");
+                    }
+                    // Equal codes hash alike under every seed, so no seed would separate them
+                    for (size_t i = 1; i < size; ++i) {
+                        for (size_t j = 0; j < i; ++j) {
+                            if (entries[bucket[i]].second == entries[bucket[j]].second) {
+                                throw runtime_error("Duplicate code in codebook");
+                            }
+                        }
+                    }
+                    for (uint32_t seed = 0;; ++seed) {
+                        if (seed == MAX_SEED_TRIES) {
+                            throw runtime_error("Failed to build reverse codebook index");
+                        }
+                        size_t count = 0;
+                        for (; count < size; ++count) {
+                            size_t slot = slotOf(hashes[bucket[count]], seed);
+                            if (taken[slot] || find(placed, placed + count, slot) != placed + count) break;
+                            placed[count] = slot;
+                        }
+                        if (count == size) {
+                            seeds[b] = seed;
+                            break;
+                        }
+                    }
+                }
+
+                for (size_t k = 0; k < size; ++k) {
+                    size_t slot = slotOf(hashes[bucket[k]], seeds[b]);
+                    taken[slot] = true;
+                    slots[slot].code = entries[bucket[k]].second;
+                    slots[slot].token = entries[bucket[k]].first;
+                }
+            }
+        }
+    }
+
+    // Returns true and sets token if code belongs to the codebook
+    bool lookup(const HuffmanCode &code, string_view &token) const {
+        if (slots.empty() || code.length == 0) return false;
+        uint64_t h = code.hash();
+        const Slot &slot = slots[slotOf(h, seeds[bucketOf(h)])];
+        if (slot.code != code) return false;
+        token = slot.token;
+        return true;
+    }
+
+    // Same, for a code still in "0101" text form
+    bool lookup(string_view codeText, string_view &token) const {
+        HuffmanCode code;
+        return HuffmanCode::parse(codeText, code) && lookup(code, token);
+    }
+
+    size_t size() const {
+        return slots.size();
+    }
+};
+
+#endif
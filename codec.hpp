@@ -0,0 +1,239 @@
+#ifndef CODEC_HPP
+#define CODEC_HPP
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <fstream>
+#include <stdexcept>
+#include "tokenizer.hpp"
+#include "codebook.hpp"
+#include "avl_tree.hpp"
+#include "eytzinger_tree.hpp"
+#include "huffman.hpp"
+#include "rsa.hpp"
+#include "checksum.hpp"
+
+using namespace std;
+
+// In-memory building blocks of the two encryption modes. Nothing here touches
+// globals or files, so several files can be encoded on different threads at once.
+
+enum class EncryptionMode {
+    Combined = 1,       // RSA + Huffman + Caesar
+    HuffmanCaesar = 2   // Huffman + Caesar
+};
+
+// Caesar shift every entry point uses unless told otherwise
+constexpr int CAESAR_SHIFT = 4;
+
+// The Caesar shift itself: digits rotate by shift (either sign, any size),
+// everything else passes through. CaesarStage (stages.hpp) builds its tables
+// from this at compile time, CaesarShift below at run time.
+constexpr char shiftDigit(char c, int shift) {
+    return (c >= '0' && c <= '9') ? static_cast<char>('0' + ((c - '0' + shift) % 10 + 10) % 10) : c;
+}
+
+// Every byte shifted once, for chunked file transforms
+constexpr array<char, 256> digitShiftTable(int shift) {
+    array<char, 256> table{};
+    for (int b = 0; b < 256; ++b) table[b] = shiftDigit(static_cast<char>(b), shift);
+    return table;
+}
+
+// A shift chosen at run time, as tables built once per encoder or decoder
+struct CaesarShift {
+    array<char, 256> encode{};
+    array<int8_t, 256> bits{};    // bit each encrypted byte reads back as, or -1
+    char zero = '0';
+    char one = '1';
+
+    constexpr explicit CaesarShift(int shift)
+        : encode(digitShiftTable(shift)), zero(shiftDigit('0', shift)), one(shiftDigit('1', shift)) {
+        for (int b = 0; b < 256; ++b) {
+            char c = shiftDigit(static_cast<char>(b), -shift);
+            bits[b] = c == '0' ? 0 : (c == '1' ? 1 : -1);
+        }
+    }
+
+    void encodeChunk(const char* in, char* out, size_t length) const {
+        for (size_t i = 0; i < length; ++i) out[i] = encode[static_cast<unsigned char>(in[i])];
+    }
+
+    int bit(char c) const {
+        return bits[static_cast<unsigned char>(c)];
+    }
+};
+
+// Write a codebook in huffman_hashmap.txt format, one "token:code" per line
+inline void writeCodebook(ostream& out, const Codebook& codebook) {
+    for (const auto& pair : codebook) {
+        out << pair.first << ":" << pair.second << "\n";
+    }
+}
+
+inline void saveCodebookFile(const Codebook& codebook, const string& filename) {
+    ofstream file(filename, ios::binary);
+    if (!file) throw runtime_error("Failed to create codebook file: " + filename);
+    writeCodebook(file, codebook);
+    if (!file) throw runtime_error("Failed to write codebook file: " + filename);
+}
+
+// Read huffman_hashmap.txt format, skipping malformed lines. Codes never
+// contain ':', so the last colon on a line separates token and code. A
+// top-K codebook (escape line ":code" and a %literal table) is refused: its
+// literal codes overlap the word codes, and only the approximate reader
+// (approximate.hpp) decodes it.
+inline void readCodebook(istream& in, Codebook& codebook) {
+    codebook.clear();
+    string line;
+    while (getline(in, line)) {
+        if (line == "%literal" || line.compare(0, 1, ":") == 0) {
+            throw runtime_error("Codebook has an escape code (written by --top-k or --incremental); "
+                                "decrypt its output with --decrypt 2");
+        }
+        size_t colon = line.rfind(':');
+        HuffmanCode code;
+        if (colon != string::npos && HuffmanCode::parse(string_view(line).substr(colon + 1), code)) {
+            codebook.insert_or_assign(string_view(line).substr(0, colon), code);
+        }
+    }
+}
+
+inline void loadCodebookFile(const string& filename, Codebook& codebook) {
+    ifstream file(filename, ios::binary);
+    if (!file) throw runtime_error("Failed to open codebook file: " + filename);
+    readCodebook(file, codebook);
+}
+
+// Intern each distinct word of content once (as a view into content) and count it by id
+inline void countTokens(string_view content, SymbolTable& symbols, vector<int>& frequency,
+                        vector<int>* tokenIds = nullptr) {
+    Tokenizer tokenizer(content);
+    string_view token;
+    while (tokenizer.next(token)) {
+        int id = symbols.intern(token);
+        if (id == static_cast<int>(frequency.size())) {
+            frequency.push_back(0);
+        }
+        frequency[id]++;
+        if (tokenIds) tokenIds->push_back(id);
+    }
+}
+
+// Huffman codes for symbol ids 0 .. frequency.size() - 1. Tree orders the
+// (count, id) keys; the flat EytzingerTree loads and walks them an order of
+// magnitude faster than the AVLTree's pointer nodes (benchmark: ordering).
+template <typename Tree = EytzingerTree>
+vector<HuffmanCode> buildHuffmanCodes(const vector<int>& frequency) {
+    vector<pair<int, int>> keys;
+    keys.reserve(frequency.size());
+    for (size_t id = 0; id < frequency.size(); ++id) {
+        keys.emplace_back(frequency[id], static_cast<int>(id));
+    }
+    sort(keys.begin(), keys.end());
+    Tree tree(keys);
+    HuffmanCoding huffman;
+    huffman.buildFromTree(tree);
+    return huffman.getCodes();
+}
+
+// Apply RSA once per distinct word. cipherOf maps a plain id to its ciphertext's id
+// in cipherSymbols, and cipherFrequency sums the plain counts per ciphertext.
+inline void encryptSymbols(const SymbolTable& plainSymbols, const vector<int>& frequency, const RSA& rsa,
+                           SymbolTable& cipherSymbols, vector<int>& cipherOf, vector<int>& cipherFrequency) {
+    // Every character of every word goes through RSA in one batch
+    vector<long long> values;
+    vector<size_t> ends(plainSymbols.size());
+    for (size_t id = 0; id < plainSymbols.size(); ++id) {
+        string_view word = plainSymbols.symbol(id);
+        values.insert(values.end(), word.begin(), word.end());
+        ends[id] = values.size();
+    }
+    rsa.encryptBatch(values.data(), values.data(), values.size());
+
+    cipherSymbols.reserve(plainSymbols.size());
+    cipherOf.resize(plainSymbols.size());
+    string cipher;
+    for (size_t id = 0; id < plainSymbols.size(); ++id) {
+        size_t start = id ? ends[id - 1] : 0;
+        cipher.clear();
+        RSA::appendNumbers(values.data() + start, ends[id] - start, cipher);
+        cipherOf[id] = cipherSymbols.internCopy(cipher);
+    }
+    cipherFrequency.assign(cipherSymbols.size(), 0);
+    for (size_t id = 0; id < plainSymbols.size(); ++id) {
+        cipherFrequency[cipherOf[id]] += frequency[id];
+    }
+}
+
+// Append the code of every word in content to out, separated by single spaces,
+// with the Caesar shift already applied to the code digits
+inline void encodeWords(string_view content, const SymbolTable& symbols, const vector<HuffmanCode>& codeOf,
+                        const CaesarShift& caesar, string& out, ChecksumBuilder* checksums = nullptr) {
+    Tokenizer tokenizer(content);
+    string_view token;
+    bool firstWord = out.empty();
+    while (tokenizer.next(token)) {
+        const HuffmanCode& code = codeOf[symbols.find(token)];
+        if (!firstWord) out.push_back(' ');
+        size_t start = out.size();
+        for (int i = code.length - 1; i >= 0; --i) {
+            out.push_back(((code.bits >> i) & 1) ? caesar.one : caesar.zero);
+        }
+        if (checksums) checksums->add(token, string_view(out).substr(start));
+        firstWord = false;
+    }
+}
+
+// Build the codebook for counted symbols and return the code each plain id is
+// written as. In combined mode the codebook is keyed by the RSA ciphertext.
+inline vector<HuffmanCode> buildCodebook(const SymbolTable& symbols, const vector<int>& frequency,
+                                         EncryptionMode mode, const RSA& rsa, Codebook& codebook) {
+    codebook.clear();
+    if (mode != EncryptionMode::Combined) {
+        vector<HuffmanCode> codeOf = buildHuffmanCodes(frequency);
+        codebook.reserve(codeOf.size());
+        for (size_t id = 0; id < codeOf.size(); ++id) {
+            codebook.insert_or_assign(symbols.symbol(id), codeOf[id]);
+        }
+        return codeOf;
+    }
+
+    SymbolTable cipherSymbols;
+    vector<int> cipherOf, cipherFrequency;
+    encryptSymbols(symbols, frequency, rsa, cipherSymbols, cipherOf, cipherFrequency);
+    vector<HuffmanCode> codes = buildHuffmanCodes(cipherFrequency);
+    codebook.reserve(codes.size());
+    for (size_t id = 0; id < codes.size(); ++id) {
+        codebook.insert_or_assign(cipherSymbols.symbol(id), codes[id]);
+    }
+    vector<HuffmanCode> codeOf(symbols.size());
+    for (size_t id = 0; id < symbols.size(); ++id) {
+        codeOf[id] = codes[cipherOf[id]];
+    }
+    return codeOf;
+}
+
+// Append a code as Caesar-shifted '0'/'1' digits
+inline void appendShiftedCode(string& out, const HuffmanCode& code, const CaesarShift& caesar) {
+    for (int i = code.length - 1; i >= 0; --i) {
+        out.push_back(((code.bits >> i) & 1) ? caesar.one : caesar.zero);
+    }
+}
+
+// Parse one space-separated word of shifted digits back into a code
+inline bool parseShiftedCode(string_view word, const CaesarShift& caesar, HuffmanCode& code) {
+    code = HuffmanCode();
+    for (char c : word) {
+        int bit = caesar.bit(c);
+        if (bit < 0 || code.length == HuffmanCode::MAX_LENGTH) return false;
+        code.append(bit);
+    }
+    return code.length > 0;
+}
+
+#endif
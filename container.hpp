@@ -0,0 +1,476 @@
+#ifndef CONTAINER_HPP
+#define CONTAINER_HPP
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <array>
+#include <fstream>
+#include <numeric>
+#include <algorithm>
+#include <stdexcept>
+#include <memory>
+#include <thread>
+#include <cstdint>
+#include "binary_io.hpp"
+#include "symbol_models.hpp"
+#include "rans.hpp"
+#include "codec.hpp"
+#include "rsa.hpp"
+#include "parallel_bits.hpp"
+
+using namespace std;
+
+// Compact container: a self-describing binary alternative to the text
+// outputs, with the codebook inside the file so small and high-cardinality
+// inputs are not dominated by huffman_hashmap.txt.
+//
+//   "DAAC" u8 version  u8 model  u8 coder  u8 mode
+//   u64 original size  u64 symbol count
+//   varint symbol count, then per symbol: varint length + text
+//                        (the RSA ciphertext in combined mode)
+//   coder table: Huffman     - u8 code length per symbol (canonical codes)
+//                rANS        - u8 scale bits, varint scaled count per symbol
+//                interleaved - u8 stream count N, N x u64 stream sizes (the
+//                              jump table), u8 code length per symbol
+//   u64 payload size, payload: Huffman codes MSB-first, rANS words, or the
+//                               N Huffman streams back to back; every byte
+//                               Caesar-shifted
+//
+// Interleaved Huffman deals symbol i to stream i % N. Each stream decodes
+// independently, so the decoder advances all of them in one loop and the
+// CPU overlaps their table lookups instead of waiting on one bit position.
+//
+// Decoding concatenates symbol texts, so it does not depend on the model; the
+// model is recorded so a reader can report it and reject ones it lacks.
+
+const char CONTAINER_MAGIC[4] = {'D', 'A', 'A', 'C'};
+const uint8_t CONTAINER_VERSION = 1;
+
+enum class EntropyCoder : uint8_t {
+    Huffman = 1,
+    Rans = 2,
+    InterleavedHuffman = 3
+};
+
+inline const char* entropyCoderName(EntropyCoder coder) {
+    switch (coder) {
+        case EntropyCoder::Rans: return "rans";
+        case EntropyCoder::InterleavedHuffman: return "interleaved";
+        default: return "huffman";
+    }
+}
+
+inline bool parseEntropyCoder(string_view name, EntropyCoder& coder) {
+    for (EntropyCoder c : {EntropyCoder::Huffman, EntropyCoder::Rans, EntropyCoder::InterleavedHuffman}) {
+        if (name == entropyCoderName(c)) {
+            coder = c;
+            return true;
+        }
+    }
+    return false;
+}
+
+const int MAX_HUFFMAN_STREAMS = 64;
+
+struct ContainerOptions {
+    SymbolModel model = SymbolModel::Auto;
+    EntropyCoder coder = EntropyCoder::Huffman;
+    int streams = 4;     // interleaved Huffman only
+    int threads = 0;     // Huffman bit packing; 0 = one per core (the output is the same either way)
+};
+
+struct ContainerHeader {
+    SymbolModel model = SymbolModel::Word;
+    EntropyCoder coder = EntropyCoder::Huffman;
+    EncryptionMode mode = EncryptionMode::HuffmanCaesar;
+    uint64_t originalSize = 0;
+    uint64_t symbolCount = 0;
+};
+
+inline bool isContainer(string_view data) {
+    return data.size() >= 4 && equal(CONTAINER_MAGIC, CONTAINER_MAGIC + 4, data.begin());
+}
+
+inline bool isContainerFile(const string& filename) {
+    ifstream file(filename, ios::binary);
+    char magic[4];
+    return file.read(magic, 4) && isContainer(string_view(magic, 4));
+}
+
+// Codes from code lengths alone: per length, consecutive values in id order
+inline vector<HuffmanCode> canonicalCodes(const vector<uint8_t>& lengths) {
+    vector<uint32_t> order(lengths.size());
+    iota(order.begin(), order.end(), 0);
+    stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return lengths[a] < lengths[b]; });
+
+    vector<HuffmanCode> codes(lengths.size());
+    uint64_t code = 0;
+    int previous = 0;
+    for (uint32_t id : order) {
+        if (lengths[id] == 0) continue;
+        code <<= (lengths[id] - previous);
+        codes[id].bits = code;
+        codes[id].length = lengths[id];
+        code++;
+        previous = lengths[id];
+    }
+    return codes;
+}
+
+// Decodes canonical codes: a code of length L is valid when it falls in
+// [first[L], first[L] + count[L]). A table indexed by the next LOOKUP_BITS
+// bits gives codes up to that long directly; for longer ones it gives the
+// shortest length a code with that prefix can have, where the search starts.
+class CanonicalDecoder {
+private:
+    static constexpr int LOOKUP_BITS = 12;
+    static constexpr int MAX_WINDOW_LENGTH = 57;   // bits a BitWindow guarantees after refill
+    static constexpr uint32_t DIRECT = 0x80;       // lookup entry: (symbol << 8) | DIRECT | length
+    static constexpr uint32_t MAX_DIRECT_SYMBOL = (1u << 24) - 1;
+
+    vector<uint32_t> sorted;     // ids ordered by (length, id)
+    vector<uint32_t> lookup;     // entry without DIRECT: first length to try
+    uint64_t first[HuffmanCode::MAX_LENGTH + 1] = {};
+    uint32_t count[HuffmanCode::MAX_LENGTH + 1] = {};
+    uint32_t offset[HuffmanCode::MAX_LENGTH + 1] = {};
+    uint64_t last[MAX_WINDOW_LENGTH + 2] = {};    // windows up to last[L] start with a code of length <= L
+    int maxLength = 0;
+
+public:
+    explicit CanonicalDecoder(const vector<uint8_t>& lengths) {
+        for (uint8_t length : lengths) {
+            if (length > HuffmanCode::MAX_LENGTH) throw runtime_error("Invalid code length");
+            if (length == 0) continue;
+            count[length]++;
+            maxLength = max(maxLength, static_cast<int>(length));
+        }
+        uint64_t code = 0;
+        uint32_t position = 0;
+        for (int length = 1; length <= maxLength; ++length) {
+            first[length] = code;
+            offset[length] = position;
+            position += count[length];
+            if (length < 64 && code + count[length] > (1ULL << length)) {
+                throw runtime_error("Invalid code lengths");
+            }
+            code = (code + count[length]) << 1;
+        }
+
+        for (int length = 1; length <= MAX_WINDOW_LENGTH; ++length) {
+            uint64_t end = first[length] + count[length];
+            if (length >= maxLength) {
+                last[length] = UINT64_MAX;
+            } else if (end > 0) {
+                last[length] = ((end - 1) << (64 - length)) | ((1ULL << (64 - length)) - 1);
+            }
+        }
+        last[MAX_WINDOW_LENGTH + 1] = UINT64_MAX;
+
+        sorted.resize(position);
+        vector<uint32_t> next(offset, offset + maxLength + 1);
+        for (size_t id = 0; id < lengths.size(); ++id) {
+            if (lengths[id]) sorted[next[lengths[id]]++] = static_cast<uint32_t>(id);
+        }
+
+        lookup.assign(1u << LOOKUP_BITS, static_cast<uint32_t>(maxLength + 1));
+        for (uint32_t index = 0; index < lookup.size(); ++index) {
+            for (int length = 1; length <= maxLength; ++length) {
+                uint64_t prefix = length <= LOOKUP_BITS ? index >> (LOOKUP_BITS - length)
+                                                        : static_cast<uint64_t>(index) << (length - LOOKUP_BITS);
+                if (prefix < first[length] + count[length]) {
+                    lookup[index] = static_cast<uint32_t>(length);
+                    break;
+                }
+            }
+        }
+        for (int length = 1; length <= min(maxLength, LOOKUP_BITS); ++length) {
+            for (uint32_t i = 0; i < count[length]; ++i) {
+                uint32_t symbol = sorted[offset[length] + i];
+                if (symbol > MAX_DIRECT_SYMBOL) continue;
+                uint64_t code = first[length] + i;
+                fill(lookup.begin() + (code << (LOOKUP_BITS - length)), lookup.begin() + ((code + 1) << (LOOKUP_BITS - length)),
+                     (symbol << 8) | DIRECT | static_cast<uint32_t>(length));
+            }
+        }
+    }
+
+    // Decodes the code at the top of window (the next 64 bits, MSB first)
+    // and sets length to its size
+    uint32_t decodeWindow(uint64_t window, int& length) const {
+        uint32_t entry = lookup[window >> (64 - LOOKUP_BITS)];
+        if (entry & DIRECT) {
+            length = static_cast<int>(entry & 0x7F);
+            return entry >> 8;
+        }
+        int l = static_cast<int>(entry);
+        while (window > last[l]) l++;
+        uint64_t code = window >> (64 - l);
+        if (l > min(maxLength, MAX_WINDOW_LENGTH) || code - first[l] >= count[l]) {
+            throw runtime_error("Invalid code in payload");
+        }
+        length = l;
+        return sorted[offset[l] + (code - first[l])];
+    }
+
+    uint32_t decode(BitReader& bits) const {
+        uint64_t code = 0;
+        for (int length = 1; length <= maxLength; ++length) {
+            code = (code << 1) | static_cast<uint64_t>(bits.bit());
+            if (code - first[length] < count[length]) {
+                return sorted[offset[length] + (code - first[length])];
+            }
+        }
+        throw runtime_error("Invalid code in payload");
+    }
+};
+
+// Decodes `rounds` symbols from each window in turn, calling emit for each.
+// A fixed N lets the compiler keep every window in registers.
+template <size_t N, typename Emit>
+inline void decodeRounds(const CanonicalDecoder& decoder, vector<BitWindow>& windows, uint64_t rounds, Emit emit) {
+    array<BitWindow, N> local;
+    copy(windows.begin(), windows.begin() + N, local.begin());
+    int length;
+    for (uint64_t r = 0; r < rounds; ++r) {
+        for (BitWindow& window : local) {
+            window.refill();
+            emit(decoder.decodeWindow(window.peek(), length));
+            window.consume(length);
+        }
+    }
+    copy(local.begin(), local.end(), windows.begin());
+}
+
+template <typename Emit>
+inline void decodeRounds(const CanonicalDecoder& decoder, vector<BitWindow>& windows, uint64_t rounds, Emit emit) {
+    switch (windows.size()) {
+        case 2: decodeRounds<2>(decoder, windows, rounds, emit); return;
+        case 4: decodeRounds<4>(decoder, windows, rounds, emit); return;
+        case 8: decodeRounds<8>(decoder, windows, rounds, emit); return;
+    }
+    int length;
+    for (uint64_t r = 0; r < rounds; ++r) {
+        for (BitWindow& window : windows) {
+            window.refill();
+            emit(decoder.decodeWindow(window.peek(), length));
+            window.consume(length);
+        }
+    }
+}
+
+// Encodes content with the given options (model Auto chooses one). Returns the
+// model used; estimates receives the per-model estimates when Auto chose.
+inline SymbolModel encodeContainer(string_view content, EncryptionMode mode, const RSA& rsa, int shift,
+                                   const ContainerOptions& options, string& out,
+                                   vector<ModelEstimate>* estimates = nullptr) {
+    SymbolModel model = options.model;
+    // One RSA character costs its decimal digits plus a separating space
+    double bytesPerChar = mode == EncryptionMode::Combined ? to_string(rsa.getPublicKey().second).size() + 1 : 1;
+    SubwordModel subword;
+    if (model == SymbolModel::Auto) {
+        model = chooseSymbolModel(content, bytesPerChar, subword, estimates);
+    } else if (model == SymbolModel::Subword) {
+        subword.learn(sampleContent(content, 1 << 18));
+    }
+
+    Segmentation seg;
+    if (model == SymbolModel::Word) {
+        segmentWords(content, seg);
+    } else if (model == SymbolModel::Byte) {
+        segmentBytes(content, seg);
+    } else {
+        subword.segment(content, seg);
+    }
+
+    // Only symbols that occur go into the dictionary
+    vector<int> denseOf(seg.frequency.size(), -1);
+    vector<int> frequency;
+    vector<int> idOf;
+    for (size_t id = 0; id < seg.frequency.size(); ++id) {
+        if (seg.frequency[id] == 0) continue;
+        denseOf[id] = static_cast<int>(frequency.size());
+        frequency.push_back(seg.frequency[id]);
+        idOf.push_back(static_cast<int>(id));
+    }
+    uint64_t symbolCount = seg.stream.empty() ? content.size() : seg.stream.size();
+    out.clear();
+    out.append(CONTAINER_MAGIC, 4);
+    out.push_back(static_cast<char>(CONTAINER_VERSION));
+    out.push_back(static_cast<char>(model));
+    out.push_back(static_cast<char>(options.coder));
+    out.push_back(static_cast<char>(mode));
+    appendU64(out, content.size());
+    appendU64(out, symbolCount);
+
+    appendVarint(out, idOf.size());
+    for (int id : idOf) {
+        string_view text = seg.symbols.symbol(id);
+        if (mode == EncryptionMode::Combined) {
+            string cipher = rsa.encryptString(text);
+            appendVarint(out, cipher.size());
+            out += cipher;
+        } else {
+            appendVarint(out, text.size());
+            out.append(text);
+        }
+    }
+
+    // Dense id of the i-th symbol
+    auto symbolAt = [&](size_t i) -> uint32_t {
+        return seg.stream.empty() ? denseOf[static_cast<unsigned char>(content[i])] : denseOf[seg.stream[i]];
+    };
+    string payload;
+    auto shiftByte = [shift](uint8_t byte) { return static_cast<uint8_t>(byte + shift); };
+    if (options.coder == EntropyCoder::Rans) {
+        RansTable table = RansTable::fromCounts(frequency);
+        out.push_back(static_cast<char>(table.scaleBits));
+        for (uint32_t f : table.freq) appendVarint(out, f);
+        ransEncode(table, symbolCount, symbolAt, payload);
+        for (char& c : payload) c = static_cast<char>(shiftByte(static_cast<unsigned char>(c)));
+        appendU64(out, payload.size());
+        out += payload;
+        return model;
+    }
+
+    // Huffman codes are packed in parallel once there is enough to split
+    size_t threads = options.threads > 0 ? options.threads : thread::hardware_concurrency();
+    unique_ptr<WorkStealingPool> pool;
+    if (threads > 1 && symbolCount >= 2 * MIN_PACK_RANGE) pool.reset(new WorkStealingPool(threads));
+
+    vector<uint8_t> lengths;
+    for (const HuffmanCode& code : buildHuffmanCodes(frequency)) lengths.push_back(code.length);
+    vector<HuffmanCode> codes = canonicalCodes(lengths);
+    if (options.coder == EntropyCoder::InterleavedHuffman) {
+        if (options.streams < 1 || options.streams > MAX_HUFFMAN_STREAMS) {
+            throw runtime_error("Stream count must be 1 to " + to_string(MAX_HUFFMAN_STREAMS));
+        }
+        // Stream k holds symbols k, k + N, k + 2N, ...
+        size_t streams = static_cast<size_t>(options.streams);
+        out.push_back(static_cast<char>(streams));
+        for (size_t k = 0; k < streams; ++k) {
+            uint64_t streamCount = symbolCount / streams + (k < symbolCount % streams ? 1 : 0);
+            size_t start = payload.size();
+            packCodes(codes, streamCount, [&](uint64_t j) { return symbolAt(k + j * streams); }, shiftByte, payload,
+                      pool.get());
+            appendU64(out, payload.size() - start);
+        }
+    } else {
+        packCodes(codes, symbolCount, symbolAt, shiftByte, payload, pool.get());
+    }
+    out.append(reinterpret_cast<const char*>(lengths.data()), lengths.size());
+
+    appendU64(out, payload.size());
+    out += payload;
+    return model;
+}
+
+// Reads the header only (throws if data is not a container this build can read)
+inline ContainerHeader readContainerHeader(ByteReader& reader) {
+    string_view magic = reader.bytes(4);
+    if (!isContainer(magic)) throw runtime_error("Not a compact container");
+    uint8_t version = reader.u8();
+    if (version != CONTAINER_VERSION) throw runtime_error("Unsupported container version " + to_string(version));
+
+    ContainerHeader header;
+    uint8_t model = reader.u8();
+    if (model < static_cast<uint8_t>(SymbolModel::Word) || model > static_cast<uint8_t>(SymbolModel::Subword)) {
+        throw runtime_error("Unknown symbol model " + to_string(model));
+    }
+    header.model = static_cast<SymbolModel>(model);
+    uint8_t coder = reader.u8();
+    if (coder < static_cast<uint8_t>(EntropyCoder::Huffman) || coder > static_cast<uint8_t>(EntropyCoder::InterleavedHuffman)) throw runtime_error("Unknown entropy coder " + to_string(coder));
+    header.coder = static_cast<EntropyCoder>(coder);
+    uint8_t mode = reader.u8();
+    if (mode != static_cast<uint8_t>(EncryptionMode::Combined) && mode != static_cast<uint8_t>(EncryptionMode::HuffmanCaesar)) {
+        throw runtime_error("Unknown encryption mode " + to_string(mode));
+    }
+    header.mode = static_cast<EncryptionMode>(mode);
+    header.originalSize = reader.u64();
+    header.symbolCount = reader.u64();
+    return header;
+}
+
+inline ContainerHeader decodeContainer(string_view data, const RSA& rsa, int shift, string& out) {
+    ByteReader reader(data);
+    ContainerHeader header = readContainerHeader(reader);
+    if (header.mode == EncryptionMode::Combined && !rsa.hasKeys()) {
+        throw runtime_error("Container is combined-mode (RSA); it only decrypts in the process holding its keys");
+    }
+
+    uint64_t symbols = reader.varint();
+    if (symbols > reader.remaining()) throw runtime_error("Truncated input");
+    vector<string> texts(symbols);
+    for (string& text : texts) {
+        string_view stored = reader.bytes(reader.varint());
+        text = header.mode == EncryptionMode::Combined ? rsa.decryptString(string(stored)) : string(stored);
+        if (text.empty()) throw runtime_error("Empty dictionary entry");
+    }
+    // Every symbol expands to at least one byte
+    if (header.symbolCount > header.originalSize) throw runtime_error("Symbol count exceeds the original size");
+
+    out.clear();
+    out.reserve(min<uint64_t>(header.originalSize, data.size() * 64));
+    if (header.coder == EntropyCoder::Rans) {
+        int scaleBits = reader.u8();
+        vector<uint32_t> scaled(symbols);
+        for (uint32_t& f : scaled) f = static_cast<uint32_t>(reader.varint());
+        RansTable table = RansTable::fromScaled(scaleBits, move(scaled));
+
+        string payload(reader.bytes(reader.u64()));
+        for (char& c : payload) c = static_cast<char>(static_cast<unsigned char>(c) - shift);
+        ransDecode(table, payload, header.symbolCount, [&](uint32_t s) {
+            out += texts[s];
+            if (out.size() > header.originalSize) throw runtime_error("Decoded size does not match the header");
+        });
+    } else if (header.coder == EntropyCoder::InterleavedHuffman) {
+        size_t streams = reader.u8();
+        if (streams == 0) throw runtime_error("Invalid stream count");
+        vector<uint64_t> streamSize(streams);
+        for (uint64_t& size : streamSize) size = reader.u64();
+        string_view lengthBytes = reader.bytes(symbols);
+        CanonicalDecoder decoder(vector<uint8_t>(lengthBytes.begin(), lengthBytes.end()));
+
+        string payload(reader.bytes(reader.u64()));
+        for (char& c : payload) c = static_cast<char>(static_cast<unsigned char>(c) - shift);
+        if (header.symbolCount > payload.size() * 8) throw runtime_error("Truncated bit stream");
+        vector<BitWindow> windows;
+        size_t position = 0;
+        for (uint64_t size : streamSize) {
+            if (size > payload.size() - position) throw runtime_error("Jump table exceeds the payload");
+            windows.emplace_back(string_view(payload).substr(position, size));
+            position += size;
+        }
+
+        // One round decodes the next symbol of every stream
+        decodeRounds(decoder, windows, header.symbolCount / streams, [&](uint32_t s) { out += texts[s]; });
+        int length;
+        for (size_t k = 0; k < header.symbolCount % streams; ++k) {
+            windows[k].refill();
+            out += texts[decoder.decodeWindow(windows[k].peek(), length)];
+            windows[k].consume(length);
+        }
+        for (const BitWindow& window : windows) {
+            if (window.overrun()) throw runtime_error("Truncated bit stream");
+        }
+    } else {
+        string_view lengthBytes = reader.bytes(symbols);
+        CanonicalDecoder decoder(vector<uint8_t>(lengthBytes.begin(), lengthBytes.end()));
+
+        string payload(reader.bytes(reader.u64()));
+        for (char& c : payload) c = static_cast<char>(static_cast<unsigned char>(c) - shift);
+        if (header.symbolCount > payload.size() * 8) throw runtime_error("Truncated bit stream");
+        BitWindow window(payload);
+        int length;
+        for (uint64_t i = 0; i < header.symbolCount; ++i) {
+            window.refill();
+            out += texts[decoder.decodeWindow(window.peek(), length)];
+            window.consume(length);
+        }
+        if (window.overrun()) throw runtime_error("Truncated bit stream");
+    }
+    if (out.size() != header.originalSize) throw runtime_error("Decoded size does not match the header");
+    return header;
+}
+
+#endif
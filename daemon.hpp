@@ -0,0 +1,607 @@
+#ifndef DAEMON_HPP
+#define DAEMON_HPP
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <shared_mutex>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <map>
+#include <fstream>
+#include <unordered_map>
+#include <unordered_set>
+#include <sstream>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "binary_io.hpp"
+#include "codec.hpp"
+#include "pipeline.hpp"
+#include "approximate.hpp"
+#include "codebook.hpp"
+#include "rsa.hpp"
+#include "result_cache.hpp"
+
+using namespace std;
+
+// Long-running service mode. The daemon generates its RSA keys once and keeps
+// the codebooks it hands out resident (already indexed for decoding), so a
+// request only pays for the cipher work itself. At most MAX_RESIDENT_CODEBOOKS
+// stay resident; past that the oldest is dropped, and decrypting with its id
+// fails as if it had been released. The Encrypt reply carries the codebook
+// itself, so ciphertext never outlives the means to decrypt it: a client whose
+// id is gone sends the codebook back with AddCodebook for a new one. With a
+// result cache, text it has encrypted before is not encrypted again.
+//
+// Protocol over a Unix domain stream socket. Every message is one frame:
+//   [u32 length, little endian][u8 tag][payload: length - 1 bytes]
+// Requests carry a DaemonOp tag and replies a DaemonStatus tag; an Error reply's
+// payload is the message text.
+//   Encrypt       [u8 mode][text]           -> [u32 codebook id][u32 codebook length][codebook][encrypted text]
+//   Decrypt       [u32 codebook id][text]   -> plain text
+//   LoadCodebook  [u8 mode][path]           -> [u32 codebook id]
+//   Release       [u32 codebook id]         -> empty
+//   Stats         empty                     -> report text
+//   Shutdown      empty                     -> empty
+//   AddCodebook   [u8 mode][codebook]       -> [u32 codebook id]
+// mode is an EncryptionMode. A codebook in a payload is huffman_hashmap.txt
+// text, keyed by RSA ciphertext in combined mode as that file is. Plain text
+// comes back with words joined by single spaces.
+
+enum class DaemonOp : uint8_t {
+    Encrypt = 1,
+    Decrypt = 2,
+    LoadCodebook = 3,
+    Release = 4,
+    Stats = 5,
+    Shutdown = 6,
+    AddCodebook = 7
+};
+
+enum class DaemonStatus : uint8_t {
+    Ok = 0,
+    Error = 1
+};
+
+const uint32_t MAX_FRAME_LENGTH = 256u * 1024 * 1024;
+
+inline bool readFully(int fd, char* buffer, size_t length) {
+    while (length > 0) {
+        ssize_t got = ::read(fd, buffer, length);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) return false;
+        buffer += got;
+        length -= got;
+    }
+    return true;
+}
+
+inline bool writeFully(int fd, const char* buffer, size_t length) {
+    while (length > 0) {
+        ssize_t sent = ::send(fd, buffer, length, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) continue;
+        if (sent <= 0) return false;
+        buffer += sent;
+        length -= sent;
+    }
+    return true;
+}
+
+// Returns false on EOF, I/O error or an oversized frame
+inline bool readFrame(int fd, uint8_t& tag, string& payload) {
+    char header[5];
+    if (!readFully(fd, header, sizeof(header))) return false;
+    uint32_t length = readU32(header);
+    if (length == 0 || length > MAX_FRAME_LENGTH) return false;
+    tag = static_cast<uint8_t>(header[4]);
+    payload.resize(length - 1);
+    return readFully(fd, &payload[0], payload.size());
+}
+
+inline bool writeFrame(int fd, uint8_t tag, string_view payload) {
+    string header;
+    appendU32(header, static_cast<uint32_t>(payload.size() + 1));
+    header.push_back(static_cast<char>(tag));
+    return writeFully(fd, header.data(), header.size()) && writeFully(fd, payload.data(), payload.size());
+}
+
+inline sockaddr_un unixAddress(const string& path) {
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) {
+        throw runtime_error("Socket path too long: " + path);
+    }
+    memcpy(address.sun_path, path.c_str(), path.size() + 1);
+    return address;
+}
+
+// q-th quantile (0..1) of a sample set, by partial sort of a copy
+inline uint32_t percentile(vector<uint32_t> samples, double q) {
+    if (samples.empty()) return 0;
+    size_t k = min(samples.size() - 1, static_cast<size_t>(q * samples.size()));
+    nth_element(samples.begin(), samples.begin() + k, samples.end());
+    return samples[k];
+}
+
+// Per-op request counts and service times. Keeps the most recent WINDOW
+// samples of each op, so p50/p99 describe current behaviour.
+class LatencyStats {
+private:
+    static const size_t WINDOW = 1 << 16;
+    static const int OPS = 8;
+
+    struct OpStats {
+        uint64_t count = 0;
+        uint64_t errors = 0;
+        vector<uint32_t> samples;   // microseconds, ring buffer once full
+        size_t next = 0;
+    };
+
+    mutable mutex lock;
+    OpStats ops[OPS];
+    chrono::steady_clock::time_point started = chrono::steady_clock::now();
+
+    static const char* opName(int op) {
+        switch (static_cast<DaemonOp>(op)) {
+            case DaemonOp::Encrypt: return "encrypt";
+            case DaemonOp::Decrypt: return "decrypt";
+            case DaemonOp::LoadCodebook: return "load";
+            case DaemonOp::Release: return "release";
+            case DaemonOp::Stats: return "stats";
+            case DaemonOp::Shutdown: return "shutdown";
+            case DaemonOp::AddCodebook: return "add";
+        }
+        return "unknown";
+    }
+
+public:
+    void record(uint8_t op, uint32_t micros, bool ok) {
+        if (op >= OPS) op = 0;
+        lock_guard<mutex> guard(lock);
+        OpStats& stats = ops[op];
+        stats.count++;
+        if (!ok) stats.errors++;
+        if (stats.samples.size() < WINDOW) {
+            stats.samples.push_back(micros);
+        } else {
+            stats.samples[stats.next] = micros;
+            stats.next = (stats.next + 1) % WINDOW;
+        }
+    }
+
+    string report(size_t residentCodebooks, uint64_t evictedCodebooks) const {
+        lock_guard<mutex> guard(lock);
+        ostringstream out;
+        double uptime = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+        out << "uptime_s " << fixed << setprecision(1) << uptime << "\n";
+        out << "resident_codebooks " << residentCodebooks << "\n";
+        out << "evicted_codebooks " << evictedCodebooks << "\n";
+        out << left << setw(10) << "op" << setw(10) << "count" << setw(8) << "errors"
+            << setw(10) << "p50_us" << "p99_us\n";
+        for (int op = 0; op < OPS; ++op) {
+            const OpStats& stats = ops[op];
+            if (stats.count == 0) continue;
+            out << setw(10) << opName(op) << setw(10) << stats.count << setw(8) << stats.errors
+                << setw(10) << percentile(stats.samples, 0.50) << percentile(stats.samples, 0.99) << "\n";
+        }
+        return out.str();
+    }
+};
+
+class CryptoDaemon {
+private:
+    static const size_t MAX_RESIDENT_CODEBOOKS = 1024;
+
+    RSA rsa;
+    int shift;
+    LatencyStats stats;
+    ResultCache* cache = nullptr;
+
+    shared_mutex codebookLock;
+    map<uint32_t, unique_ptr<DecryptionPipeline>> codebooks;   // indexed, keyed by plain word; oldest id first
+    uint32_t nextCodebookId = 1;
+    uint64_t evictedCodebooks = 0;
+
+    int listenFd = -1;
+    string socketPath;
+    atomic<bool> stopping{false};
+    mutex connectionLock;
+    unordered_set<int> connections;
+    vector<thread> workers;
+    vector<thread::id> finished;    // workers done serving, to be joined
+
+    // Drops the oldest codebooks once more than MAX_RESIDENT_CODEBOOKS are resident
+    uint32_t store(unique_ptr<DecryptionPipeline> codebook) {
+        unique_lock<shared_mutex> guard(codebookLock);
+        uint32_t id = nextCodebookId++;
+        codebooks[id] = move(codebook);
+        while (codebooks.size() > MAX_RESIDENT_CODEBOOKS) {
+            codebooks.erase(codebooks.begin());
+            evictedCodebooks++;
+        }
+        return id;
+    }
+
+    static EncryptionMode parseMode(uint8_t mode) {
+        if (mode != static_cast<uint8_t>(EncryptionMode::Combined) &&
+            mode != static_cast<uint8_t>(EncryptionMode::HuffmanCaesar)) {
+            throw runtime_error("Unknown encryption mode " + to_string(mode));
+        }
+        return static_cast<EncryptionMode>(mode);
+    }
+
+    string handle(DaemonOp op, const string& payload) {
+        string reply;
+        switch (op) {
+            case DaemonOp::Encrypt: {
+                if (payload.empty()) throw runtime_error("Missing mode");
+                EncryptionMode mode = parseMode(payload[0]);
+                EncryptionPipeline encryptor(mode, rsa, shift);
+                encryptor.setCache(cache);
+                string encrypted = encryptor.encrypt(string_view(payload).substr(1));
+                unique_ptr<DecryptionPipeline> decryptor(new DecryptionPipeline(mode, rsa, shift));
+                decryptor->setPlainCodebook(encryptor.getPlainCodebook());
+                ostringstream codes;
+                writeCodebook(codes, encryptor.getCodebook());
+                appendU32(reply, store(move(decryptor)));
+                appendU32(reply, static_cast<uint32_t>(codes.str().size()));
+                reply += codes.str();
+                reply += encrypted;
+                break;
+            }
+            case DaemonOp::Decrypt: {
+                if (payload.size() < 4) throw runtime_error("Missing codebook id");
+                uint32_t id = readU32(payload.data());
+                shared_lock<shared_mutex> guard(codebookLock);
+                auto it = codebooks.find(id);
+                if (it == codebooks.end()) throw runtime_error("Unknown codebook " + to_string(id));
+                it->second->decrypt(string_view(payload).substr(4), reply);
+                break;
+            }
+            case DaemonOp::LoadCodebook: {
+                if (payload.empty()) throw runtime_error("Missing mode");
+                // Combined-mode keys are decrypted with this daemon's keys, once, here
+                unique_ptr<DecryptionPipeline> decryptor(new DecryptionPipeline(parseMode(payload[0]), rsa, shift));
+                decryptor->loadCodebook(payload.substr(1));
+                appendU32(reply, store(move(decryptor)));
+                break;
+            }
+            case DaemonOp::AddCodebook: {
+                if (payload.empty()) throw runtime_error("Missing mode");
+                unique_ptr<DecryptionPipeline> decryptor(new DecryptionPipeline(parseMode(payload[0]), rsa, shift));
+                istringstream codes(payload.substr(1));
+                ApproximateCodebook book;
+                readApproximateCodebook(codes, book);
+                decryptor->setApproximateCodebook(book);
+                appendU32(reply, store(move(decryptor)));
+                break;
+            }
+            case DaemonOp::Release: {
+                if (payload.size() < 4) throw runtime_error("Missing codebook id");
+                uint32_t id = readU32(payload.data());
+                unique_lock<shared_mutex> guard(codebookLock);
+                if (codebooks.erase(id) == 0) throw runtime_error("Unknown codebook " + to_string(id));
+                break;
+            }
+            case DaemonOp::Stats: {
+                size_t resident;
+                uint64_t evicted;
+                {
+                    shared_lock<shared_mutex> guard(codebookLock);
+                    resident = codebooks.size();
+                    evicted = evictedCodebooks;
+                }
+                reply = stats.report(resident, evicted);
+                if (cache) {
+                    reply += "cache_hits " + to_string(cache->hits) + "\ncache_misses " + to_string(cache->misses) +
+                             "\ncache_evictions " + to_string(cache->evictions) + "\n";
+                }
+                break;
+            }
+            case DaemonOp::Shutdown:
+                stop();
+                break;
+            default:
+                throw runtime_error("Unknown op " + to_string(static_cast<int>(op)));
+        }
+        return reply;
+    }
+
+    void serveConnection(int fd) {
+        uint8_t tag;
+        string payload;
+        while (readFrame(fd, tag, payload)) {
+            auto start = chrono::steady_clock::now();
+            DaemonStatus status = DaemonStatus::Ok;
+            string reply;
+            try {
+                reply = handle(static_cast<DaemonOp>(tag), payload);
+            } catch (const exception& e) {
+                status = DaemonStatus::Error;
+                reply = e.what();
+            }
+            auto micros = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count();
+            stats.record(tag, static_cast<uint32_t>(micros), status == DaemonStatus::Ok);
+            if (!writeFrame(fd, static_cast<uint8_t>(status), reply)) break;
+        }
+        {
+            lock_guard<mutex> guard(connectionLock);
+            connections.erase(fd);
+            finished.push_back(this_thread::get_id());
+        }
+        close(fd);
+    }
+
+    // Joins the workers that have finished; needs connectionLock
+    void reapWorkers() {
+        for (thread::id id : finished) {
+            auto it = find_if(workers.begin(), workers.end(), [id](const thread& worker) { return worker.get_id() == id; });
+            it->join();
+            workers.erase(it);
+        }
+        finished.clear();
+    }
+
+    // Unblocks accept() and every connection waiting for its next request
+    void stop() {
+        stopping = true;
+        ::shutdown(listenFd, SHUT_RDWR);
+        lock_guard<mutex> guard(connectionLock);
+        for (int fd : connections) ::shutdown(fd, SHUT_RD);
+    }
+
+public:
+    explicit CryptoDaemon(int s) : shift(s) {
+        rsa.initializeKeys();
+    }
+
+    // Encrypt requests look their text up in c first (null = off)
+    void setCache(ResultCache* c) {
+        cache = c;
+    }
+
+    CryptoDaemon(const CryptoDaemon&) = delete;
+    CryptoDaemon& operator=(const CryptoDaemon&) = delete;
+
+    ~CryptoDaemon() {
+        if (listenFd >= 0) {
+            close(listenFd);
+            unlink(socketPath.c_str());
+        }
+    }
+
+    // Binds the socket, replacing a stale socket file but never a live daemon
+    bool listen(const string& path) {
+        sockaddr_un address = unixAddress(path);
+
+        int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (probe >= 0 && connect(probe, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0) {
+            close(probe);
+            cerr << "A daemon is already listening on " << path << endl;
+            return false;
+        }
+        if (probe >= 0) close(probe);
+        unlink(path.c_str());
+
+        listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (listenFd < 0 ||
+            bind(listenFd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+            ::listen(listenFd, 64) != 0) {
+            cerr << "Cannot listen on " << path << ": " << strerror(errno) << endl;
+            return false;
+        }
+        socketPath = path;
+        return true;
+    }
+
+    // Serves connections (one thread each, joined once it is done) until a
+    // Shutdown request arrives
+    void run() {
+        while (!stopping) {
+            int fd = accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (fd < 0) {
+                if (errno == EINTR || errno == ECONNABORTED) continue;
+                if (!stopping) cerr << "accept failed: " << strerror(errno) << endl;
+                break;
+            }
+            lock_guard<mutex> guard(connectionLock);
+            if (stopping) {
+                close(fd);
+                break;
+            }
+            reapWorkers();
+            connections.insert(fd);
+            workers.emplace_back(&CryptoDaemon::serveConnection, this, fd);
+        }
+        stop();
+        vector<thread> remaining;
+        {
+            lock_guard<mutex> guard(connectionLock);
+            remaining.swap(workers);
+            finished.clear();
+        }
+        for (thread& worker : remaining) worker.join();
+    }
+};
+
+// Blocking client for one daemon connection
+class DaemonClient {
+private:
+    int fd = -1;
+
+public:
+    explicit DaemonClient(const string& path) {
+        sockaddr_un address = unixAddress(path);
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0 || connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+            string reason = strerror(errno);
+            if (fd >= 0) close(fd);
+            throw runtime_error("Cannot connect to " + path + ": " + reason);
+        }
+    }
+
+    DaemonClient(const DaemonClient&) = delete;
+    DaemonClient& operator=(const DaemonClient&) = delete;
+
+    ~DaemonClient() {
+        close(fd);
+    }
+
+    // Sends one request and returns the reply payload; an Error reply is thrown
+    string request(DaemonOp op, string_view payload) {
+        uint8_t status;
+        string reply;
+        if (!writeFrame(fd, static_cast<uint8_t>(op), payload) || !readFrame(fd, status, reply)) {
+            throw runtime_error("Connection to daemon lost");
+        }
+        if (status != static_cast<uint8_t>(DaemonStatus::Ok)) {
+            throw runtime_error(reply);
+        }
+        return reply;
+    }
+
+    // codebook gets what addCodebook needs should the id be released or evicted
+    string encrypt(EncryptionMode mode, string_view text, uint32_t& codebookId, string& codebook) {
+        string payload(1, static_cast<char>(mode));
+        payload.append(text.data(), text.size());
+        string reply = request(DaemonOp::Encrypt, payload);
+        if (reply.size() < 8) throw runtime_error("Short encrypt reply");
+        codebookId = readU32(reply.data());
+        uint32_t length = readU32(reply.data() + 4);
+        if (reply.size() - 8 < length) throw runtime_error("Short encrypt reply");
+        codebook = reply.substr(8, length);
+        return reply.substr(8 + length);
+    }
+
+    string decrypt(uint32_t codebookId, string_view text) {
+        string payload;
+        appendU32(payload, codebookId);
+        payload.append(text.data(), text.size());
+        return request(DaemonOp::Decrypt, payload);
+    }
+
+    uint32_t loadCodebook(EncryptionMode mode, const string& path) {
+        string reply = request(DaemonOp::LoadCodebook, string(1, static_cast<char>(mode)) + path);
+        if (reply.size() < 4) throw runtime_error("Short load reply");
+        return readU32(reply.data());
+    }
+
+    uint32_t addCodebook(EncryptionMode mode, string_view codebook) {
+        string payload(1, static_cast<char>(mode));
+        payload.append(codebook.data(), codebook.size());
+        string reply = request(DaemonOp::AddCodebook, payload);
+        if (reply.size() < 4) throw runtime_error("Short add reply");
+        return readU32(reply.data());
+    }
+
+    void release(uint32_t codebookId) {
+        string payload;
+        appendU32(payload, codebookId);
+        request(DaemonOp::Release, payload);
+    }
+};
+
+// Test client: --client <socket> <command> ...
+inline int runDaemonClient(const string& socketPath, const vector<string>& args) {
+    auto usage = [] {
+        cerr << "Client commands:\n"
+             << "  encrypt <mode> <file> [codes file]\n"
+             << "                            encrypted text to stdout, codebook id to stderr,\n"
+             << "                            the codebook to codes file if given\n"
+             << "  decrypt <id> <file>       plain text to stdout\n"
+             << "  load <mode> <codes file>  have the daemon load a huffman_hashmap.txt codebook, print its id\n"
+             << "  add <mode> <codes file>   send a codebook (as encrypt saved it) to the daemon, print its id\n"
+             << "  release <id>\n"
+             << "  stats\n"
+             << "  shutdown\n"
+             << "  roundtrip <mode> <file>   encrypt, decrypt and release every line as one record\n"
+             << "mode: 1 = combined, 2 = Huffman + Caesar" << endl;
+        return 2;
+    };
+    if (args.empty()) return usage();
+
+    try {
+        DaemonClient client(socketPath);
+        const string& command = args[0];
+        auto readInput = [](const string& path) {
+            string content;
+            if (!readFileAsync(path, content)) throw runtime_error("Cannot read " + path);
+            return content;
+        };
+        auto modeArg = [&](const string& text) {
+            return static_cast<EncryptionMode>(stoi(text));
+        };
+
+        if (command == "encrypt" && (args.size() == 3 || args.size() == 4)) {
+            uint32_t id;
+            string codebook;
+            cout << client.encrypt(modeArg(args[1]), readInput(args[2]), id, codebook);
+            cerr << "codebook " << id << endl;
+            if (args.size() == 4) {
+                ofstream codes(args[3], ios::binary);
+                if (!codes.write(codebook.data(), codebook.size())) throw runtime_error("Cannot write " + args[3]);
+            }
+        } else if (command == "decrypt" && args.size() == 3) {
+            cout << client.decrypt(static_cast<uint32_t>(stoul(args[1])), readInput(args[2])) << endl;
+        } else if (command == "load" && args.size() == 3) {
+            cout << client.loadCodebook(modeArg(args[1]), args[2]) << endl;
+        } else if (command == "add" && args.size() == 3) {
+            cout << client.addCodebook(modeArg(args[1]), readInput(args[2])) << endl;
+        } else if (command == "release" && args.size() == 2) {
+            client.release(static_cast<uint32_t>(stoul(args[1])));
+        } else if (command == "stats" && args.size() == 1) {
+            cout << client.request(DaemonOp::Stats, "");
+        } else if (command == "shutdown" && args.size() == 1) {
+            client.request(DaemonOp::Shutdown, "");
+        } else if (command == "roundtrip" && args.size() == 3) {
+            EncryptionMode mode = modeArg(args[1]);
+            string content = readInput(args[2]);
+            vector<uint32_t> micros;
+            size_t mismatches = 0;
+            istringstream lines(content);
+            string line;
+            while (getline(lines, line)) {
+                string expected;
+                Tokenizer tokenizer(line);
+                string_view word;
+                while (tokenizer.next(word)) {
+                    if (!expected.empty()) expected.push_back(' ');
+                    expected.append(word.data(), word.size());
+                }
+                if (expected.empty()) continue;
+
+                auto start = chrono::steady_clock::now();
+                uint32_t id;
+                string codebook;
+                string encrypted = client.encrypt(mode, line, id, codebook);
+                string decrypted = client.decrypt(id, encrypted);
+                client.release(id);
+                micros.push_back(static_cast<uint32_t>(
+                    chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count()));
+                if (decrypted != expected) mismatches++;
+            }
+            cout << "records " << micros.size() << ", mismatches " << mismatches
+                 << ", p50 " << percentile(micros, 0.50) << " us, p99 " << percentile(micros, 0.99) << " us" << endl;
+            return mismatches == 0 ? 0 : 1;
+        } else {
+            return usage();
+        }
+    } catch (const exception& e) {
+        cerr << "Error: " << e.what() << endl;
+        return 1;
+    }
+    return 0;
+}
+
+#endif
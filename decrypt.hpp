@@ -4,20 +4,31 @@
 #include <string>
 #include <fstream>
 #include <sstream>
-#include <unordered_map>
+#include <memory>
 #include "rsa.hpp"
+#include "codebook.hpp"
+#include "async_io.hpp"
 #include "huffman.hpp"
 #include "avl_tree.hpp"
+#include "container.hpp"
+#include "stages.hpp"
+#include "checksum.hpp"
+#include "tokenizer.hpp"
+#include "delimiter_scan.hpp"
 
 using namespace std;
 
-// Forward declarations
-extern RSA globalRSA;
-extern unordered_map<string, string> globalHuffmanCodes;
-
 class Decryptor {
 private:
-    const int SHIFT = 4;  // Same shift as in encryption
+    const RSA& rsa;       // Keys the text was encrypted with
+
+    // Codebook and its code -> token index, built once in setCodebook and shared by every decode path
+    Codebook huffmanCodes;
+    ReverseCodebook reverseCodes;
+
+    // Block checksums of the encrypted file, once checkEncryptedFile found them
+    BlockChecksums checksums;
+    bool hasChecksums = false;
 
     // Reverse Caesar cipher for digits
     string reverseCaesar(const string& text) {
@@ -25,15 +36,7 @@ private:
         cout << "Input: " << text << endl;
         
         string result;
-        for (char c : text) {
-            if (isdigit(c)) {
-                int digit = c - '0';
-                digit = (digit - SHIFT + 10) % 10;  // Reverse the shift
-                result += to_string(digit);
-            } else {
-                result += c;
-            }
-        }
+        for (char c : text) result += CaesarStage<>::decodeChar(c);
         
         cout << "Output: " << result << endl;
         cout << "=====================================" << endl;
@@ -41,25 +44,23 @@ private:
     }
 
     // Convert Huffman codes back to original tokens
-    string decodeHuffman(const string& encoded, const unordered_map<string, string>& huffmanCodes) {
+    string decodeHuffman(const string& encoded) {
         cout << "\n=== Step 2: Decoding Huffman Codes ===" << endl;
         cout << "Input: " << encoded << endl;
-        
-        // Create reverse mapping (code -> token)
-        unordered_map<string, string> reverseCodes;
-        for (const auto& pair : huffmanCodes) {
-            reverseCodes[pair.second] = pair.first;
-        }
 
         string result;
-        string currentCode;
+        HuffmanCode currentCode;
+        string_view token;
         
         for (char c : encoded) {
-            currentCode += c;
-            if (reverseCodes.find(currentCode) != reverseCodes.end()) {
-                result += reverseCodes[currentCode];
-                cout << "Decoded '" << currentCode << "' to '" << reverseCodes[currentCode] << "'" << endl;
-                currentCode.clear();
+            if (c != '0' && c != '1') continue;
+            currentCode.append(c - '0');
+            if (reverseCodes.lookup(currentCode, token)) {
+                result += token;
+                cout << "Decoded '" << currentCode << "' to '" << token << "'" << endl;
+                currentCode = HuffmanCode();
+            } else if (currentCode.length == HuffmanCode::MAX_LENGTH) {
+                currentCode = HuffmanCode();
             }
         }
         
@@ -69,40 +70,86 @@ private:
     }
 
 public:
-    Decryptor() = default;
+    explicit Decryptor(const RSA& keys) : rsa(keys) {}
+
+    // The reverse index holds views into huffmanCodes, so a Decryptor is not copyable
+    Decryptor(const Decryptor&) = delete;
+    Decryptor& operator=(const Decryptor&) = delete;
+
+    // Take a copy of the codebook and build its reverse index once
+    void setCodebook(const Codebook& codes) {
+        huffmanCodes = codes;
+        reverseCodes.build(huffmanCodes);
+    }
+
+    const Codebook& getCodebook() const {
+        return huffmanCodes;
+    }
+
+    // Look up the token for one code in "0101" text form
+    bool decodeToken(string_view code, string_view& token) const {
+        return reverseCodes.lookup(code, token);
+    }
+
+    // Checks the encrypted file against the checksums the encoder saved next
+    // to it, so a truncated or corrupt file is rejected before any decoding.
+    // False if it has none; the decode steps then run unchecked as before.
+    bool checkEncryptedFile(const string& encryptedFile) {
+        hasChecksums = checksums.load(checksumFileFor(encryptedFile));
+        if (!hasChecksums) return false;
+        string content;
+        if (!readFileAsync(encryptedFile, content)) {
+            throw runtime_error("Failed to open encrypted file: " + encryptedFile);
+        }
+        checksums.verifyEncoded(content);
+        return true;
+    }
+
+    // Null unless checkEncryptedFile found checksums
+    const BlockChecksums* getBlockChecksums() const {
+        return hasChecksums ? &checksums : nullptr;
+    }
 
     // Method to reverse Caesar cipher and save to file
     void reverseCaesarToFile(const string& inputFile = "combined_encrypted.txt", 
                            const string& outputFile = "reverse_caesar.txt") {
         cout << "\n=== Reversing Caesar Cipher ===" << endl;
         cout << "Reading from: " << inputFile << endl;
-        
-        // Read the encrypted file
-        ifstream encryptedFile(inputFile);
-        if (!encryptedFile.is_open()) {
+
+        if (access(inputFile.c_str(), R_OK) != 0) {
             throw runtime_error("Failed to open encrypted file: " + inputFile);
         }
 
-        string encryptedContent((istreambuf_iterator<char>(encryptedFile)),
-                              istreambuf_iterator<char>());
-        encryptedFile.close();
+        // Stream the file through the reverse shift; the next read and the
+        // previous write are in flight while each chunk is shifted
+        bool reversed = transformFileAsync(inputFile, outputFile, CaesarStage<>::decodeChunk);
+        if (!reversed) {
+            throw runtime_error("Failed to create output file: " + outputFile);
+        }
 
-        cout << "Original Content: " << encryptedContent << endl;
+        cout << "Caesar cipher reversed and saved to: " << outputFile << endl;
+        cout << "=====================================" << endl;
+    }
 
-        // Reverse the Caesar cipher
-        string reversedContent = reverseCaesar(encryptedContent);
+    // Decode a compact container; its header names the model and the coder to
+    // decode with (Huffman or rANS), and
+    // the codebook travels inside the file
+    void decryptContainerFile(const string& inputFile, const string& outputFile = "decrypted_output.txt") {
+        string content;
+        if (!readFileAsync(inputFile, content)) {
+            throw runtime_error("Failed to open input file: " + inputFile);
+        }
+        string decoded;
+        ContainerHeader header = decodeContainer(content, rsa, CAESAR_SHIFT, decoded);
 
-        // Write to output file
-        ofstream output(outputFile);
-        if (!output.is_open()) {
+        AsyncFileWriter output(outputFile);
+        if (!output.isOpen()) {
             throw runtime_error("Failed to create output file: " + outputFile);
         }
-
-        output << reversedContent;
+        output.write(decoded);
         output.close();
-
-        cout << "Caesar cipher reversed and saved to: " << outputFile << endl;
-        cout << "=====================================" << endl;
+        cout << "Decoded " << header.symbolCount << " " << symbolModelName(header.model) << " symbols ("
+             << entropyCoderName(header.coder) << ") to: " << outputFile << endl;
     }
 
     // Decrypt a file and return the decrypted content
@@ -116,21 +163,21 @@ public:
         buffer << file.rdbuf();
         file.close();
 
-        return globalRSA.decryptString(buffer.str());
+        return rsa.decryptString(buffer.str());
     }
 
     // Decrypt a string directly
     string decryptString(const string& encrypted) {
-        return globalRSA.decryptString(encrypted);
+        return rsa.decryptString(encrypted);
     }
 
     // Get the private key for decryption
     pair<long long, long long> getPrivateKey() const {
-        return globalRSA.getPrivateKey();
+        return rsa.getPrivateKey();
     }
 
     // Combined decryption process (Caesar + RSA + Huffman)
-    string combinedDecryptFile(const string& filename, const unordered_map<string, string>& huffmanCodes) {
+    string combinedDecryptFile(const string& filename) {
         cout << "\n=== Starting Decryption Process ===" << endl;
         
         // Step 1: Read the encrypted file
@@ -149,24 +196,24 @@ public:
         string afterCaesar = reverseCaesar(encryptedContent);
 
         // Step 3: Decode Huffman codes
-        string afterHuffman = decodeHuffman(afterCaesar, huffmanCodes);
+        string afterHuffman = decodeHuffman(afterCaesar);
 
         // Step 4: Split into RSA-encrypted words and decrypt each
         cout << "\n=== Step 3: RSA Decryption ===" << endl;
-        stringstream ss(afterHuffman);
-        string word;
+        Tokenizer words(afterHuffman);
+        string_view word;
         string result;
         bool firstWord = true;
 
-        while (ss >> word) {
+        while (words.next(word)) {
             if (!firstWord) {
                 result += " ";
             }
             // Remove brackets if present
-            if (word.front() == '[') word = word.substr(1);
-            if (word.back() == ']') word.pop_back();
+            if (word.front() == '[') word.remove_prefix(1);
+            if (!word.empty() && word.back() == ']') word.remove_suffix(1);
             
-            string decryptedWord = globalRSA.decryptString(word);
+            string decryptedWord = rsa.decryptString(string(word));
             cout << "Decrypted '" << word << "' to '" << decryptedWord << "'" << endl;
             result += decryptedWord;
             firstWord = false;
@@ -177,17 +224,14 @@ public:
         return result;
     }
 
-    // Method to decode Huffman codes and save to file
-    void decodeHuffmanToFile(const unordered_map<string, string>& huffmanCodes,
-                           const string& inputFile = "reverse_caesar.txt", 
+    // Method to decode Huffman codes and save to file; returns the number of codes decoded
+    size_t decodeHuffmanToFile(const string& inputFile = "reverse_caesar.txt", 
                            const string& outputFile = "reverse_huffman.txt") {
         cout << "\n=== Decoding Huffman Codes ===" << endl;
         
-        // Create and print reverse mapping (code -> token)
+        // Print reverse mapping (code -> token)
         cout << "\n=== Huffman Codes Reverse Mapping ===" << endl;
-        unordered_map<string, string> reverseCodes;
         for (const auto& pair : huffmanCodes) {
-            reverseCodes[pair.second] = pair.first;  // code -> token
             cout << "Code: '" << pair.second << "' -> Token: '" << pair.first << "'" << endl;
         }
         cout << "===================================" << endl;
@@ -195,93 +239,127 @@ public:
         cout << "Reading from: " << inputFile << endl;
         
         // Read the input file
-        ifstream input(inputFile);
-        if (!input.is_open()) {
+        string content;
+        if (!readFileAsync(inputFile, content)) {
             throw runtime_error("Failed to open input file: " + inputFile);
         }
 
         // Write to output file
-        ofstream output(outputFile);
-        if (!output.is_open()) {
+        AsyncFileWriter output(outputFile);
+        if (!output.isOpen()) {
             throw runtime_error("Failed to create output file: " + outputFile);
         }
 
-        string word;
-        while (input >> word) {
+        Tokenizer tokenizer(content);
+        string_view word;
+        string_view token;
+        size_t decodedCount = 0;
+        while (tokenizer.next(word)) {
+            decodedCount++;
             // Look up the word in reverseCodes (word is a code)
-            if (reverseCodes.find(word) != reverseCodes.end()) {
-                output << "[" << reverseCodes[word] << "]";
+            if (reverseCodes.lookup(word, token)) {
+                output << "[" << token << "]";
+            } else if (hasChecksums) {
+                // The file checked out, so the codebook is the wrong one
+                throw runtime_error("Unknown code '" + string(word) + "': wrong codebook for this file");
             } else {
                 output << "[" << word << "]";  // If no match found, keep original
             }
             output << " ";  // Add space between tokens
         }
 
-        input.close();
         output.close();
 
         cout << "Huffman codes decoded and saved to: " << outputFile << endl;
         cout << "=====================================" << endl;
+        return decodedCount;
     }
 
-    // Method to reverse RSA encryption and save to file
-    void reverseRSAToFile(const string& inputFile = "reverse_huffman.txt", 
+    // Method to reverse RSA encryption and save to file; returns the number of words decrypted
+    size_t reverseRSAToFile(const string& inputFile = "reverse_huffman.txt", 
                          const string& outputFile = "decrypted_output.txt") {
         cout << "\n=== Reversing RSA Encryption ===" << endl;
         cout << "Reading from: " << inputFile << endl;
         
         // Read the input file
-        ifstream input(inputFile);
-        if (!input.is_open()) {
+        string content;
+        if (!readFileAsync(inputFile, content)) {
             throw runtime_error("Failed to open input file: " + inputFile);
         }
 
         // Write to output file
-        ofstream output(outputFile);
-        if (!output.is_open()) {
+        AsyncFileWriter output(outputFile);
+        if (!output.isOpen()) {
             throw runtime_error("Failed to create output file: " + outputFile);
         }
 
-        string content((istreambuf_iterator<char>(input)),
-                      istreambuf_iterator<char>());
-        input.close();
-
         bool firstWord = true;
-        string currentEncrypted;
+        size_t words = 0;
+        unique_ptr<ChecksumVerifier> verifier;
+        if (hasChecksums) verifier.reset(new ChecksumVerifier(checksums));
+
+        // Bracketed groups are decrypted a batch at a time so RSA runs over
+        // many numbers at once; each batch is written before the next is read
+        const size_t BATCH_VALUES = 1 << 14;
+        vector<string_view> groups;
+        vector<size_t> groupEnds;    // end of each group's numbers in values
+        vector<long long> values;
+        auto flushBatch = [&] {
+            rsa.decryptBatch(values.data(), values.data(), values.size());
+            size_t v = 0;
+            for (size_t g = 0; g < groups.size(); ++g) {
+                string decryptedWord;
+                for (; v < groupEnds[g]; ++v) decryptedWord += static_cast<char>(values[v]);
+                cout << "Processing encrypted content: " << groups[g] << endl;
+                cout << "Decrypted to: " << decryptedWord << endl;
+
+                // Add space between words (except before first word)
+                if (!firstWord) {
+                    output << " ";
+                }
+                output << decryptedWord;
+                firstWord = false;
+                if (verifier) verifier->add(decryptedWord);
+            }
+            words += groups.size();
+            groups.clear();
+            groupEnds.clear();
+            values.clear();
+        };
+
+        // The scanner hands over the bracket positions in bulk
+        size_t groupStart = 0;
         bool inBrackets = false;
-
-        for (char c : content) {
-            if (c == '[') {
-                inBrackets = true;
-                currentEncrypted.clear();
-            } else if (c == ']') {
-                inBrackets = false;
-                if (!currentEncrypted.empty()) {
-                    cout << "Processing encrypted content: " << currentEncrypted << endl;
-                    
-                    // Decrypt the entire content as a single word using global RSA
-                    string decryptedWord = globalRSA.decryptString(currentEncrypted);
-                    cout << "Decrypted to: " << decryptedWord << endl;
-                    
-                    // Add space between words (except before first word)
-                    if (!firstWord) {
-                        output << " ";
+        DelimiterScanner<BracketDelimiters> brackets(content, DelimiterScanner<BracketDelimiters>::POSITIONS);
+        for (size_t n = brackets.next(); n > 0; n = brackets.next()) {
+            const size_t* positions = brackets.batch();
+            for (size_t k = 0; k < n; ++k) {
+                size_t i = positions[k];
+                if (content[i] == '[') {
+                    inBrackets = true;
+                    groupStart = i + 1;
+                } else if (inBrackets) {
+                    inBrackets = false;
+                    if (i > groupStart) {
+                        groups.push_back(string_view(content).substr(groupStart, i - groupStart));
+                        RSA::parseNumbers(groups.back(), values);
+                        groupEnds.push_back(values.size());
+                        if (values.size() >= BATCH_VALUES) flushBatch();
                     }
-                    output << decryptedWord;
-                    firstWord = false;
                 }
-            } else if (inBrackets) {
-                currentEncrypted += c;
             }
         }
+        flushBatch();
+        if (verifier) verifier->finish();
 
         output.close();
 
         cout << "RSA encryption reversed and saved to: " << outputFile << endl;
         cout << "=====================================" << endl;
+        return words;
     }
 
-    void huffmanCaesarDecryptToFile(const unordered_map<string, string>& huffmanCodes) {
+    void huffmanCaesarDecryptToFile() {
         cout << "\n=== Starting Huffman + Caesar Decryption ===" << endl;
         
         // Step 1: Reverse Caesar cipher
@@ -297,15 +375,7 @@ public:
         cout << "Read encrypted content: " << encryptedContent << endl;
 
         string reversedCaesar;
-        for (char c : encryptedContent) {
-            if (isdigit(c)) {
-                int digit = c - '0';
-                digit = (digit - SHIFT + 10) % 10;  // Reverse the shift
-                reversedCaesar += to_string(digit);
-            } else {
-                reversedCaesar += c;
-            }
-        }
+        for (char c : encryptedContent) reversedCaesar += CaesarStage<>::decodeChar(c);
         cout << "Reversed Caesar cipher: " << reversedCaesar << endl;
 
         ofstream caesarReversedFile("reverse_caesar.txt");
@@ -334,16 +404,11 @@ public:
             for (char c : line) {
                 if (c == ' ') {
                     // Try to decode the current code
-                    bool found = false;
-                    for (const auto& pair : huffmanCodes) {
-                        if (pair.second == currentCode) {
-                            decodedFile << pair.first << " ";
-                            cout << "Decoded '" << currentCode << "' to '" << pair.first << "'" << endl;
-                            found = true;
-                            break;
-                        }
-                    }
-                    if (!found) {
+                    string_view token;
+                    if (reverseCodes.lookup(currentCode, token)) {
+                        decodedFile << token << " ";
+                        cout << "Decoded '" << currentCode << "' to '" << token << "'" << endl;
+                    } else {
                         decodedFile << currentCode << " ";
                         cout << "Could not decode '" << currentCode << "', writing as is" << endl;
                     }
@@ -354,16 +419,11 @@ public:
             }
             // Handle the last code in the line
             if (!currentCode.empty()) {
-                bool found = false;
-                for (const auto& pair : huffmanCodes) {
-                    if (pair.second == currentCode) {
-                        decodedFile << pair.first;
-                        cout << "Decoded '" << currentCode << "' to '" << pair.first << "'" << endl;
-                        found = true;
-                        break;
-                    }
-                }
-                if (!found) {
+                string_view token;
+                if (reverseCodes.lookup(currentCode, token)) {
+                    decodedFile << token;
+                    cout << "Decoded '" << currentCode << "' to '" << token << "'" << endl;
+                } else {
                     decodedFile << currentCode;
                     cout << "Could not decode '" << currentCode << "', writing as is" << endl;
                 }
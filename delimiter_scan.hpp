@@ -0,0 +1,235 @@
+#ifndef DELIMITER_SCAN_HPP
+#define DELIMITER_SCAN_HPP
+
+#include <string_view>
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+// Finds delimiter bytes without looking at the text a byte at a time. Up to
+// 4 KiB per pass is turned into one 64-bit mask per 64-byte block (bit i set
+// when byte i is a delimiter) by vector compares and movemask: AVX2 when the
+// CPU has it, SSE2 otherwise, a scalar loop elsewhere. The scanner then hands
+// out offsets in bulk by walking the set bits of the masks:
+//   POSITIONS  - every delimiter byte, for the bracket parsers
+//   BOUNDARIES - the start and end of every run of non-delimiters, in pairs,
+//                for the tokenizers
+// A delimiter set is a type saying which bytes it matches on each path.
+
+// ' ' and '\t' .. '\r', the bytes isTokenSpace accepts
+struct WhitespaceDelimiters {
+    static constexpr bool contains(char c) {
+        return c == ' ' || static_cast<unsigned char>(c - 9) < 5;
+    }
+
+#if defined(__x86_64__) || defined(__i386__)
+#ifdef __SSE2__
+    static __m128i matchSse2(__m128i v) {
+        __m128i control = _mm_sub_epi8(v, _mm_set1_epi8(9));
+        __m128i inRange = _mm_cmpeq_epi8(_mm_min_epu8(control, _mm_set1_epi8(4)), control);
+        return _mm_or_si128(inRange, _mm_cmpeq_epi8(v, _mm_set1_epi8(' ')));
+    }
+#endif
+
+    __attribute__((target("avx2"))) static __m256i matchAvx2(__m256i v) {
+        __m256i control = _mm256_sub_epi8(v, _mm256_set1_epi8(9));
+        __m256i inRange = _mm256_cmpeq_epi8(_mm256_min_epu8(control, _mm256_set1_epi8(4)), control);
+        return _mm256_or_si256(inRange, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')));
+    }
+#endif
+};
+
+// ' ' alone, for the text that is split on single spaces
+struct SpaceDelimiters {
+    static constexpr bool contains(char c) {
+        return c == ' ';
+    }
+
+#if defined(__x86_64__) || defined(__i386__)
+#ifdef __SSE2__
+    static __m128i matchSse2(__m128i v) {
+        return _mm_cmpeq_epi8(v, _mm_set1_epi8(' '));
+    }
+#endif
+
+    __attribute__((target("avx2"))) static __m256i matchAvx2(__m256i v) {
+        return _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' '));
+    }
+#endif
+};
+
+// '[' and ']', which wrap the RSA groups of rsa_encoded.txt and reverse_huffman.txt
+struct BracketDelimiters {
+    static constexpr bool contains(char c) {
+        return c == '[' || c == ']';
+    }
+
+#if defined(__x86_64__) || defined(__i386__)
+#ifdef __SSE2__
+    static __m128i matchSse2(__m128i v) {
+        return _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('[')), _mm_cmpeq_epi8(v, _mm_set1_epi8(']')));
+    }
+#endif
+
+    __attribute__((target("avx2"))) static __m256i matchAvx2(__m256i v) {
+        return _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('[')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8(']')));
+    }
+#endif
+};
+
+// Fills masks[0 .. blocks) from blocks * 64 bytes of data
+using BlockMasker = void (*)(const char* data, size_t blocks, uint64_t* masks);
+
+template <typename Set>
+uint64_t maskBytes(const char* data, size_t length) {
+    uint64_t mask = 0;
+    for (size_t i = 0; i < length; ++i) mask |= static_cast<uint64_t>(Set::contains(data[i])) << i;
+    return mask;
+}
+
+template <typename Set>
+void maskBlocksScalar(const char* data, size_t blocks, uint64_t* masks) {
+    for (size_t b = 0; b < blocks; ++b) masks[b] = maskBytes<Set>(data + 64 * b, 64);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#ifdef __SSE2__
+template <typename Set>
+void maskBlocksSse2(const char* data, size_t blocks, uint64_t* masks) {
+    for (size_t b = 0; b < blocks; ++b, data += 64) {
+        uint64_t mask = 0;
+        for (int part = 0; part < 4; ++part) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 16 * part));
+            mask |= static_cast<uint64_t>(static_cast<uint16_t>(_mm_movemask_epi8(Set::matchSse2(v)))) << (16 * part);
+        }
+        masks[b] = mask;
+    }
+}
+#endif
+
+template <typename Set>
+__attribute__((target("avx2"))) void maskBlocksAvx2(const char* data, size_t blocks, uint64_t* masks) {
+    for (size_t b = 0; b < blocks; ++b, data += 64) {
+        __m256i low = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data));
+        __m256i high = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + 32));
+        uint32_t lowMask = static_cast<uint32_t>(_mm256_movemask_epi8(Set::matchAvx2(low)));
+        uint32_t highMask = static_cast<uint32_t>(_mm256_movemask_epi8(Set::matchAvx2(high)));
+        masks[b] = lowMask | static_cast<uint64_t>(highMask) << 32;
+    }
+}
+#endif
+
+// The fastest masker this CPU has, chosen on first use
+template <typename Set>
+BlockMasker blockMasker() {
+    static const BlockMasker masker = [] {
+#if defined(__x86_64__) || defined(__i386__)
+        if (__builtin_cpu_supports("avx2")) return maskBlocksAvx2<Set>;
+#endif
+#ifdef __SSE2__
+        return maskBlocksSse2<Set>;
+#else
+        return maskBlocksScalar<Set>;
+#endif
+    }();
+    return masker;
+}
+
+template <typename Set>
+class DelimiterScanner {
+public:
+    enum Mode { POSITIONS, BOUNDARIES };
+
+    static constexpr size_t CHUNK_BLOCKS = 64;    // 4 KiB masked per pass
+    static constexpr size_t BATCH = 256;           // a batch stops at the first block boundary past this many
+
+private:
+    const char* data;
+    size_t length;
+    Mode mode;
+    BlockMasker masker;
+    uint64_t masks[CHUNK_BLOCKS];
+    size_t chunkStart = 0;    // offset of masks[0]
+    size_t chunkEnd = 0;      // offset just past the bytes masked so far
+    size_t filled = 0;        // masks in this chunk
+    size_t used = 0;          // masks already turned into offsets
+    uint64_t inRun = 0;       // BOUNDARIES: the byte before the next block is not a delimiter
+    size_t offsets[BATCH + 64 + 8];    // a whole block, plus the overrun of the last group of 8
+
+    // The offsets of the next block as bits from base; false once the text is done
+    bool nextBlock(uint64_t& bits, size_t& base) {
+        if (used == filled) {
+            size_t remaining = length - chunkEnd;
+            if (remaining == 0) {
+                // A run that reaches the end of the text ends there
+                if (!inRun) return false;
+                inRun = 0;
+                bits = 1;
+                base = length;
+                return true;
+            }
+            chunkStart = chunkEnd;
+            used = 0;
+            filled = min(remaining / 64, CHUNK_BLOCKS);
+            if (filled > 0) {
+                masker(data + chunkStart, filled, masks);
+                chunkEnd = chunkStart + 64 * filled;
+            } else {
+                masks[0] = maskBytes<Set>(data + chunkStart, remaining);
+                filled = 1;
+                chunkEnd = length;
+            }
+        }
+        base = chunkStart + 64 * used;
+        uint64_t mask = masks[used++];
+        size_t valid = min<size_t>(64, chunkEnd - base);
+        uint64_t validBits = valid == 64 ? ~0ULL : (1ULL << valid) - 1;
+        if (mode == POSITIONS) {
+            bits = mask & validBits;
+        } else {
+            // Bits past the end count as delimiters, so a run cut off there ends at the end
+            uint64_t run = ~mask & validBits;
+            bits = run ^ ((run << 1) | inRun);
+            inRun = valid == 64 ? run >> 63 : 0;
+        }
+        return true;
+    }
+
+public:
+    DelimiterScanner(string_view text, Mode m)
+        : data(text.data()), length(text.size()), mode(m), masker(blockMasker<Set>()) {}
+
+    // Scans whole blocks until the batch holds at least BATCH offsets or the
+    // text ends; returns how many, 0 once they are all out. They stay in
+    // batch() until the next call.
+    size_t next() {
+        size_t count = 0;
+        uint64_t bits;
+        size_t base;
+        while (count < BATCH && nextBlock(bits, base)) {
+            // Groups of 8 without a test per offset; the slots past the last
+            // set bit get junk that the count leaves out
+            size_t n = static_cast<size_t>(__builtin_popcountll(bits));
+            size_t* out = offsets + count;
+            for (size_t i = 0; i < n; i += 8) {
+                for (int k = 0; k < 8; ++k) {
+                    out[i + k] = base + static_cast<size_t>(__builtin_ctzll(bits | (1ULL << 63)));
+                    bits &= bits - 1;
+                }
+            }
+            count += n;
+        }
+        return count;
+    }
+
+    const size_t* batch() const {
+        return offsets;
+    }
+};
+
+#endif
@@ -0,0 +1,313 @@
+#ifndef DIRECTORY_MODE_HPP
+#define DIRECTORY_MODE_HPP
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <mutex>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <filesystem>
+#include <system_error>
+#include "codec.hpp"
+#include "pipeline.hpp"
+#include "async_io.hpp"
+#include "thread_pool.hpp"
+#include "result_cache.hpp"
+
+using namespace std;
+namespace fs = std::filesystem;
+
+// One line of the directory-mode manifest
+struct ManifestEntry {
+    string path;            // relative to the input root
+    bool ok = false;
+    uint64_t inputBytes = 0;
+    uint64_t outputBytes = 0;
+    double milliseconds = 0;
+    string message;
+};
+
+// Encrypts a directory tree on a work-stealing pool. Every regular file
+// <in>/<rel> becomes <out>/<rel>.enc (the encrypted text) plus
+// <out>/<rel>.codes (its codebook, huffman_hashmap.txt format). Small files
+// are grouped into batches so per-task overhead stays low, large files are
+// split into count/encode sub-tasks, and per-file results go to
+// <out>/manifest.tsv. With a result cache, unchanged files are copied out of
+// it instead of encrypted.
+class DirectoryEncryptor {
+private:
+    EncryptionMode mode;
+    const RSA& rsa;
+    int shift;
+    WorkStealingPool pool;
+    ResultCache* cache = nullptr;
+
+    fs::path inputRoot, outputRoot;
+    mutex manifestLock;
+    vector<ManifestEntry> manifest;
+
+    static const uint64_t SMALL_FILE = 64 * 1024;
+    static const uint64_t BATCH_BYTES = 4 * 1024 * 1024;
+    static const size_t BATCH_FILES = 256;
+    static const uint64_t LARGE_FILE = 16 * 1024 * 1024;
+    static const size_t SPLIT_CHUNK = 4 * 1024 * 1024;
+
+    void record(ManifestEntry entry) {
+        lock_guard<mutex> guard(manifestLock);
+        manifest.push_back(move(entry));
+    }
+
+    static bool readSmallFile(const fs::path& path, string& content) {
+        ifstream file(path, ios::binary);
+        if (!file) return false;
+        content.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+        return !file.bad();
+    }
+
+    static void writeWhole(const fs::path& path, const string& content) {
+        ofstream out(path, ios::binary);
+        if (!out.write(content.data(), content.size())) throw runtime_error("cannot write " + path.string());
+    }
+
+    // Creates <out>/<rel>'s directory and returns <out>/<rel> with the suffix appended
+    fs::path outputPath(const fs::path& relative, const string& suffix) {
+        fs::path target = outputRoot / relative;
+        fs::create_directories(target.parent_path());
+        target += suffix;
+        return target;
+    }
+
+    // Runs work for one file, timing it and turning exceptions into a failed manifest entry
+    template <typename Work>
+    void processFile(const fs::path& file, uint64_t size, Work work) {
+        ManifestEntry entry;
+        entry.path = fs::relative(file, inputRoot).generic_string();
+        entry.inputBytes = size;
+        auto start = chrono::steady_clock::now();
+        try {
+            entry.outputBytes = work(fs::relative(file, inputRoot));
+            entry.ok = true;
+        } catch (const exception& e) {
+            entry.message = e.what();
+        }
+        entry.milliseconds = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+        record(move(entry));
+    }
+
+    // Whole file on the current thread
+    uint64_t encryptWhole(const fs::path& file, const fs::path& relative) {
+        string content;
+        if (!readSmallFile(file, content)) throw runtime_error("cannot read file");
+
+        EncryptionPipeline pipeline(mode, rsa, shift);
+        pipeline.setCache(cache);
+        string encrypted = pipeline.encrypt(content);
+
+        writeWhole(outputPath(relative, ".enc"), encrypted);
+        pipeline.saveCodebook(outputPath(relative, ".codes").string());
+        return encrypted.size();
+    }
+
+    // Large file: count and encode whitespace-aligned chunks as parallel sub-tasks.
+    // Chunk symbol tables are merged in chunk order, so ids (and therefore the
+    // codes) match what a single-threaded pass would assign.
+    uint64_t encryptSplit(const fs::path& file, const fs::path& relative) {
+        string content;
+        if (!readFileAsync(file.string(), content)) throw runtime_error("cannot read file");
+
+        // The output and codebook are the same text an EncryptionPipeline writes,
+        // so entries are shared with it
+        CacheKey key;
+        if (cache) {
+            key = CacheKey(content, encryptionCacheVariant(mode, rsa, shift));
+            CacheSections sections;
+            if (cache->lookup(key, sections) && sections.count("output") && sections.count("codebook")) {
+                writeWhole(outputPath(relative, ".enc"), sections["output"]);
+                writeWhole(outputPath(relative, ".codes"), sections["codebook"]);
+                return sections["output"].size();
+            }
+        }
+
+        vector<string_view> chunks;
+        size_t start = 0;
+        while (start < content.size()) {
+            size_t end = min(content.size(), start + SPLIT_CHUNK);
+            while (end < content.size() && !isTokenSpace(content[end])) end++;
+            chunks.push_back(string_view(content).substr(start, end - start));
+            start = end;
+        }
+
+        vector<SymbolTable> partSymbols(chunks.size());
+        vector<vector<int>> partFrequency(chunks.size());
+        TaskGroup counting(pool);
+        for (size_t i = 0; i < chunks.size(); ++i) {
+            counting.run([&, i] { countTokens(chunks[i], partSymbols[i], partFrequency[i]); });
+        }
+        counting.wait();
+
+        SymbolTable symbols;
+        vector<int> frequency;
+        for (size_t i = 0; i < chunks.size(); ++i) {
+            for (size_t id = 0; id < partSymbols[i].size(); ++id) {
+                int merged = symbols.intern(partSymbols[i].symbol(id));
+                if (merged == static_cast<int>(frequency.size())) frequency.push_back(0);
+                frequency[merged] += partFrequency[i][id];
+            }
+        }
+        partSymbols.clear();
+        partFrequency.clear();
+
+        Codebook codebook;
+        vector<HuffmanCode> codeOf = buildCodebook(symbols, frequency, mode, rsa, codebook);
+
+        vector<string> parts(chunks.size());
+        CaesarShift caesar(shift);
+        TaskGroup encoding(pool);
+        for (size_t i = 0; i < chunks.size(); ++i) {
+            encoding.run([&, i] { encodeWords(chunks[i], symbols, codeOf, caesar, parts[i]); });
+        }
+        encoding.wait();
+
+        fs::path target = outputPath(relative, ".enc");
+        AsyncFileWriter out(target.string());
+        if (!out.isOpen()) throw runtime_error("cannot create " + target.string());
+        uint64_t written = 0;
+        for (const string& part : parts) {
+            if (part.empty()) continue;
+            if (written > 0) {
+                out.put(' ');
+                written++;
+            }
+            out.write(part);
+            written += part.size();
+        }
+        out.close();
+        saveCodebookFile(codebook, outputPath(relative, ".codes").string());
+
+        if (cache) {
+            CacheSections sections;
+            string& joined = sections["output"];
+            joined.reserve(written);
+            for (const string& part : parts) {
+                if (part.empty()) continue;
+                if (!joined.empty()) joined.push_back(' ');
+                joined += part;
+            }
+            ostringstream codes;
+            writeCodebook(codes, codebook);
+            sections["codebook"] = codes.str();
+            cache->insert(key, sections);
+        }
+        return written;
+    }
+
+    void writeManifest() {
+        sort(manifest.begin(), manifest.end(), [](const ManifestEntry& a, const ManifestEntry& b) {
+            return a.path < b.path;
+        });
+        fs::create_directories(outputRoot);
+        ofstream file(outputRoot / "manifest.tsv");
+        file << "status\tpath\tinput_bytes\toutput_bytes\tmilliseconds\tmessage\n";
+        for (const ManifestEntry& entry : manifest) {
+            file << (entry.ok ? "ok" : "failed") << '\t' << entry.path << '\t' << entry.inputBytes << '\t'
+                 << entry.outputBytes << '\t' << entry.milliseconds << '\t' << entry.message << '\n';
+        }
+    }
+
+public:
+    DirectoryEncryptor(EncryptionMode m, const RSA& r, int s, size_t threads = thread::hardware_concurrency())
+        : mode(m), rsa(r), shift(s), pool(threads) {}
+
+    // Look files up in c before encrypting them and store them there after (null = off)
+    void setCache(ResultCache* c) {
+        cache = c;
+    }
+
+    const vector<ManifestEntry>& getManifest() const {
+        return manifest;
+    }
+
+    // Encrypts every regular file under inputDir into outputDir and writes the manifest.
+    // Returns the number of files that failed.
+    size_t run(const string& inputDir, const string& outputDir) {
+        inputRoot = fs::absolute(inputDir).lexically_normal();
+        outputRoot = fs::absolute(outputDir).lexically_normal();
+        manifest.clear();
+
+        vector<pair<fs::path, uint64_t>> batch;
+        uint64_t batchBytes = 0;
+        auto flushBatch = [&] {
+            if (batch.empty()) return;
+            pool.submit([this, files = move(batch)] {
+                for (const auto& file : files) {
+                    processFile(file.first, file.second, [&](const fs::path& relative) {
+                        return encryptWhole(file.first, relative);
+                    });
+                }
+            });
+            batch.clear();
+            batchBytes = 0;
+        };
+
+        error_code error;
+        fs::recursive_directory_iterator walker(inputRoot, fs::directory_options::skip_permission_denied, error);
+        if (error) throw runtime_error("Cannot open directory " + inputDir + ": " + error.message());
+
+        // A failed increment may leave the walker at its end, so a failure is
+        // recorded against the last entry reached, never read from the walker
+        fs::path path;
+        auto recordFailure = [&](const string& message) {
+            ManifestEntry entry;
+            entry.path = fs::relative(path, inputRoot).generic_string();
+            entry.message = message;
+            record(move(entry));
+            error.clear();
+        };
+        for (;; walker.increment(error)) {
+            if (error) recordFailure("Stopped walking after this entry: " + error.message());
+            if (walker == fs::recursive_directory_iterator()) break;
+            path = walker->path();
+
+            // Never descend into our own output when it lives inside the input tree
+            if (walker->is_directory(error) && path.lexically_normal() == outputRoot) {
+                walker.disable_recursion_pending();
+                continue;
+            }
+            if (!walker->is_regular_file(error)) continue;
+
+            uint64_t size = walker->file_size(error);
+            if (error) {
+                recordFailure("Cannot read file size: " + error.message());
+                continue;
+            }
+            if (size >= LARGE_FILE) {
+                pool.submit([this, path, size] {
+                    processFile(path, size, [&](const fs::path& relative) { return encryptSplit(path, relative); });
+                });
+            } else if (size >= SMALL_FILE) {
+                pool.submit([this, path, size] {
+                    processFile(path, size, [&](const fs::path& relative) { return encryptWhole(path, relative); });
+                });
+            } else {
+                batch.emplace_back(path, size);
+                batchBytes += size;
+                if (batchBytes >= BATCH_BYTES || batch.size() >= BATCH_FILES) flushBatch();
+            }
+        }
+        flushBatch();
+
+        pool.waitIdle();
+        writeManifest();
+
+        size_t failed = 0;
+        for (const ManifestEntry& entry : manifest) {
+            if (!entry.ok) failed++;
+        }
+        return failed;
+    }
+};
+
+#endif
@@ -0,0 +1,136 @@
+#ifndef EYTZINGER_TREE_HPP
+#define EYTZINGER_TREE_HPP
+
+#include <vector>
+#include <algorithm>
+#include <utility>
+#include <iterator>
+#include <stdexcept>
+#include <cstddef>
+#include <cstdint>
+
+using namespace std;
+
+// 8-byte (count, id) key; the same fields an AVLNode exposes
+struct FrequencyKey {
+    int id;
+    int count;
+};
+
+// Read-only ordered set of (count, id) keys stored as a sorted array in
+// Eytzinger (BFS) order: slot k has children 2k and 2k + 1, so the first
+// levels share cache lines and a search touches one line per few levels
+// instead of one pointer node per level. A drop-in for AVLTree wherever
+// the keys are known up front, e.g. HuffmanCoding::buildFromTree.
+class EytzingerTree {
+public:
+    // In-order traversal by slot arithmetic alone
+    class Iterator {
+    private:
+        const FrequencyKey *slots = nullptr;
+        size_t n = 0;
+        size_t k = 0;    // current slot, 0 at the end
+
+    public:
+        using iterator_category = forward_iterator_tag;
+        using value_type = FrequencyKey;
+        using difference_type = ptrdiff_t;
+        using pointer = const FrequencyKey *;
+        using reference = const FrequencyKey &;
+
+        Iterator() {}
+
+        Iterator(const FrequencyKey *s, size_t size, size_t slot) : slots(s), n(size), k(slot) {}
+
+        // Leftmost slot of the subtree rooted at slot
+        static size_t leftmost(size_t slot, size_t size) {
+            if (slot > size) return 0;
+            while (2 * slot <= size) slot *= 2;
+            return slot;
+        }
+
+        // In-order successor of slot, or 0 past the last one
+        static size_t successor(size_t slot, size_t size) {
+            if (2 * slot + 1 <= size) return leftmost(2 * slot + 1, size);
+            // Climb while slot is a right child, then once more
+            while (slot & 1) slot >>= 1;
+            return slot >> 1;
+        }
+
+        reference operator*() const {
+            return slots[k];
+        }
+
+        pointer operator->() const {
+            return slots + k;
+        }
+
+        Iterator &operator++() {
+            k = successor(k, n);
+            return *this;
+        }
+
+        bool operator==(const Iterator &other) const {
+            return k == other.k;
+        }
+
+        bool operator!=(const Iterator &other) const {
+            return k != other.k;
+        }
+    };
+
+private:
+    vector<FrequencyKey> slots;    // slot 0 is unused
+
+    static int64_t packed(int count, int id) {
+        return (static_cast<int64_t>(count) << 32) | static_cast<uint32_t>(id);
+    }
+
+public:
+    EytzingerTree() : slots(1) {}
+
+    // Bulk load in O(n) from (count, id) keys in strictly increasing order
+    explicit EytzingerTree(const vector<pair<int, int>> &sortedKeys) : slots(sortedKeys.size() + 1) {
+        for (size_t i = 1; i < sortedKeys.size(); ++i) {
+            if (!(sortedKeys[i - 1] < sortedKeys[i])) throw runtime_error("Eytzinger bulk load needs strictly increasing keys");
+        }
+        size_t n = sortedKeys.size();
+        size_t k = Iterator::leftmost(1, n);
+        for (const pair<int, int> &key : sortedKeys) {
+            slots[k] = FrequencyKey{key.second, key.first};
+            k = Iterator::successor(k, n);
+        }
+    }
+
+    // Branch-free descent: the comparison picks the child, and the slot of
+    // the lower bound is recovered from the path bits at the end
+    bool contains(int id, int count) const {
+        const int64_t key = packed(count, id);
+        const size_t n = size();
+        size_t k = 1;
+        while (k <= n) {
+            __builtin_prefetch(slots.data() + min(16 * k, n));
+            k = 2 * k + (packed(slots[k].count, slots[k].id) < key);
+        }
+        k >>= __builtin_ffsll(static_cast<long long>(~k));
+        return k != 0 && packed(slots[k].count, slots[k].id) == key;
+    }
+
+    Iterator begin() const {
+        return Iterator(slots.data(), size(), Iterator::leftmost(1, size()));
+    }
+
+    Iterator end() const {
+        return Iterator(slots.data(), size(), 0);
+    }
+
+    size_t size() const {
+        return slots.size() - 1;
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+};
+
+#endif
@@ -1,40 +1,42 @@
 #ifndef HUFFMAN_HPP
 #define HUFFMAN_HPP
 
-#include <queue>
-#include <unordered_map>
 #include <vector>
 #include <string>
+#include <stdexcept>
 #include "avl_tree.hpp"
+#include "codebook.hpp"
 
 using namespace std;
 
+// Leaves carry a symbol id from the SymbolTable; internal nodes use -1
 struct HuffmanNode {
-    string word;
+    int id;
     int frequency;
     HuffmanNode *left, *right;
 
-    HuffmanNode(const string &w, int freq) : word(w), frequency(freq), left(nullptr), right(nullptr) {}
-};
-
-struct CompareNodes {
-    bool operator()(HuffmanNode *a, HuffmanNode *b) {
-        return a->frequency > b->frequency;
-    }
+    HuffmanNode(int i, int freq) : id(i), frequency(freq), left(nullptr), right(nullptr) {}
 };
 
 class HuffmanCoding {
 private:
     HuffmanNode *root;
-    unordered_map<string, string> huffmanCodes;
+    vector<HuffmanCode> huffmanCodes;    // indexed by symbol id
 
-    void generateCodes(HuffmanNode *node, const string &code) {
+    void generateCodes(HuffmanNode *node, HuffmanCode code) {
         if (!node) return;
-        if (!node->word.empty()) {
-            huffmanCodes[node->word] = code;
+        if (node->id >= 0) {
+            huffmanCodes[node->id] = code;
+            return;
         }
-        generateCodes(node->left, code + "0");
-        generateCodes(node->right, code + "1");
+        if (code.length == HuffmanCode::MAX_LENGTH) {
+            throw runtime_error("Huffman tree deeper than 64 levels");
+        }
+        HuffmanCode leftCode = code, rightCode = code;
+        leftCode.append(0);
+        rightCode.append(1);
+        generateCodes(node->left, leftCode);
+        generateCodes(node->right, rightCode);
     }
 
     void cleanup(HuffmanNode *node) {
@@ -45,13 +47,6 @@ private:
         }
     }
 
-    void collectNodes(AVLNode *avlNode, vector<HuffmanNode *> &nodes) {
-        if (!avlNode) return;
-        collectNodes(avlNode->left, nodes);
-        nodes.push_back(new HuffmanNode(avlNode->word, avlNode->count));
-        collectNodes(avlNode->right, nodes);
-    }
-
 public:
     HuffmanCoding() : root(nullptr) {}
 
@@ -59,39 +54,65 @@ public:
         cleanup(root);
     }
 
-    void buildFromAVL(AVLTree &avlTree) {
-        vector<HuffmanNode *> nodes;
-        collectNodes(avlTree.getRoot(), nodes);
-
-        priority_queue<HuffmanNode *, vector<HuffmanNode *>, CompareNodes> pq;
-        for (auto node : nodes) {
-            pq.push(node);
+    // Tree is any ordered container of (count, id) keys with size(), empty()
+    // and an in-order Iterator whose elements expose id and count, such as
+    // AVLTree or EytzingerTree.
+    // The in-order walk yields leaves by ascending count and merged nodes are
+    // created in ascending order too, so two FIFO queues replace the heap
+    template <typename Tree>
+    void buildFromTree(const Tree &tree) {
+        if (tree.empty()) return;
+
+        int maxId = 0;
+        for (const auto &node : tree) {
+            maxId = max(maxId, node.id);
         }
-
-        while (pq.size() > 1) {
-            HuffmanNode *left = pq.top(); pq.pop();
-            HuffmanNode *right = pq.top(); pq.pop();
-            HuffmanNode *internal = new HuffmanNode("", left->frequency + right->frequency);
+        huffmanCodes.assign(maxId + 1, HuffmanCode());
+
+        typename Tree::Iterator leaf = tree.begin(), lastLeaf = tree.end();
+        vector<HuffmanNode *> merged;
+        merged.reserve(tree.size() - 1);
+        size_t front = 0;
+        auto lightest = [&]() {
+            if (leaf != lastLeaf && (front == merged.size() || leaf->count <= merged[front]->frequency)) {
+                HuffmanNode *node = new HuffmanNode(leaf->id, leaf->count);
+                ++leaf;
+                return node;
+            }
+            return merged[front++];
+        };
+
+        for (size_t remaining = tree.size(); remaining > 1; --remaining) {
+            HuffmanNode *left = lightest();
+            HuffmanNode *right = lightest();
+            HuffmanNode *internal = new HuffmanNode(-1, left->frequency + right->frequency);
             internal->left = left;
             internal->right = right;
-            pq.push(internal);
+            merged.push_back(internal);
         }
 
-        root = pq.top();
-        generateCodes(root, "");
+        root = lightest();
+        // A lone symbol still needs a non-empty code
+        HuffmanCode code;
+        if (root->id >= 0) code.append(0);
+        generateCodes(root, code);
+    }
+
+    void buildFromAVL(const AVLTree &avlTree) {
+        buildFromTree(avlTree);
     }
 
-    const unordered_map<string, string> &getCodes() {
+    const vector<HuffmanCode> &getCodes() const {
         return huffmanCodes;
     }
 
-    void printCodes() const {
-        for (const auto &pair : huffmanCodes) {
-            cout << pair.first << ": " << pair.second << endl;
+    void printCodes(const SymbolTable &symbols) const {
+        for (size_t id = 0; id < huffmanCodes.size(); ++id) {
+            cout << symbols.symbol(id) << ": " << huffmanCodes[id] << endl;
         }
     }
 
-    void setCodes(const unordered_map<string, string>& codes) {
+    void setCodes(const vector<HuffmanCode>& codes) {
         huffmanCodes = codes;
     }
 };
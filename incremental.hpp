@@ -0,0 +1,396 @@
+#ifndef INCREMENTAL_HPP
+#define INCREMENTAL_HPP
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <array>
+#include <unordered_map>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <cstdio>
+#include <cstdint>
+#include "tokenizer.hpp"
+#include "codebook.hpp"
+#include "codec.hpp"
+#include "approximate.hpp"
+#include "async_io.hpp"
+#include "checksum.hpp"
+#include "result_cache.hpp"
+#include "rsa.hpp"
+
+using namespace std;
+
+// Incremental re-encryption. The input is cut into content-defined chunks
+// (FastCDC: a gear rolling hash picks the cut points, so an edit moves only
+// the boundaries next to it) and every chunk is encoded on its own against a
+// stable codebook. The codebook is the approximate-codebook format with an
+// escape, so words added later are written as literals instead of forcing a
+// new codebook. The chunk manifest, "<output>.chunks", records each chunk's
+// hash and the length of its encoding. On the next run, chunks whose hash is
+// in the manifest are copied from the previous output, and only new chunks
+// are encoded. The output is the usual text format and decrypts like top-K
+// output, with the same codebook file.
+//
+// Manifest format:
+//   cdc-manifest 1
+//   variant <mode, shift and key fingerprint>
+//   codebook <hex XXH64 of the codebook file>
+//   output <hex XXH64 of the output file>
+//   chunks <count>
+//   <hex XXH64 of chunk> <plain bytes> <encoded bytes> <words> <escaped words>   (one line per chunk)
+
+// One pseudo-random word per byte value, fixed (splitmix64 from a constant
+// seed) so cut points are the same in every run and every build
+constexpr array<uint64_t, 256> makeGearTable() {
+    array<uint64_t, 256> table{};
+    uint64_t state = 0x6A09E667F3BCC908ULL;
+    for (uint64_t& entry : table) {
+        state += 0x9E3779B97F4A7C15ULL;
+        uint64_t z = state;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        entry = z ^ (z >> 31);
+    }
+    return table;
+}
+
+constexpr array<uint64_t, 256> GEAR_TABLE = makeGearTable();
+
+struct ChunkingOptions {
+    size_t minBytes = 4 << 10;
+    size_t averageBytes = 16 << 10;    // a power of two
+    size_t maxBytes = 64 << 10;
+};
+
+// Length of the first chunk of data. The gear hash shifts one bit per byte,
+// so its top bits cover the last 64 bytes. Normalized chunking: up to the
+// average size a cut needs two more zero bits than the average implies, and
+// after it two fewer, which keeps chunk sizes close to the average.
+inline size_t fastCdcCut(string_view data, const ChunkingOptions& options) {
+    if (data.size() <= options.minBytes) return data.size();
+    int bits = 63 - __builtin_clzll(options.averageBytes);
+    const uint64_t strictMask = ~0ULL << (64 - (bits + 2));
+    const uint64_t looseMask = ~0ULL << (64 - (bits - 2));
+    size_t normal = min(options.averageBytes, data.size());
+    size_t limit = min(options.maxBytes, data.size());
+    uint64_t hash = 0;
+    size_t i = options.minBytes;
+    for (; i < normal; ++i) {
+        hash = (hash << 1) + GEAR_TABLE[static_cast<unsigned char>(data[i])];
+        if (!(hash & strictMask)) return i;
+    }
+    for (; i < limit; ++i) {
+        hash = (hash << 1) + GEAR_TABLE[static_cast<unsigned char>(data[i])];
+        if (!(hash & looseMask)) return i;
+    }
+    return limit;
+}
+
+// Cuts content into chunks, each moved on to the next whitespace so no word
+// straddles two chunks
+inline vector<string_view> chunkContent(string_view content, const ChunkingOptions& options = ChunkingOptions()) {
+    vector<string_view> chunks;
+    size_t start = 0;
+    while (start < content.size()) {
+        size_t end = start + fastCdcCut(content.substr(start), options);
+        while (end < content.size() && !isTokenSpace(content[end])) end++;
+        chunks.push_back(content.substr(start, end - start));
+        start = end;
+    }
+    return chunks;
+}
+
+struct ChunkRecord {
+    uint64_t hash = 0;
+    uint64_t plainBytes = 0;
+    uint64_t encodedBytes = 0;
+    uint64_t words = 0;
+    uint64_t escapes = 0;
+};
+
+struct ChunkManifest {
+    string variant;
+    uint64_t codebookHash = 0;
+    uint64_t outputHash = 0;
+    vector<ChunkRecord> chunks;
+
+    void save(const string& filename) const {
+        ofstream file(filename, ios::binary);
+        if (!file) throw runtime_error("Failed to create chunk manifest: " + filename);
+        file << "cdc-manifest 1\nvariant " << variant << "\n" << hex << "codebook " << codebookHash << "\noutput "
+             << outputHash << "\n" << dec << "chunks " << chunks.size() << "\n";
+        for (const ChunkRecord& chunk : chunks) {
+            file << hex << chunk.hash << dec << " " << chunk.plainBytes << " " << chunk.encodedBytes << " "
+                 << chunk.words << " " << chunk.escapes << "\n";
+        }
+        if (!file) throw runtime_error("Failed to write chunk manifest: " + filename);
+    }
+
+    // False if there is no such file or it is not a manifest this version reads
+    bool load(const string& filename) {
+        ifstream file(filename, ios::binary);
+        string line;
+        if (!file || !getline(file, line) || line != "cdc-manifest 1") return false;
+        if (!getline(file, line) || line.compare(0, 8, "variant ") != 0) return false;
+        variant = line.substr(8);
+        string field;
+        uint64_t count = 0;
+        if (!(file >> field >> hex >> codebookHash) || field != "codebook") return false;
+        if (!(file >> field >> outputHash) || field != "output") return false;
+        if (!(file >> field >> dec >> count) || field != "chunks") return false;
+        chunks.assign(count, ChunkRecord());
+        for (ChunkRecord& chunk : chunks) {
+            if (!(file >> hex >> chunk.hash >> dec >> chunk.plainBytes >> chunk.encodedBytes >> chunk.words >>
+                  chunk.escapes)) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+// What one incremental run did
+struct IncrementalStats {
+    size_t chunks = 0;
+    size_t reusedChunks = 0;
+    uint64_t inputBytes = 0;
+    uint64_t encodedInputBytes = 0;    // plain bytes that went through the encoder
+    uint64_t words = 0;
+    uint64_t escapes = 0;
+    bool rebuiltCodebook = false;
+};
+
+class IncrementalEncoder {
+private:
+    // A codebook is rebuilt once more than this share of the words are escaped
+    static constexpr double MAX_ESCAPED_SHARE = 0.125;
+
+    EncryptionMode mode;
+    RSA rsa;
+    int shift;
+    CaesarShift caesar;
+    ChunkingOptions options;
+    ApproximateCodebook book;    // as saved, keyed by ciphertext in combined mode
+    Codebook plainCodes;         // the same codes keyed by plain word
+    vector<string> cipherOfByte;
+    string literal;
+
+    // An escaped word's literal: its text, or its RSA ciphertext in combined mode
+    const string& literalText(string_view word) {
+        literal.clear();
+        if (mode != EncryptionMode::Combined) {
+            literal.assign(word.data(), word.size());
+            return literal;
+        }
+        for (size_t i = 0; i < word.size(); ++i) {
+            if (i) literal.push_back(' ');
+            literal += cipherOfByte[static_cast<unsigned char>(word[i])];
+        }
+        return literal;
+    }
+
+    // Codes for every word of content, plus an escape weighted by the words
+    // seen once (the Good-Turing estimate of how often a new word turns up),
+    // and a literal code for every byte value
+    void buildCodebook(string_view content) {
+        SymbolTable symbols;
+        vector<int> frequency;
+        countTokens(content, symbols, frequency);
+        int seenOnce = 0;
+        for (int count : frequency) seenOnce += count == 1;
+
+        vector<int> counts;
+        vector<string_view> keys;
+        SymbolTable cipherSymbols;
+        vector<int> cipherOf;
+        if (mode == EncryptionMode::Combined) {
+            encryptSymbols(symbols, frequency, rsa, cipherSymbols, cipherOf, counts);
+            for (size_t id = 0; id < cipherSymbols.size(); ++id) keys.push_back(cipherSymbols.symbol(id));
+        } else {
+            counts = frequency;
+            for (size_t id = 0; id < symbols.size(); ++id) keys.push_back(symbols.symbol(id));
+        }
+        const int escapeId = static_cast<int>(counts.size());
+        counts.push_back(max(1, seenOnce));
+        vector<HuffmanCode> codes = buildHuffmanCodes(counts);
+
+        book.clear();
+        book.codes.reserve(escapeId);
+        for (int id = 0; id < escapeId; ++id) book.codes.insert_or_assign(keys[id], codes[id]);
+        book.hasEscape = true;
+        book.escape = codes[escapeId];
+        vector<int> literalFrequency(LiteralCoder::END + 1, 1);
+        for (size_t id = 0; id < symbols.size(); ++id) {
+            for (char c : literalText(symbols.symbol(id))) literalFrequency[static_cast<unsigned char>(c)]++;
+        }
+        literalFrequency[LiteralCoder::END] += static_cast<int>(symbols.size());
+        book.literals.build(literalFrequency);
+
+        plainCodes.clear();
+        plainCodes.reserve(symbols.size());
+        for (size_t id = 0; id < symbols.size(); ++id) {
+            int codeId = mode == EncryptionMode::Combined ? cipherOf[id] : static_cast<int>(id);
+            plainCodes.insert_or_assign(symbols.symbol(id), codes[codeId]);
+        }
+    }
+
+    void usePlainCodes() {
+        plainCodes.clear();
+        plainCodes.reserve(book.codes.size());
+        for (const auto& pair : book.codes) {
+            if (mode == EncryptionMode::Combined) {
+                plainCodes.insert_or_assign(rsa.decryptString(string(pair.first)), pair.second);
+            } else {
+                plainCodes.insert_or_assign(pair.first, pair.second);
+            }
+        }
+    }
+
+    // Appends chunk's codes, separated by single spaces, to an empty out
+    ChunkRecord encodeChunk(string_view chunk, string& out) {
+        ChunkRecord record;
+        record.hash = xxh64(chunk);
+        record.plainBytes = chunk.size();
+        Tokenizer tokenizer(chunk);
+        string_view token;
+        while (tokenizer.next(token)) {
+            if (record.words++) out.push_back(' ');
+            const HuffmanCode* code = plainCodes.lookup(token);
+            if (code) {
+                appendShiftedCode(out, *code, caesar);
+                continue;
+            }
+            record.escapes++;
+            appendShiftedCode(out, book.escape, caesar);
+            out.push_back(' ');
+            book.literals.encode(literalText(token), caesar, out);
+        }
+        record.encodedBytes = out.size();
+        return record;
+    }
+
+    static void appendEncoding(string& output, string_view encoded) {
+        if (encoded.empty()) return;
+        if (!output.empty()) output.push_back(' ');
+        output.append(encoded.data(), encoded.size());
+    }
+
+public:
+    IncrementalEncoder(EncryptionMode m, const RSA& keys, int s = CAESAR_SHIFT) : mode(m), rsa(keys), shift(s), caesar(s) {
+        if (mode == EncryptionMode::Combined) {
+            for (int c = 0; c < 256; ++c) cipherOfByte.push_back(to_string(rsa.encrypt(static_cast<char>(c))));
+        }
+    }
+
+    void setChunking(const ChunkingOptions& o) {
+        options = o;
+    }
+
+    // Encrypts inputFile to outputFile. When outputFile, its manifest and
+    // codebookFile are from an earlier run with the same mode, shift and keys,
+    // the chunks that did not change are copied over and the codebook is kept
+    // unless too many words have become escapes. Otherwise the codebook is
+    // built from this input and saved to codebookFile.
+    IncrementalStats encryptFile(const string& inputFile, const string& outputFile, const string& codebookFile) {
+        string content;
+        if (!readFileAsync(inputFile, content)) throw runtime_error("Failed to open input file: " + inputFile);
+        vector<string_view> chunks = chunkContent(content, options);
+        IncrementalStats stats;
+        stats.chunks = chunks.size();
+        stats.inputBytes = content.size();
+
+        string variant = encryptionCacheVariant(mode, rsa, shift);
+        string manifestFile = outputFile + ".chunks";
+        ChunkManifest previous;
+        string previousOutput, codebookText;
+        bool reuse = previous.load(manifestFile) && previous.variant == variant &&
+                     readFileAsync(codebookFile, codebookText) && xxh64(codebookText) == previous.codebookHash &&
+                     readFileAsync(outputFile, previousOutput) && xxh64(previousOutput) == previous.outputHash;
+
+        ChunkManifest manifest;
+        manifest.variant = variant;
+        string output, encoded;
+        if (reuse) {
+            istringstream codes(codebookText);
+            readApproximateCodebook(codes, book);
+            reuse = book.hasEscape;
+        }
+        if (reuse) {
+            usePlainCodes();
+            // Where each earlier chunk's encoding sits in the earlier output
+            vector<size_t> offsets(previous.chunks.size());
+            unordered_map<uint64_t, size_t> earlier;
+            size_t position = 0;
+            for (size_t i = 0; i < previous.chunks.size(); ++i) {
+                const ChunkRecord& chunk = previous.chunks[i];
+                if (chunk.encodedBytes > 0 && position > 0) position++;
+                offsets[i] = position;
+                earlier.emplace(chunk.hash, i);
+                position += chunk.encodedBytes;
+            }
+            reuse = position == previousOutput.size();
+
+            output.reserve(previousOutput.size());
+            for (size_t i = 0; reuse && i < chunks.size(); ++i) {
+                uint64_t hash = xxh64(chunks[i]);
+                auto it = earlier.find(hash);
+                if (it != earlier.end() && previous.chunks[it->second].plainBytes == chunks[i].size()) {
+                    const ChunkRecord& record = previous.chunks[it->second];
+                    appendEncoding(output, string_view(previousOutput).substr(offsets[it->second], record.encodedBytes));
+                    manifest.chunks.push_back(record);
+                    stats.reusedChunks++;
+                } else {
+                    encoded.clear();
+                    manifest.chunks.push_back(encodeChunk(chunks[i], encoded));
+                    appendEncoding(output, encoded);
+                    stats.encodedInputBytes += chunks[i].size();
+                }
+                stats.words += manifest.chunks.back().words;
+                stats.escapes += manifest.chunks.back().escapes;
+            }
+            reuse = reuse && stats.escapes <= MAX_ESCAPED_SHARE * stats.words;
+        }
+
+        if (!reuse) {
+            stats = IncrementalStats();
+            stats.chunks = chunks.size();
+            stats.inputBytes = content.size();
+            stats.rebuiltCodebook = true;
+            buildCodebook(content);
+            ostringstream codes;
+            writeApproximateCodebook(codes, book);
+            codebookText = codes.str();
+            ofstream file(codebookFile, ios::binary);
+            if (!file.write(codebookText.data(), codebookText.size())) {
+                throw runtime_error("Failed to write codebook file: " + codebookFile);
+            }
+
+            manifest.chunks.clear();
+            output.clear();
+            for (string_view chunk : chunks) {
+                encoded.clear();
+                manifest.chunks.push_back(encodeChunk(chunk, encoded));
+                appendEncoding(output, encoded);
+                stats.words += manifest.chunks.back().words;
+                stats.escapes += manifest.chunks.back().escapes;
+            }
+            stats.encodedInputBytes = content.size();
+        }
+
+        AsyncFileWriter file(outputFile);
+        if (!file.isOpen()) throw runtime_error("Failed to create output file: " + outputFile);
+        file.write(output);
+        file.close();
+        // Escaped words are not covered by block checksums; drop a stale sidecar
+        removeChecksumFile(outputFile);
+
+        manifest.codebookHash = xxh64(codebookText);
+        manifest.outputHash = xxh64(output);
+        manifest.save(manifestFile);
+        return stats;
+    }
+};
+
+#endif
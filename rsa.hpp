@@ -2,6 +2,7 @@
 #define RSA_HPP
 
 #include <string>
+#include <string_view>
 #include <vector>
 #include <random>
 #include <cmath>
@@ -9,12 +10,16 @@
 #include <sstream>
 #include <bitset>
 #include <iostream>
+#include <charconv>
+#include <cctype>
+#include "tokenizer.hpp"
+#include "modpow_batch.hpp"
 
 using namespace std;
 
 class RSA {
 private:
-    long long p, q, n, phi, e, d;
+    long long p = 0, q = 0, n = 0, phi = 0, e = 0, d = 0;
     const int KEY_SIZE = 16; // Using small key size for demonstration
     bool keysGenerated = false;
 
@@ -66,7 +71,7 @@ private:
     }
 
     // Modular exponentiation
-    long long modPow(long long base, long long exp, long long mod) {
+    long long modPow(long long base, long long exp, long long mod) const {
         long long result = 1;
         base = base % mod;
         while (exp > 0) {
@@ -77,6 +82,21 @@ private:
         return result;
     }
 
+    // Without keys n is 0 and every modPow would divide by it
+    void requireKeys() const {
+        if (!keysGenerated) throw runtime_error("RSA keys are not initialized");
+    }
+
+    // Batches run through the Montgomery/AVX2 kernel when the modulus allows it
+    void powBatch(const long long* values, long long* out, size_t count, long long exp) const {
+        requireKeys();
+        if (!MontgomeryModulus::supports(n) || exp < 0) {
+            for (size_t i = 0; i < count; ++i) out[i] = modPow(values[i], exp, n);
+            return;
+        }
+        modPowBatch(values, out, count, exp, n);
+    }
+
     // Convert binary string to long long
     long long binaryToLong(const string& binary) {
         long long result = 0;
@@ -131,6 +151,10 @@ public:
         keysGenerated = true;
     }
 
+    bool hasKeys() const {
+        return keysGenerated;
+    }
+
     // Get public key
     pair<long long, long long> getPublicKey() const {
         return {e, n};
@@ -142,49 +166,75 @@ public:
     }
 
     // Encrypt a single number
-    long long encrypt(long long message) {
+    long long encrypt(long long message) const {
+        requireKeys();
         return modPow(message, e, n);
     }
 
     // Decrypt a single number
-    long long decrypt(long long ciphertext) {
+    long long decrypt(long long ciphertext) const {
+        requireKeys();
         return modPow(ciphertext, d, n);
     }
 
-    // Encrypt a string while preserving spaces
-    string encryptString(const string& message) {
-        string result;
-        bool firstChar = true;
-        
-        for (char c : message) {
-            if (!firstChar) {
-                result += " ";
+    // Encrypt many numbers at once, the same as encrypt on each; values and
+    // out may be the same array
+    void encryptBatch(const long long* values, long long* out, size_t count) const {
+        powBatch(values, out, count, e);
+    }
+
+    // Decrypt many numbers at once, the same as decrypt on each
+    void decryptBatch(const long long* values, long long* out, size_t count) const {
+        powBatch(values, out, count, d);
+    }
+
+    // Append numbers in decimal, separated by single spaces
+    static void appendNumbers(const long long* values, size_t count, string& out) {
+        char digits[24];
+        for (size_t i = 0; i < count; ++i) {
+            if (i) out += ' ';
+            out.append(digits, to_chars(digits, digits + sizeof(digits), values[i]).ptr);
+        }
+    }
+
+    // Append every whitespace-separated number in text to values. A token
+    // that does not start with a number is reported and skipped.
+    static void parseNumbers(string_view text, vector<long long>& values) {
+        Tokenizer tokenizer(text);
+        string_view token;
+        while (tokenizer.next(token)) {
+            string_view digits = token;
+            if (digits.size() > 1 && digits[0] == '+' && isdigit(static_cast<unsigned char>(digits[1]))) {
+                digits.remove_prefix(1);
+            }
+            long long value;
+            if (from_chars(digits.data(), digits.data() + digits.size(), value).ec == errc()) {
+                values.push_back(value);
+            } else {
+                cerr << "Error decrypting token: " << token << endl;
             }
-            long long m = static_cast<long long>(c);
-            long long encrypted = encrypt(m);
-            result += to_string(encrypted);
-            firstChar = false;
         }
-        
+    }
+
+    // Encrypt a string while preserving spaces
+    string encryptString(string_view message) const {
+        vector<long long> values(message.begin(), message.end());
+        encryptBatch(values.data(), values.data(), values.size());
+        string result;
+        appendNumbers(values.data(), values.size(), result);
         return result;
     }
 
     // Decrypt a string while preserving spaces
-    string decryptString(const string& encrypted) {
+    string decryptString(const string& encrypted) const {
+        vector<long long> values;
+        parseNumbers(encrypted, values);
+        decryptBatch(values.data(), values.data(), values.size());
         string result;
-        stringstream ss(encrypted);
-        string token;
-        
-        while (ss >> token) {
-            try {
-                long long num = stoll(token);
-                long long decrypted = decrypt(num);
-                result += static_cast<char>(decrypted);
-            } catch (const exception& e) {
-                cerr << "Error decrypting token: " << token << endl;
-            }
+        result.reserve(values.size());
+        for (long long value : values) {
+            result += static_cast<char>(value);
         }
-        
         return result;
     }
 };
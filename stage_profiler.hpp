@@ -0,0 +1,271 @@
+#ifndef STAGE_PROFILER_HPP
+#define STAGE_PROFILER_HPP
+
+#include <string>
+#include <vector>
+#include <array>
+#include <algorithm>
+#include <utility>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <cstdint>
+#include <cstring>
+#include <unistd.h>
+#include "allocation_tracker.hpp"
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+using namespace std;
+
+// Optional per-stage profiling. Each stage runs inside a ProfileScope that adds
+// its wall time and hardware counter deltas (cycles, instructions, L1D and
+// last-level cache misses, branch misses) to a StageProfiler. Counters come
+// from perf_event_open for the calling thread only; any event the kernel or
+// sandbox refuses is left out without a message, and with none at all the
+// report shows wall time alone. A null profiler makes every scope free.
+// Programs built with allocation tracking (allocation_tracker.hpp) also get
+// each stage's allocation count, bytes allocated and peak live heap.
+
+enum PerfEvent { CYCLES, INSTRUCTIONS, L1D_MISSES, LLC_MISSES, BRANCH_MISSES, PERF_EVENT_COUNT };
+
+struct CounterValues {
+    array<uint64_t, PERF_EVENT_COUNT> value{};
+};
+
+// One counter group on the calling thread
+class PerfCounters {
+private:
+    int leader = -1;
+    vector<int> fds;
+    array<int, PERF_EVENT_COUNT> slot;    // position in a group read, -1 if not counted
+
+#ifdef __linux__
+    static int openEvent(uint32_t type, uint64_t config, int group) {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.disabled = group < 0;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP;
+        return static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, group, 0));
+    }
+#endif
+
+public:
+    PerfCounters() {
+        slot.fill(-1);
+#ifdef __linux__
+        const uint64_t l1dReadMiss = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                     (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        const pair<uint32_t, uint64_t> events[PERF_EVENT_COUNT] = {
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+            {PERF_TYPE_HW_CACHE, l1dReadMiss},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+        };
+        for (int e = 0; e < PERF_EVENT_COUNT; ++e) {
+            int fd = openEvent(events[e].first, events[e].second, leader);
+            if (fd < 0) continue;
+            if (leader < 0) leader = fd;
+            slot[e] = static_cast<int>(fds.size());
+            fds.push_back(fd);
+        }
+        if (leader >= 0) {
+            ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+            ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        }
+#endif
+    }
+
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    ~PerfCounters() {
+        for (int fd : fds) close(fd);
+    }
+
+    bool available(PerfEvent event) const {
+        return slot[event] >= 0;
+    }
+
+    bool anyAvailable() const {
+        return leader >= 0;
+    }
+
+    CounterValues read() const {
+        CounterValues counts;
+        if (leader < 0) return counts;
+        // Group read: the number of events, then one value per event
+        uint64_t buffer[1 + PERF_EVENT_COUNT] = {};
+        if (::read(leader, buffer, sizeof(buffer)) < static_cast<ssize_t>(sizeof(uint64_t))) return counts;
+        for (int e = 0; e < PERF_EVENT_COUNT; ++e) {
+            if (slot[e] >= 0 && static_cast<uint64_t>(slot[e]) < buffer[0]) counts.value[e] = buffer[1 + slot[e]];
+        }
+        return counts;
+    }
+};
+
+// Accumulates stages by name, in first-seen order. Not thread-safe.
+class StageProfiler {
+private:
+    struct StageTotals {
+        string name;
+        size_t calls = 0;
+        uint64_t tokens = 0;
+        double ms = 0;
+        CounterValues counts;
+        uint64_t allocations = 0;
+        uint64_t allocatedBytes = 0;
+        uint64_t peakLive = 0;    // highest live heap seen during any call
+    };
+
+    PerfCounters counters;
+    vector<StageTotals> stages;
+
+    StageTotals& stage(const string& name) {
+        for (StageTotals& s : stages) {
+            if (s.name == name) return s;
+        }
+        stages.push_back(StageTotals());
+        stages.back().name = name;
+        return stages.back();
+    }
+
+public:
+    CounterValues sample() const {
+        return counters.read();
+    }
+
+    void record(const string& name, uint64_t tokens, double ms, const CounterValues& start, const CounterValues& stop) {
+        StageTotals& s = stage(name);
+        s.calls++;
+        s.tokens += tokens;
+        s.ms += ms;
+        for (int e = 0; e < PERF_EVENT_COUNT; ++e) s.counts.value[e] += stop.value[e] - start.value[e];
+    }
+
+    void recordAllocations(const string& name, const AllocationCounts& start, const AllocationCounts& stop,
+                           uint64_t peakLive) {
+        StageTotals& s = stage(name);
+        s.allocations += stop.allocations - start.allocations;
+        s.allocatedBytes += stop.bytes - start.bytes;
+        s.peakLive = max(s.peakLive, peakLive);
+    }
+
+    void clear() {
+        stages.clear();
+    }
+
+    // Totals of one stage so far; zero if it never ran
+    double stageMs(const string& name) const {
+        for (const StageTotals& s : stages) {
+            if (s.name == name) return s.ms;
+        }
+        return 0;
+    }
+
+    uint64_t stageTokens(const string& name) const {
+        for (const StageTotals& s : stages) {
+            if (s.name == name) return s.tokens;
+        }
+        return 0;
+    }
+
+    // IPC and misses per token; "-" where a counter or the token count is missing
+    void report(ostream& out) const {
+        out << "\n=== Stage profile ===" << endl;
+        if (!counters.anyAvailable()) out << "(hardware counters unavailable; wall time only)" << endl;
+        out << "  " << left << setw(28) << "stage" << right << setw(7) << "calls" << setw(11) << "ms" << setw(12)
+            << "tokens" << setw(7) << "IPC" << setw(13) << "L1D miss/tok" << setw(13) << "LLC miss/tok" << setw(13)
+            << "br miss/tok" << endl;
+        auto perToken = [&](const StageTotals& s, PerfEvent event) -> string {
+            if (!counters.available(event) || s.tokens == 0) return "-";
+            ostringstream text;
+            text << fixed << setprecision(3) << static_cast<double>(s.counts.value[event]) / s.tokens;
+            return text.str();
+        };
+        for (const StageTotals& s : stages) {
+            string ipc = "-";
+            if (counters.available(CYCLES) && counters.available(INSTRUCTIONS) && s.counts.value[CYCLES]) {
+                ostringstream text;
+                text << fixed << setprecision(2)
+                     << static_cast<double>(s.counts.value[INSTRUCTIONS]) / s.counts.value[CYCLES];
+                ipc = text.str();
+            }
+            out << "  " << left << setw(28) << s.name << right << setw(7) << s.calls << setw(11) << fixed
+                << setprecision(2) << s.ms << setw(12) << s.tokens << setw(7) << ipc << setw(13)
+                << perToken(s, L1D_MISSES) << setw(13) << perToken(s, LLC_MISSES) << setw(13)
+                << perToken(s, BRANCH_MISSES) << endl;
+        }
+        if (!AllocationTracker::isHooked()) return;
+
+        // Peak is the whole process's live heap at its highest during the stage
+        out << "  " << left << setw(28) << "stage (heap)" << right << setw(12) << "allocs" << setw(13) << "alloc MB"
+            << setw(12) << "peak MB" << endl;
+        for (const StageTotals& s : stages) {
+            out << "  " << left << setw(28) << s.name << right << setw(12) << s.allocations << setw(13) << fixed
+                << setprecision(2) << s.allocatedBytes / 1048576.0 << setw(12) << s.peakLive / 1048576.0 << endl;
+        }
+        out << "  process peak live heap: " << fixed << setprecision(2)
+            << AllocationTracker::peakLive() / 1048576.0 << " MB" << endl;
+    }
+};
+
+// Times one run of a stage into profiler, if there is one
+class ProfileScope {
+private:
+    StageProfiler* profiler;
+    const char* name;
+    uint64_t tokens;
+    chrono::steady_clock::time_point startTime;
+    CounterValues startCounts;
+    AllocationCounts startAllocations;
+    uint64_t outerPeak = 0;
+
+public:
+    ProfileScope(StageProfiler* p, const char* stageName, uint64_t tokenCount = 0)
+        : profiler(p), name(stageName), tokens(tokenCount) {
+        if (!profiler) return;
+        startAllocations = AllocationTracker::counts();
+        outerPeak = AllocationTracker::beginPeakWindow();
+        startCounts = profiler->sample();
+        startTime = chrono::steady_clock::now();
+    }
+
+    ProfileScope(const ProfileScope&) = delete;
+    ProfileScope& operator=(const ProfileScope&) = delete;
+
+    // For stages that only learn how many tokens they handled as they run
+    void setTokens(uint64_t count) {
+        tokens = count;
+    }
+
+    ~ProfileScope() {
+        if (!profiler) return;
+        CounterValues stopCounts = profiler->sample();
+        double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - startTime).count();
+        AllocationCounts stopAllocations = AllocationTracker::counts();
+        uint64_t stagePeak = AllocationTracker::peakLive();
+        profiler->record(name, tokens, ms, startCounts, stopCounts);
+        profiler->recordAllocations(name, startAllocations, stopAllocations, stagePeak);
+        AllocationTracker::endPeakWindow(outerPeak);
+    }
+};
+
+// Runs work() as one named stage; tokens is how many it handles
+template <typename Work>
+inline void profileStage(StageProfiler* profiler, const char* name, uint64_t tokens, Work&& work) {
+    ProfileScope scope(profiler, name, tokens);
+    work();
+}
+
+#endif
@@ -0,0 +1,253 @@
+#ifndef STAGES_HPP
+#define STAGES_HPP
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <array>
+#include <cstdint>
+#include "codec.hpp"
+#include "codebook.hpp"
+#include "tokenizer.hpp"
+#include "rsa.hpp"
+#include "stage_profiler.hpp"
+#include "checksum.hpp"
+
+using namespace std;
+
+// Compile-time composition of the encryption stages. A mode is a type:
+//
+//     using CombinedEncryption = Pipeline<Tokenize, RSAStage, HuffmanStage, CaesarStage<>>;
+//
+// Stages that work per distinct word (tokenizing, RSA, building codes) run
+// once in order through prepare. Stages that work per character (Caesar) are
+// folded at compile time into the digit and separator bytes the single emit
+// loop writes, and into the table the decode loop parses with, so no stage
+// makes its own pass over the text.
+
+// State handed from stage to stage while encrypting one buffer
+struct StageState {
+    const RSA* rsa = nullptr;
+    SymbolTable symbols;           // plain words
+    vector<int> frequency;
+    vector<int> tokenIds;          // the text as plain word ids
+    SymbolTable keySymbols;        // codebook keys when they differ from the words (RSA)
+    vector<int> keyOf;             // plain id -> key id, empty while keys are the words
+    vector<int> keyFrequency;
+    vector<HuffmanCode> codeOf;    // plain id -> code
+    Codebook* codebook = nullptr;  // keyed as written to huffman_hashmap.txt
+};
+
+// No-op hooks; stages override the ones they need. NAME labels a stage with
+// prepare work in profiles.
+struct Stage {
+    static constexpr const char* NAME = nullptr;
+
+    static void prepare(string_view, StageState&) {}
+
+    static constexpr char encodeChar(char c) {
+        return c;
+    }
+
+    static constexpr char decodeChar(char c) {
+        return c;
+    }
+};
+
+// Interns and counts the words, keeping the text as ids so it is never re-hashed
+struct Tokenize : Stage {
+    static constexpr const char* NAME = "tokenize";
+
+    static void prepare(string_view content, StageState& state) {
+        countTokens(content, state.symbols, state.frequency, &state.tokenIds);
+    }
+};
+
+// Keys the codebook by each distinct word's ciphertext
+struct RSAStage : Stage {
+    static constexpr const char* NAME = "rsa";
+
+    static void prepare(string_view, StageState& state) {
+        encryptSymbols(state.symbols, state.frequency, *state.rsa, state.keySymbols, state.keyOf, state.keyFrequency);
+    }
+};
+
+// Builds the codes over the current keys and fills the codebook
+struct HuffmanStage : Stage {
+    static constexpr const char* NAME = "huffman-build";
+
+    static void prepare(string_view, StageState& state) {
+        bool keyed = !state.keyOf.empty();
+        vector<HuffmanCode> codes = buildHuffmanCodes(keyed ? state.keyFrequency : state.frequency);
+        const SymbolTable& keys = keyed ? state.keySymbols : state.symbols;
+        state.codebook->clear();
+        state.codebook->reserve(codes.size());
+        for (size_t id = 0; id < codes.size(); ++id) {
+            state.codebook->insert_or_assign(keys.symbol(id), codes[id]);
+        }
+        if (!keyed) {
+            state.codeOf = move(codes);
+            return;
+        }
+        state.codeOf.resize(state.symbols.size());
+        for (size_t id = 0; id < state.symbols.size(); ++id) {
+            state.codeOf[id] = codes[state.keyOf[id]];
+        }
+    }
+};
+
+template <int Shift = CAESAR_SHIFT>
+struct CaesarStage : Stage {
+    static constexpr array<char, 256> ENCODE = digitShiftTable(Shift);
+    static constexpr array<char, 256> DECODE = digitShiftTable(-Shift);
+
+    static constexpr char encodeChar(char c) {
+        return shiftDigit(c, Shift);
+    }
+
+    static constexpr char decodeChar(char c) {
+        return shiftDigit(c, -Shift);
+    }
+
+    // Chunk callbacks for transformFileAsync
+    static void encodeChunk(const char* in, char* out, size_t length) {
+        for (size_t i = 0; i < length; ++i) out[i] = ENCODE[static_cast<unsigned char>(in[i])];
+    }
+
+    static void decodeChunk(const char* in, char* out, size_t length) {
+        for (size_t i = 0; i < length; ++i) out[i] = DECODE[static_cast<unsigned char>(in[i])];
+    }
+};
+
+// Folds the per-character hooks: encode runs the stages in order, decode in reverse
+template <typename... Stages>
+struct ComposeChars;
+
+template <>
+struct ComposeChars<> {
+    static constexpr char encode(char c) {
+        return c;
+    }
+
+    static constexpr char decode(char c) {
+        return c;
+    }
+};
+
+template <typename First, typename... Rest>
+struct ComposeChars<First, Rest...> {
+    static constexpr char encode(char c) {
+        return ComposeChars<Rest...>::encode(First::encodeChar(c));
+    }
+
+    static constexpr char decode(char c) {
+        return First::decodeChar(ComposeChars<Rest...>::decode(c));
+    }
+};
+
+template <typename... Stages>
+class Pipeline {
+private:
+    using Chars = ComposeChars<Stages...>;
+
+    // Bit value of each encrypted byte once the character stages are undone, or -1
+    static constexpr array<int8_t, 256> makeBitTable() {
+        array<int8_t, 256> table{};
+        for (int b = 0; b < 256; ++b) {
+            char c = Chars::decode(static_cast<char>(b));
+            table[b] = c == '0' ? 0 : (c == '1' ? 1 : -1);
+        }
+        return table;
+    }
+
+public:
+    static constexpr char ZERO = Chars::encode('0');
+    static constexpr char ONE = Chars::encode('1');
+    static constexpr char SEPARATOR = Chars::encode(' ');
+    static constexpr array<int8_t, 256> BITS = makeBitTable();
+
+    static_assert(ZERO != ONE && isTokenSpace(SEPARATOR), "Character stages must keep codes parseable");
+
+    template <typename S>
+    static void prepareStage(string_view content, StageState& state, StageProfiler* profiler) {
+        if constexpr (S::NAME == nullptr) {
+            S::prepare(content, state);
+            return;
+        }
+        ProfileScope scope(profiler, S::NAME);
+        S::prepare(content, state);
+        scope.setTokens(state.tokenIds.size());
+    }
+
+    // Writes each word's code, separated by single spaces. checksums, if given,
+    // gets every word and the bytes written for it. caesar, if given, stands in
+    // for the character stages: a shift chosen at run time.
+    static void encrypt(string_view content, const RSA& rsa, string& out, Codebook& codebook,
+                        Codebook* plainCodebook = nullptr, StageProfiler* profiler = nullptr,
+                        ChecksumBuilder* checksums = nullptr, const CaesarShift* caesar = nullptr) {
+        StageState state;
+        state.rsa = &rsa;
+        state.codebook = &codebook;
+        (prepareStage<Stages>(content, state, profiler), ...);
+
+        if (plainCodebook) {
+            plainCodebook->clear();
+            plainCodebook->reserve(state.codeOf.size());
+            for (size_t id = 0; id < state.codeOf.size(); ++id) {
+                plainCodebook->insert_or_assign(state.symbols.symbol(id), state.codeOf[id]);
+            }
+        }
+
+        ProfileScope emit(profiler, "emit", state.tokenIds.size());
+        const char zero = caesar ? caesar->zero : ZERO;
+        const char one = caesar ? caesar->one : ONE;
+        const char separator = caesar ? ' ' : SEPARATOR;
+        out.clear();
+        for (size_t i = 0; i < state.tokenIds.size(); ++i) {
+            const HuffmanCode& code = state.codeOf[state.tokenIds[i]];
+            if (i) out.push_back(separator);
+            size_t start = out.size();
+            for (int b = code.length - 1; b >= 0; --b) {
+                out.push_back(((code.bits >> b) & 1) ? one : zero);
+            }
+            if (checksums) checksums->add(state.symbols.symbol(state.tokenIds[i]), string_view(out).substr(start));
+        }
+    }
+
+    // Undoes encrypt: appends the token of each code, separated by single spaces.
+    // Throws on a code not in the index, or on the first block checksums rejects.
+    static void decrypt(string_view encrypted, const ReverseCodebook& reverse, string& out,
+                        StageProfiler* profiler = nullptr, ChecksumVerifier* checksums = nullptr,
+                        const CaesarShift* caesar = nullptr) {
+        ProfileScope scope(profiler, "decode");
+        const array<int8_t, 256>& bits = caesar ? caesar->bits : BITS;
+        uint64_t tokens = 0;
+        Tokenizer tokenizer(encrypted);
+        string_view word, token;
+        bool firstWord = out.empty();
+        while (tokenizer.next(word)) {
+            HuffmanCode code;
+            for (char c : word) {
+                int bit = bits[static_cast<unsigned char>(c)];
+                if (bit < 0 || code.length == HuffmanCode::MAX_LENGTH) throw runtime_error("Malformed code: " + string(word));
+                code.append(bit);
+            }
+            if (!reverse.lookup(code, token)) {
+                throw runtime_error("Unknown code: " + string(word));
+            }
+            if (!firstWord) out.push_back(' ');
+            out.append(token.data(), token.size());
+            firstWord = false;
+            tokens++;
+            if (checksums) checksums->add(token);
+        }
+        if (checksums) checksums->finish();
+        scope.setTokens(tokens);
+    }
+};
+
+// The two encryption modes
+using CombinedEncryption = Pipeline<Tokenize, RSAStage, HuffmanStage, CaesarStage<>>;
+using HuffmanCaesarEncryption = Pipeline<Tokenize, HuffmanStage, CaesarStage<>>;
+
+#endif
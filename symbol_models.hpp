@@ -0,0 +1,399 @@
+#ifndef SYMBOL_MODELS_HPP
+#define SYMBOL_MODELS_HPP
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <queue>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include "tokenizer.hpp"
+
+using namespace std;
+
+// Symbol models for the compact container. A model cuts the input into
+// symbols whose texts concatenate back to the input byte for byte:
+//   Word    - a word plus the whitespace after it (leading whitespace alone)
+//   Byte    - single bytes; at most 256 symbols, so IDs and hex cost no vocabulary
+//   Subword - BPE-style byte-pair merges learned on a sample of the input
+// Auto picks the model with the smallest estimated output: order-0 entropy of
+// a sample plus a vocabulary size extrapolated to the whole input.
+
+enum class SymbolModel : uint8_t {
+    Auto = 0,
+    Word = 1,
+    Byte = 2,
+    Subword = 3
+};
+
+inline const char* symbolModelName(SymbolModel model) {
+    switch (model) {
+        case SymbolModel::Word: return "word";
+        case SymbolModel::Byte: return "byte";
+        case SymbolModel::Subword: return "subword";
+        default: return "auto";
+    }
+}
+
+inline bool parseSymbolModel(string_view name, SymbolModel& model) {
+    for (SymbolModel m : {SymbolModel::Auto, SymbolModel::Word, SymbolModel::Byte, SymbolModel::Subword}) {
+        if (name == symbolModelName(m)) {
+            model = m;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Calls f(unit) for every word unit of content, in order
+template <typename F>
+inline void forEachWordUnit(string_view content, F&& f) {
+    // Each unit runs from the start of one word to the start of the next
+    Tokenizer words(content);
+    string_view word;
+    size_t unitStart = 0;
+    while (words.next(word)) {
+        size_t wordStart = static_cast<size_t>(word.data() - content.data());
+        if (wordStart > unitStart) f(content.substr(unitStart, wordStart - unitStart));
+        unitStart = wordStart;
+    }
+    if (unitStart < content.size()) f(content.substr(unitStart));
+}
+
+// The input as a sequence of symbol ids. Word symbols are views into the
+// segmented content, which must outlive the segmentation.
+struct Segmentation {
+    SymbolTable symbols;        // id -> text
+    vector<int> frequency;
+    vector<uint32_t> stream;    // ids in input order; empty for the byte model, whose ids are the bytes
+};
+
+inline void segmentWords(string_view content, Segmentation& seg) {
+    forEachWordUnit(content, [&](string_view unit) {
+        int id = seg.symbols.intern(unit);
+        if (id == static_cast<int>(seg.frequency.size())) seg.frequency.push_back(0);
+        seg.frequency[id]++;
+        seg.stream.push_back(static_cast<uint32_t>(id));
+    });
+}
+
+inline void segmentBytes(string_view content, Segmentation& seg) {
+    for (int c = 0; c < 256; ++c) {
+        char byte = static_cast<char>(c);
+        seg.symbols.internCopy(string_view(&byte, 1));
+    }
+    seg.frequency.assign(256, 0);
+    for (char c : content) seg.frequency[static_cast<unsigned char>(c)]++;
+}
+
+// Byte-pair encoding. Merges never cross a word unit, and units are cut into
+// pieces of at most MAX_PIECE bytes so applying merges stays linear. The
+// alphabet is at most 256 + MAX_MERGES ids, so pairs index flat tables.
+class SubwordModel {
+private:
+    static constexpr size_t MAX_PIECE = 64;
+    static constexpr size_t MAX_MERGES = 256;
+    static constexpr size_t ALPHABET = 256 + MAX_MERGES;
+    static constexpr size_t CACHE_LIMIT = 1 << 16;
+    static constexpr uint16_t NO_MERGE = 0xFFFF;
+
+    vector<string> texts;         // id -> text; ids below 256 are single bytes
+    vector<uint16_t> rankOf;      // pair index -> merge rank (earlier merges win)
+    vector<uint32_t> pairOfRank;  // merge rank -> pair index
+
+    static uint32_t pairIndex(uint32_t a, uint32_t b) {
+        return a * ALPHABET + b;
+    }
+
+    template <typename F>
+    static void forEachPiece(string_view content, F&& f) {
+        forEachWordUnit(content, [&](string_view unit) {
+            for (size_t pos = 0; pos < unit.size(); pos += MAX_PIECE) f(unit.substr(pos, MAX_PIECE));
+        });
+    }
+
+public:
+    SubwordModel() : rankOf(ALPHABET * ALPHABET, NO_MERGE) {
+        for (int c = 0; c < 256; ++c) texts.push_back(string(1, static_cast<char>(c)));
+    }
+
+    size_t mergeCount() const {
+        return texts.size() - 256;
+    }
+
+    // Learns up to maxMerges merges, most frequent pair first. Pair counts are
+    // kept up to date incrementally, so each merge only revisits the pieces
+    // that contain it.
+    void learn(string_view sample, size_t maxMerges = MAX_MERGES) {
+        maxMerges = min(maxMerges, MAX_MERGES);
+        texts.resize(256);
+        fill(rankOf.begin(), rankOf.end(), NO_MERGE);
+        pairOfRank.clear();
+
+        unordered_map<string_view, int64_t> pieceCount;
+        forEachPiece(sample, [&](string_view piece) { pieceCount[piece]++; });
+
+        vector<vector<uint16_t>> pieces;
+        vector<int64_t> weight;
+        pieces.reserve(pieceCount.size());
+        for (const auto& entry : pieceCount) {
+            pieces.emplace_back();
+            for (char c : entry.first) pieces.back().push_back(static_cast<unsigned char>(c));
+            weight.push_back(entry.second);
+        }
+
+        vector<int64_t> pairCount(ALPHABET * ALPHABET, 0);
+        vector<vector<uint32_t>> where(ALPHABET * ALPHABET);   // may hold stale or repeated entries
+        for (size_t p = 0; p < pieces.size(); ++p) {
+            for (size_t i = 0; i + 1 < pieces[p].size(); ++i) {
+                uint32_t pair = pairIndex(pieces[p][i], pieces[p][i + 1]);
+                pairCount[pair] += weight[p];
+                where[pair].push_back(static_cast<uint32_t>(p));
+            }
+        }
+
+        priority_queue<pair<int64_t, uint32_t>> heap;   // lazily invalidated
+        for (uint32_t pair = 0; pair < pairCount.size(); ++pair) {
+            if (pairCount[pair] > 0) heap.push({pairCount[pair], pair});
+        }
+
+        vector<uint32_t> visited(pieces.size(), 0);
+        vector<uint32_t> touchedAt(pairCount.size(), 0);
+        vector<uint32_t> touched;
+        while (mergeCount() < maxMerges && !heap.empty()) {
+            auto [count, pair] = heap.top();
+            heap.pop();
+            if (pairCount[pair] != count) continue;
+            if (count < 2) break;
+
+            uint16_t a = static_cast<uint16_t>(pair / ALPHABET);
+            uint16_t b = static_cast<uint16_t>(pair % ALPHABET);
+            uint16_t merged = static_cast<uint16_t>(texts.size());
+            rankOf[pair] = static_cast<uint16_t>(merged - 256);
+            pairOfRank.push_back(pair);
+            texts.push_back(texts[a] + texts[b]);
+
+            auto touch = [&](uint32_t k) {
+                if (touchedAt[k] != merged) {
+                    touchedAt[k] = merged;
+                    touched.push_back(k);
+                }
+            };
+            vector<uint32_t> candidates;
+            candidates.swap(where[pair]);
+            touched.clear();
+            for (uint32_t p : candidates) {
+                if (visited[p] == merged) continue;
+                visited[p] = merged;
+                vector<uint16_t>& seq = pieces[p];
+
+                for (size_t i = 0; i + 1 < seq.size(); ++i) {
+                    uint32_t k = pairIndex(seq[i], seq[i + 1]);
+                    pairCount[k] -= weight[p];
+                    touch(k);
+                }
+                size_t out = 0;
+                for (size_t i = 0; i < seq.size(); ++i) {
+                    if (i + 1 < seq.size() && seq[i] == a && seq[i + 1] == b) {
+                        seq[out++] = merged;
+                        i++;
+                    } else {
+                        seq[out++] = seq[i];
+                    }
+                }
+                seq.resize(out);
+                for (size_t i = 0; i + 1 < seq.size(); ++i) {
+                    uint32_t k = pairIndex(seq[i], seq[i + 1]);
+                    pairCount[k] += weight[p];
+                    touch(k);
+                    if (seq[i] == merged || seq[i + 1] == merged) where[k].push_back(p);
+                }
+            }
+            for (uint32_t k : touched) {
+                if (pairCount[k] > 0) heap.push({pairCount[k], k});
+            }
+        }
+    }
+
+    // Appends the ids of one piece: repeatedly apply the earliest-learned merge
+    void split(string_view piece, vector<uint32_t>& out) const {
+        size_t start = out.size();
+        for (char c : piece) out.push_back(static_cast<unsigned char>(c));
+        while (out.size() - start > 1) {
+            uint16_t best = NO_MERGE;
+            for (size_t i = start; i + 1 < out.size(); ++i) {
+                best = min(best, rankOf[pairIndex(out[i], out[i + 1])]);
+            }
+            if (best == NO_MERGE) break;
+
+            uint32_t merged = best + 256u;
+            uint32_t a = pairOfRank[best] / ALPHABET;
+            uint32_t b = pairOfRank[best] % ALPHABET;
+            size_t write = start;
+            for (size_t i = start; i < out.size(); ++i) {
+                if (i + 1 < out.size() && out[i] == a && out[i + 1] == b) {
+                    out[write++] = merged;
+                    i++;
+                } else {
+                    out[write++] = out[i];
+                }
+            }
+            out.resize(write);
+        }
+    }
+
+    void segment(string_view content, Segmentation& seg) const {
+        for (const string& text : texts) seg.symbols.internCopy(text);
+        seg.frequency.assign(texts.size(), 0);
+
+        // Repeated pieces are split once: (offset, length) into cached
+        unordered_map<string_view, pair<uint32_t, uint32_t>> cache;
+        vector<uint32_t> cached;
+        vector<uint32_t> ids;
+        forEachPiece(content, [&](string_view piece) {
+            auto it = cache.find(piece);
+            if (it != cache.end()) {
+                for (uint32_t i = 0; i < it->second.second; ++i) {
+                    uint32_t id = cached[it->second.first + i];
+                    seg.frequency[id]++;
+                    seg.stream.push_back(id);
+                }
+                return;
+            }
+            ids.clear();
+            split(piece, ids);
+            if (cache.size() < CACHE_LIMIT) {
+                cache.emplace(piece, make_pair(static_cast<uint32_t>(cached.size()), static_cast<uint32_t>(ids.size())));
+                cached.insert(cached.end(), ids.begin(), ids.end());
+            }
+            for (uint32_t id : ids) {
+                seg.frequency[id]++;
+                seg.stream.push_back(id);
+            }
+        });
+    }
+};
+
+struct ModelEstimate {
+    SymbolModel model;
+    double payloadBytes;
+    double dictionaryBytes;
+
+    double total() const {
+        return payloadBytes + dictionaryBytes;
+    }
+};
+
+// Up to `budget` bytes of content: all of it when it fits, otherwise evenly
+// spaced blocks moved to whitespace so that most word units stay whole
+inline string sampleContent(string_view content, size_t budget = 1 << 20) {
+    if (content.size() <= budget) return string(content);
+
+    const size_t blocks = 16;
+    const size_t slack = 256;
+    size_t blockSize = budget / blocks;
+    size_t stride = content.size() / blocks;
+    auto toBoundary = [&](size_t pos) {
+        size_t limit = min(content.size(), pos + slack);
+        size_t at = pos;
+        while (at < limit && !isTokenSpace(content[at])) at++;
+        while (at < limit && isTokenSpace(content[at])) at++;
+        return at < limit ? at : pos;
+    };
+
+    string sample;
+    sample.reserve(budget + 2 * blocks * slack);
+    for (size_t b = 0; b < blocks; ++b) {
+        size_t start = b == 0 ? 0 : toBoundary(b * stride);
+        size_t end = toBoundary(min(content.size(), start + blockSize));
+        sample.append(content.substr(start, end - start));
+    }
+    return sample;
+}
+
+// Estimates the output of one model from segmentations of the whole sample
+// and of its first half. The vocabulary is extrapolated with Heaps' law
+// V(n) ~ n^beta, beta measured between the two.
+inline ModelEstimate estimateModel(SymbolModel model, const Segmentation& full, const Segmentation& half,
+                                   double scale, double bytesPerChar) {
+    auto used = [](const Segmentation& seg) {
+        size_t count = 0;
+        for (int f : seg.frequency) count += f > 0;
+        return count;
+    };
+
+    double total = 0;
+    for (int f : full.frequency) total += f;
+    double bits = 0;
+    double dictionary = 0;
+    for (size_t id = 0; id < full.frequency.size(); ++id) {
+        int f = full.frequency[id];
+        if (f == 0) continue;
+        bits += f * log2(total / f);
+        dictionary += full.symbols.symbol(static_cast<int>(id)).size() * bytesPerChar + 2;  // + length and code length
+    }
+
+    double beta = 0;
+    size_t fullUsed = used(full);
+    size_t halfUsed = used(half);
+    if (halfUsed > 0 && fullUsed > halfUsed) beta = min(1.0, log2(static_cast<double>(fullUsed) / halfUsed));
+
+    ModelEstimate estimate;
+    estimate.model = model;
+    estimate.payloadBytes = bits / 8 * scale;
+    estimate.dictionaryBytes = dictionary * pow(scale, beta);
+    return estimate;
+}
+
+// Estimates every model from a sample standing for `scale` times as much
+// input. subword receives the merges learned on the sample.
+inline vector<ModelEstimate> estimateSymbolModels(string_view sample, double scale, double bytesPerChar,
+                                                  SubwordModel& subword) {
+    size_t cut = sample.size() / 2;
+    while (cut < sample.size() && !isTokenSpace(sample[cut])) cut++;
+    string_view firstHalf = sample.substr(0, cut);
+
+    subword.learn(sampleContent(sample, 1 << 18));
+
+    vector<ModelEstimate> results;
+    for (SymbolModel model : {SymbolModel::Word, SymbolModel::Byte, SymbolModel::Subword}) {
+        Segmentation full, half;
+        if (model == SymbolModel::Word) {
+            segmentWords(sample, full);
+            segmentWords(firstHalf, half);
+        } else if (model == SymbolModel::Byte) {
+            segmentBytes(sample, full);
+            segmentBytes(firstHalf, half);
+        } else {
+            subword.segment(sample, full);
+            subword.segment(firstHalf, half);
+        }
+        results.push_back(estimateModel(model, full, half, scale, bytesPerChar));
+    }
+    return results;
+}
+
+// Picks the cheapest model for content. subword receives the merges learned
+// on the sample so the encoder can reuse them. bytesPerChar is what one
+// character of a symbol costs in the dictionary (RSA ciphertext is bigger).
+inline SymbolModel chooseSymbolModel(string_view content, double bytesPerChar, SubwordModel& subword,
+                                     vector<ModelEstimate>* estimates = nullptr) {
+    string sample = sampleContent(content);
+    double scale = sample.empty() ? 1.0 : static_cast<double>(content.size()) / sample.size();
+    vector<ModelEstimate> results = estimateSymbolModels(sample, scale, bytesPerChar, subword);
+
+    SymbolModel best = SymbolModel::Word;
+    double bestTotal = results[0].total();
+    for (const ModelEstimate& estimate : results) {
+        if (estimate.total() < bestTotal) {
+            best = estimate.model;
+            bestTotal = estimate.total();
+        }
+    }
+    if (estimates) *estimates = move(results);
+    return best;
+}
+
+#endif
@@ -0,0 +1,201 @@
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <exception>
+#include <iostream>
+
+using namespace std;
+
+// Work-stealing thread pool. Every worker owns a deque: it pushes and pops its
+// own tasks at the back (newest first, which keeps a task's sub-tasks hot in
+// cache) and, when it runs dry, steals the oldest task from the front of
+// another worker's deque. Tasks submitted from outside the pool are spread
+// round-robin over the deques.
+class WorkStealingPool {
+public:
+    using Task = function<void()>;
+
+private:
+    struct WorkerQueue {
+        mutex lock;
+        deque<Task> tasks;
+    };
+
+    vector<unique_ptr<WorkerQueue>> queues;
+    vector<thread> workers;
+    atomic<size_t> queued{0};       // tasks sitting in some deque
+    atomic<size_t> pending{0};      // tasks submitted and not yet finished
+    atomic<size_t> nextQueue{0};
+    bool stopping = false;
+    mutex sleepLock;
+    condition_variable wake, idle;
+
+    // Index of the worker running on this thread, or -1 outside the pool
+    static int &currentWorker() {
+        static thread_local int index = -1;
+        return index;
+    }
+
+    bool popLocal(size_t index, Task &task) {
+        WorkerQueue &queue = *queues[index];
+        lock_guard<mutex> guard(queue.lock);
+        if (queue.tasks.empty()) return false;
+        task = move(queue.tasks.back());
+        queue.tasks.pop_back();
+        queued--;
+        return true;
+    }
+
+    bool steal(size_t thief, Task &task) {
+        for (size_t k = 1; k <= queues.size(); ++k) {
+            WorkerQueue &queue = *queues[(thief + k) % queues.size()];
+            lock_guard<mutex> guard(queue.lock);
+            if (queue.tasks.empty()) continue;
+            task = move(queue.tasks.front());
+            queue.tasks.pop_front();
+            queued--;
+            return true;
+        }
+        return false;
+    }
+
+    void execute(Task &task) {
+        try {
+            task();
+        } catch (const exception &e) {
+            cerr << "Unhandled exception in pool task: " << e.what() << endl;
+        } catch (...) {
+            cerr << "Unhandled exception in pool task" << endl;
+        }
+        if (--pending == 0) {
+            lock_guard<mutex> guard(sleepLock);
+            idle.notify_all();
+        }
+    }
+
+    void workerLoop(size_t index) {
+        currentWorker() = static_cast<int>(index);
+        Task task;
+        while (true) {
+            if (popLocal(index, task) || steal(index, task)) {
+                execute(task);
+                task = nullptr;
+                continue;
+            }
+            unique_lock<mutex> guard(sleepLock);
+            wake.wait(guard, [this] { return stopping || queued > 0; });
+            if (stopping && queued == 0) return;
+        }
+    }
+
+public:
+    explicit WorkStealingPool(size_t threadCount = thread::hardware_concurrency()) {
+        if (threadCount == 0) threadCount = 1;
+        for (size_t i = 0; i < threadCount; ++i) {
+            queues.emplace_back(new WorkerQueue());
+        }
+        for (size_t i = 0; i < threadCount; ++i) {
+            workers.emplace_back(&WorkStealingPool::workerLoop, this, i);
+        }
+    }
+
+    WorkStealingPool(const WorkStealingPool &) = delete;
+    WorkStealingPool &operator=(const WorkStealingPool &) = delete;
+
+    // Finishes every queued task, then stops the workers
+    ~WorkStealingPool() {
+        waitIdle();
+        {
+            lock_guard<mutex> guard(sleepLock);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (thread &worker : workers) worker.join();
+    }
+
+    size_t size() const {
+        return workers.size();
+    }
+
+    void submit(Task task) {
+        int self = currentWorker();
+        size_t index = self >= 0 ? static_cast<size_t>(self) : nextQueue++ % queues.size();
+        pending++;
+        {
+            lock_guard<mutex> guard(queues[index]->lock);
+            queues[index]->tasks.push_back(move(task));
+            queued++;
+        }
+        lock_guard<mutex> guard(sleepLock);
+        wake.notify_one();
+    }
+
+    // Runs one queued task on the calling thread, if there is one. Lets a task
+    // that waits on its sub-tasks help with them instead of blocking a worker.
+    bool runPendingTask() {
+        int self = currentWorker();
+        size_t index = self >= 0 ? static_cast<size_t>(self) : 0;
+        Task task;
+        if ((self >= 0 && popLocal(index, task)) || steal(index, task)) {
+            execute(task);
+            return true;
+        }
+        return false;
+    }
+
+    // Blocks until every submitted task (including tasks they spawned) is done
+    void waitIdle() {
+        unique_lock<mutex> guard(sleepLock);
+        idle.wait(guard, [this] { return pending == 0; });
+    }
+};
+
+// Fork/join helper: run() spawns sub-tasks into the pool and wait() returns once
+// they have all finished, executing pool work meanwhile. The first exception a
+// sub-task throws is rethrown from wait().
+class TaskGroup {
+private:
+    WorkStealingPool &pool;
+    atomic<size_t> remaining{0};
+    mutex errorLock;
+    exception_ptr error;
+
+public:
+    explicit TaskGroup(WorkStealingPool &p) : pool(p) {}
+
+    ~TaskGroup() {
+        while (remaining > 0) {
+            if (!pool.runPendingTask()) this_thread::yield();
+        }
+    }
+
+    void run(function<void()> task) {
+        remaining++;
+        pool.submit([this, task] {
+            try {
+                task();
+            } catch (...) {
+                lock_guard<mutex> guard(errorLock);
+                if (!error) error = current_exception();
+            }
+            remaining--;
+        });
+    }
+
+    void wait() {
+        while (remaining > 0) {
+            if (!pool.runPendingTask()) this_thread::yield();
+        }
+        if (error) rethrow_exception(error);
+    }
+};
+
+#endif
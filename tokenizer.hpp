@@ -0,0 +1,185 @@
+#ifndef TOKENIZER_HPP
+#define TOKENIZER_HPP
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <cstring>
+#include <cstdint>
+#include "delimiter_scan.hpp"
+
+using namespace std;
+
+// Same whitespace set operator>> uses in the "C" locale
+constexpr bool isTokenSpace(char c) {
+    return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+// FNV-1a over the token bytes; shared by the symbol table and the codebook maps
+inline uint64_t hashToken(string_view token) {
+    uint64_t h = 1469598103934665603ULL;
+    for (char c : token) {
+        h ^= static_cast<unsigned char>(c);
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+// Splits a buffer on whitespace without copying; tokens are views into the
+// buffer. Token boundaries come from the vectorized scanner a batch at a time.
+class Tokenizer {
+private:
+    string_view buffer;
+    DelimiterScanner<WhitespaceDelimiters> scanner;
+    const size_t* bounds;    // start, end, start, end, ...
+    size_t count = 0;
+    size_t index = 0;
+
+public:
+    explicit Tokenizer(string_view buf)
+        : buffer(buf), scanner(buf, DelimiterScanner<WhitespaceDelimiters>::BOUNDARIES), bounds(scanner.batch()) {}
+
+    Tokenizer(const Tokenizer &other) : buffer(other.buffer), scanner(other.scanner), bounds(scanner.batch()),
+                                        count(other.count), index(other.index) {}
+
+    Tokenizer &operator=(const Tokenizer &other) {
+        buffer = other.buffer;
+        scanner = other.scanner;
+        bounds = scanner.batch();
+        count = other.count;
+        index = other.index;
+        return *this;
+    }
+
+    bool next(string_view &token) {
+        if (index + 2 <= count) {
+            token = string_view(buffer.data() + bounds[index], bounds[index + 1] - bounds[index]);
+            index += 2;
+            return true;
+        }
+        // A token that starts at the end of one batch ends at the front of the next
+        bool carried = index < count;
+        size_t start = carried ? bounds[index] : 0;
+        count = scanner.next();
+        index = 0;
+        if (count == 0) return false;
+        if (carried) {
+            token = string_view(buffer.data() + start, bounds[0] - start);
+            index = 1;
+            return true;
+        }
+        return next(token);
+    }
+};
+
+// Interns each distinct token once and hands out dense integer IDs (0, 1, 2, ...)
+class SymbolTable {
+private:
+    static const size_t ARENA_BLOCK = 64 * 1024;
+
+    vector<string_view> symbols;    // id -> token text
+    vector<uint64_t> hashes;        // id -> hash, kept so growing never rehashes text
+    vector<int> slots;              // open-addressing index, -1 = empty
+    vector<unique_ptr<char[]>> arena;
+    size_t arenaUsed = ARENA_BLOCK;
+
+    size_t findSlot(string_view token, uint64_t h) const {
+        size_t mask = slots.size() - 1;
+        size_t i = h & mask;
+        while (slots[i] != -1) {
+            int id = slots[i];
+            if (hashes[id] == h && symbols[id] == token) return i;
+            i = (i + 1) & mask;
+        }
+        return i;
+    }
+
+    void grow() {
+        size_t newSize = slots.empty() ? 1024 : slots.size() * 2;
+        slots.assign(newSize, -1);
+        size_t mask = newSize - 1;
+        for (size_t id = 0; id < symbols.size(); ++id) {
+            size_t i = hashes[id] & mask;
+            while (slots[i] != -1) i = (i + 1) & mask;
+            slots[i] = static_cast<int>(id);
+        }
+    }
+
+    string_view copyToArena(string_view token) {
+        if (token.size() > ARENA_BLOCK / 4) {
+            arena.emplace_back(new char[token.size()]);
+            memcpy(arena.back().get(), token.data(), token.size());
+            string_view stored(arena.back().get(), token.size());
+            // Keep filling the previous block, not this dedicated one
+            if (arena.size() > 1) swap(arena[arena.size() - 1], arena[arena.size() - 2]);
+            return stored;
+        }
+        if (arenaUsed + token.size() > ARENA_BLOCK) {
+            arena.emplace_back(new char[ARENA_BLOCK]);
+            arenaUsed = 0;
+        }
+        char *dest = arena.back().get() + arenaUsed;
+        memcpy(dest, token.data(), token.size());
+        arenaUsed += token.size();
+        return string_view(dest, token.size());
+    }
+
+    int insert(string_view token, bool copy) {
+        if ((symbols.size() + 1) * 2 > slots.size()) grow();
+
+        uint64_t h = hashToken(token);
+        size_t slot = findSlot(token, h);
+        if (slots[slot] != -1) return slots[slot];
+
+        int id = static_cast<int>(symbols.size());
+        symbols.push_back(copy ? copyToArena(token) : token);
+        hashes.push_back(h);
+        slots[slot] = id;
+        return id;
+    }
+
+public:
+    SymbolTable() = default;
+    SymbolTable(const SymbolTable &) = delete;
+    SymbolTable &operator=(const SymbolTable &) = delete;
+    // Moving keeps every view valid: arena blocks are heap-allocated and move with the table
+    SymbolTable(SymbolTable &&) = default;
+    SymbolTable &operator=(SymbolTable &&) = default;
+
+    // Intern a view into a buffer that outlives this table (no copy is made)
+    int intern(string_view token) {
+        return insert(token, false);
+    }
+
+    // Intern a token whose storage is temporary; the text is copied into the arena once
+    int internCopy(string_view token) {
+        return insert(token, true);
+    }
+
+    // Returns the id of a token, or -1 if it was never interned
+    int find(string_view token) const {
+        if (slots.empty()) return -1;
+        return slots[findSlot(token, hashToken(token))];
+    }
+
+    string_view symbol(int id) const {
+        return symbols[id];
+    }
+
+    // hashToken(symbol(id)), cached from interning
+    uint64_t hashOf(int id) const {
+        return hashes[id];
+    }
+
+    size_t size() const {
+        return symbols.size();
+    }
+
+    void reserve(size_t n) {
+        symbols.reserve(n);
+        hashes.reserve(n);
+    }
+};
+
+#endif